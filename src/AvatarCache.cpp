@@ -0,0 +1,63 @@
+#include "AvatarCache.hpp"
+
+#include <QWidget>
+#include <QMimeDatabase>
+
+#include "matrix/Room.hpp"
+#include "matrix/Session.hpp"
+#include "matrix/Trace.hpp"
+
+AvatarCache::AvatarCache(QWidget &view)
+  : view_(view), unset_(QIcon::fromTheme("unknown")), loading_(QIcon::fromTheme("image-loading", unset_)) {}
+
+void AvatarCache::ref(matrix::Room &room, const matrix::Content &content, qreal size) {
+  auto result = avatars_.emplace(std::piecewise_construct,
+                                 std::forward_as_tuple(content),
+                                 std::forward_as_tuple());
+  if(result.second) {
+    // New avatar, download it
+    auto reply = room.session().get_thumbnail(result.first->first, view_.devicePixelRatioF() * QSize(size, size));
+    QObject::connect(reply, &matrix::ContentFetch::finished, &view_,
+                     [this, size](const matrix::Content &c, const QString &type, const QString &, const QByteArray &data) {
+                       set(c, type, data, size);
+                     });
+    QObject::connect(reply, &matrix::ContentFetch::error, &room, &matrix::Room::error);
+  }
+  ++result.first->second.references;
+}
+
+void AvatarCache::unref(const matrix::Content &content) {
+  auto it = avatars_.find(content);
+  --it->second.references;
+  if(it->second.references == 0) {
+    avatars_.erase(it);
+  }
+}
+
+void AvatarCache::clear() {
+  avatars_.clear();
+}
+
+QPixmap AvatarCache::pixmap(const std::experimental::optional<matrix::Content> &content, qreal size) const {
+  if(!content) return unset_.pixmap(size, size);
+  const auto &a = avatars_.at(*content);
+  return a.pixmap.isNull() ? loading_.pixmap(size, size) : a.pixmap;
+}
+
+void AvatarCache::set(const matrix::Content &content, const QString &type, const QByteArray &data, qreal size) {
+  auto it = avatars_.find(content);
+  if(it == avatars_.end()) return;  // Avatar is no longer necessary
+
+  TRACE_OPERATION("image decode", type);
+  QPixmap pixmap;
+  pixmap.loadFromData(data, QMimeDatabase().mimeTypeForName(type.toUtf8()).preferredSuffix().toUtf8().constData());
+  if(pixmap.isNull()) pixmap.loadFromData(data);
+
+  const auto ratio = view_.devicePixelRatioF();
+  const auto extent = size * ratio;
+  if(pixmap.width() > extent || pixmap.height() > extent)
+    pixmap = pixmap.scaled(extent, extent, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+  pixmap.setDevicePixelRatio(ratio);
+  it->second.pixmap = pixmap;
+  view_.update();
+}
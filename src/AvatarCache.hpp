@@ -0,0 +1,44 @@
+#ifndef NATIVE_CHAT_AVATAR_CACHE_HPP_
+#define NATIVE_CHAT_AVATAR_CACHE_HPP_
+
+#include <unordered_map>
+#include <experimental/optional>
+
+#include <QIcon>
+#include <QPixmap>
+
+#include "matrix/Content.hpp"
+
+class QWidget;
+
+namespace matrix {
+class Room;
+}
+
+class AvatarCache {
+public:
+  explicit AvatarCache(QWidget &view);
+  // Holds the avatars of the blocks drawn in view, which is repainted as they arrive
+
+  void ref(matrix::Room &room, const matrix::Content &content, qreal size);
+  // Fetches content at size logical pixels square unless it's already held. Errors are reported through room.
+  void unref(const matrix::Content &content);
+  void clear();
+
+  QPixmap pixmap(const std::experimental::optional<matrix::Content> &content, qreal size) const;
+  // Image to draw for content, or a placeholder if it's unset or hasn't arrived yet
+
+private:
+  struct Avatar {
+    size_t references = 0;
+    QPixmap pixmap;
+  };
+
+  QWidget &view_;
+  std::unordered_map<matrix::Content, Avatar> avatars_;
+  QIcon unset_, loading_;
+
+  void set(const matrix::Content &content, const QString &type, const QByteArray &data, qreal size);
+};
+
+#endif
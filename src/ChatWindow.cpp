@@ -73,7 +73,7 @@ void ChatWindow::add(matrix::Room &r, RoomView *v) {
   v->setFocus();
 }
 
-void ChatWindow::add_or_focus(matrix::Room &room) {
+RoomView *ChatWindow::add_or_focus(matrix::Room &room) {
   RoomView *view;
   if(rooms_.find(room.id()) == rooms_.end()) {
     view = new RoomView(room, this);
@@ -83,6 +83,16 @@ void ChatWindow::add_or_focus(matrix::Room &room) {
     view = static_cast<RoomView*>(ui->room_stack->currentWidget());
   }
   view->setFocus();
+  return view;
+}
+
+std::vector<RoomView *> ChatWindow::views() const {
+  std::vector<RoomView *> result;
+  result.reserve(room_list_->count());
+  for(int i = 0; i < room_list_->count(); ++i) {
+    result.push_back(rooms_.at(matrix::RoomID(room_list_->item(i)->data(Qt::UserRole).toString())));
+  }
+  return result;
 }
 
 void ChatWindow::room_display_changed(matrix::Room &room) {
@@ -113,8 +123,12 @@ void ChatWindow::current_changed(int i) {
 
 void ChatWindow::changeEvent(QEvent *e) {   
   QWidget::changeEvent(e);
-  if(e->type() == QEvent::ActivationChange && isActiveWindow()) {
-    focused(focused_room());
+  if(e->type() == QEvent::ActivationChange) {
+    if(isActiveWindow()) {
+      focused(focused_room());
+    } else if(auto w = ui->room_stack->currentWidget()) {
+      static_cast<RoomView*>(w)->room().flush_read_receipt();
+    }
   }
 }
 
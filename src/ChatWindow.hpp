@@ -3,6 +3,7 @@
 
 #include <unordered_map>
 #include <memory>
+#include <vector>
 
 #include <QWidget>
 
@@ -28,13 +29,16 @@ public:
   ~ChatWindow();
 
   void add(matrix::Room &r, RoomView *); // Takes ownership
-  void add_or_focus(matrix::Room &);
+  RoomView *add_or_focus(matrix::Room &);
   void room_display_changed(matrix::Room &);
 
   RoomView *take(const matrix::RoomID &); // Releases ownership
 
   const matrix::RoomID &focused_room() const;
 
+  std::vector<RoomView *> views() const;
+  // In the order they're listed
+
 signals:
   void focused(const matrix::RoomID &);
   void released(const matrix::RoomID &);
@@ -6,7 +6,8 @@
 
 static constexpr size_t INPUT_HISTORY_SIZE = 127;
 
-EntryBox::EntryBox(QWidget *parent) : QTextEdit(parent), true_history_(INPUT_HISTORY_SIZE), working_history_(1), history_index_(0) {
+EntryBox::EntryBox(QWidget *parent) : QTextEdit(parent), true_history_(INPUT_HISTORY_SIZE), working_history_(1), history_index_(0),
+                                          completion_index_(0), completion_start_(0), completion_end_(0) {
   connect(document()->documentLayout(), &QAbstractTextDocumentLayout::documentSizeChanged, this, &EntryBox::updateGeometry);
   QSizePolicy policy(QSizePolicy::Ignored, QSizePolicy::Maximum);
   policy.setHorizontalStretch(1);
@@ -38,8 +39,18 @@ void EntryBox::keyPressEvent(QKeyEvent *event) {
   activity();
 
   auto modifiers = QGuiApplication::keyboardModifiers();
-  // TODO: Autocomplete
+  if(event->key() != Qt::Key_Tab && event->key() != Qt::Key_Backtab) {
+    completions_.clear();
+  }
   switch(event->key()) {
+  case Qt::Key_Tab:
+  case Qt::Key_Backtab:
+    if(completer_) {
+      complete(event->key() == Qt::Key_Backtab);
+    } else {
+      QTextEdit::keyPressEvent(event);
+    }
+    break;
   case Qt::Key_Return:
   case Qt::Key_Enter:
     if(!(modifiers & Qt::ShiftModifier)) {
@@ -80,6 +91,47 @@ void EntryBox::keyPressEvent(QKeyEvent *event) {
   }
 }
 
+void EntryBox::complete(bool backward) {
+  if(!completions_.empty()) {
+    if(backward) {
+      completion_index_ = (completion_index_ + completions_.size() - 1) % completions_.size();
+    } else {
+      completion_index_ = (completion_index_ + 1) % completions_.size();
+    }
+    insert_completion();
+    return;
+  }
+
+  const QString text = toPlainText();
+  const int end = textCursor().position();
+  int start = end;
+  while(start > 0 && !text[start-1].isSpace()) {
+    --start;
+  }
+  if(start == end) return;
+
+  completions_ = completer_(text.mid(start, end - start));
+  if(completions_.empty()) return;
+  completion_index_ = backward ? completions_.size() - 1 : 0;
+  completion_start_ = start;
+  completion_end_ = end;
+  insert_completion();
+}
+
+void EntryBox::insert_completion() {
+  QString replacement = completions_[completion_index_];
+  // Address people IRC-style when completing at the start of a message
+  if(completion_start_ == 0 && !replacement.startsWith('#')) replacement += ":";
+  replacement += " ";
+
+  auto cursor = textCursor();
+  cursor.setPosition(completion_start_);
+  cursor.setPosition(completion_end_, QTextCursor::KeepAnchor);
+  cursor.insertText(replacement);
+  completion_end_ = completion_start_ + replacement.size();
+  setTextCursor(cursor);
+}
+
 void EntryBox::text_changed() {
   working_history_[history_index_] = toPlainText();
 }
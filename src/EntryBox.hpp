@@ -2,6 +2,8 @@
 #define NATIVE_CHAT_ENTRY_BOX_HPP_
 
 #include <deque>
+#include <vector>
+#include <functional>
 
 #include <QTextEdit>
 
@@ -16,6 +18,10 @@ public:
 
   void send();
 
+  using Completer = std::function<std::vector<QString>(const QString &prefix)>;
+  void set_completer(Completer completer) { completer_ = std::move(completer); }
+  // Supplies candidates for tab completion, best first
+
 signals:
   void message(const QString &);
   void command(const QString &name, const QString &args);
@@ -30,7 +36,15 @@ private:
   std::deque<QString> true_history_, working_history_;
   size_t history_index_;
 
+  Completer completer_;
+  std::vector<QString> completions_;
+  size_t completion_index_;
+  int completion_start_, completion_end_;
+  // Span of the text most recently inserted by completion, to be replaced when cycling
+
   void text_changed();
+  void complete(bool backward);
+  void insert_completion();
 };
 
 #endif
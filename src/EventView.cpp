@@ -16,13 +16,18 @@
 #include <QRegularExpression>
 #include <QMimeData>
 #include <QPointer>
+#include <QFileDialog>
+#include <QFile>
+#include <QScrollBar>
 
 #include "qstringbuilder.h"
 
 #include "matrix/Session.hpp"
+#include "matrix/Trace.hpp"
 
 #include "RedactDialog.hpp"
 #include "EventSourceView.hpp"
+#include "MessageBox.hpp"
 
 using std::experimental::optional;
 
@@ -33,6 +38,13 @@ static auto to_time_point(uint64_t ts) {
       + std::chrono::duration<uint64_t, std::milli>(ts);
 }
 
+static bool is_file_like(const matrix::event::room::MessageContent &content) {
+  return content.type() == matrix::event::room::message::File::tag()
+    || content.type() == matrix::event::room::message::Image::tag()
+    || content.type() == matrix::event::room::message::Video::tag()
+    || content.type() == matrix::event::room::message::Audio::tag();
+}
+
 static QString pretty_size(double n) {
   constexpr const static char *const units[9] = {"B", "KiB", "MiB", "GiB", "TiB", "PiB", "EiB", "ZiB", "YiB"}; // should be enough for anyone!
   auto idx = std::min<size_t>(8, std::log(n)/std::log(1024.));
@@ -40,7 +52,7 @@ static QString pretty_size(double n) {
 }
 
 std::vector<std::pair<QString, QVector<QTextLayout::FormatRange>>>
-  BlockRenderInfo::format_text(const matrix::RoomState &state, const matrix::event::Room &evt, const QString &str) const {
+  BlockRenderInfo::format_text(const matrix::RoomState &state, const matrix::event::Room &evt, const QString &str, bool highlight) const {
 
   std::vector<std::pair<QString, QVector<QTextLayout::FormatRange>>> result;
   const static QRegularExpression line_re("\\R", QRegularExpression::UseUnicodePropertiesOption | QRegularExpression::OptimizeOnFirstUsageOption);
@@ -57,12 +69,6 @@ std::vector<std::pair<QString, QVector<QTextLayout::FormatRange>>>
     }
   }
 
-  // Detect highlights
-  auto self_member = state.member_from_id(self());
-  const bool highlight =
-    self_member
-    && ((self_member->displayname() && str.toCaseFolded().contains(self_member->displayname()->toCaseFolded()))
-        || str.toCaseFolded().contains(self().value()));
   if(highlight) {
     QTextCharFormat highlight_format;
     highlight_format.setFontWeight(QFont::Bold);
@@ -108,16 +114,14 @@ std::vector<std::pair<QString, QVector<QTextLayout::FormatRange>>>
   return result;
 }
 
-Event::Event(const BlockRenderInfo &info, const matrix::RoomState &state, const matrix::event::Room &e)
+Event::Event(const BlockRenderInfo &info, const matrix::RoomState &state, const matrix::event::Room &e, bool highlight)
   : data(e), time(to_time_point(e.origin_server_ts())) {
+  TRACE_SCOPE("Event::Event");
   std::vector<std::pair<QString, QVector<QTextLayout::FormatRange>>> lines;
   if(e.type() == matrix::event::room::Message::tag()) {
     matrix::event::room::Message msg(e);
     const auto &content = msg.content();
-    if(content.type() == matrix::event::room::message::File::tag()
-       || content.type() == matrix::event::room::message::Image::tag()
-       || content.type() == matrix::event::room::message::Video::tag()
-       || content.type() == matrix::event::room::message::Audio::tag()) {
+    if(is_file_like(content)) {
       matrix::event::room::message::FileLike file(content);
       lines.emplace_back();
       auto &line = lines.front();
@@ -152,7 +156,7 @@ Event::Event(const BlockRenderInfo &info, const matrix::RoomState &state, const
       if(type || size)
         line.first += ")";
     } else {
-      lines = info.format_text(state, e, content.body());
+      lines = info.format_text(state, e, content.body(), highlight);
     }
   } else if(e.type() == matrix::event::room::Member::tag()) {
     matrix::event::room::Member member{matrix::event::room::State{e}};
@@ -161,21 +165,21 @@ Event::Event(const BlockRenderInfo &info, const matrix::RoomState &state, const
       auto invitee = state.member_from_id(member.user());
       if(!invitee) {
         qDebug() << "got invite for non-member" << member.user().value() << "probably due to SYN-645";
-        lines = info.format_text(state, e, QObject::tr("SYN-645 related error"));
+        lines = info.format_text(state, e, QObject::tr("SYN-645 related error"), highlight);
       } else {
-        lines = info.format_text(state, e, QObject::tr("invited %1").arg(state.member_name(*invitee)));
+        lines = info.format_text(state, e, QObject::tr("invited %1").arg(state.member_name(*invitee)), highlight);
       }
       break;
     }
     case matrix::Membership::JOIN: {
       if(!member.prev_content()) {
-        lines = info.format_text(state, e, QObject::tr("joined"));
+        lines = info.format_text(state, e, QObject::tr("joined"), highlight);
         break;
       }
       const auto &prev = *member.prev_content();
       switch(prev.membership()) {
       case matrix::Membership::INVITE:
-        lines = info.format_text(state, e, QObject::tr("accepted invite"));
+        lines = info.format_text(state, e, QObject::tr("accepted invite"), highlight);
         break;
       case matrix::Membership::JOIN: {
         const bool avatar_changed = prev.avatar_url() != member.content().avatar_url();
@@ -184,39 +188,39 @@ Event::Event(const BlockRenderInfo &info, const matrix::RoomState &state, const
         const bool dn_changed = old_dn != new_dn;
         if(avatar_changed && dn_changed) {
           if(!new_dn)
-            lines = info.format_text(state, e, QObject::tr("unset display name and changed avatar"));
+            lines = info.format_text(state, e, QObject::tr("unset display name and changed avatar"), highlight);
           else
-            lines = info.format_text(state, e, QObject::tr("changed display name to %1 and changed avatar").arg(*new_dn));
+            lines = info.format_text(state, e, QObject::tr("changed display name to %1 and changed avatar").arg(*new_dn), highlight);
         } else if(avatar_changed) {
-          lines = info.format_text(state, e, QObject::tr("changed avatar"));
+          lines = info.format_text(state, e, QObject::tr("changed avatar"), highlight);
         } else if(dn_changed) {
           if(!new_dn) {
-            lines = info.format_text(state, e, QObject::tr("unset display name"));
+            lines = info.format_text(state, e, QObject::tr("unset display name"), highlight);
           } else if(!old_dn) {
-            lines = info.format_text(state, e, QObject::tr("set display name to %1").arg(*new_dn));
+            lines = info.format_text(state, e, QObject::tr("set display name to %1").arg(*new_dn), highlight);
           } else {
-            lines = info.format_text(state, e, QObject::tr("changed display name from %1 to %2").arg(*old_dn).arg(*new_dn));
+            lines = info.format_text(state, e, QObject::tr("changed display name from %1 to %2").arg(*old_dn).arg(*new_dn), highlight);
           }
         } else {
-          lines = info.format_text(state, e, QObject::tr("sent a no-op join"));
+          lines = info.format_text(state, e, QObject::tr("sent a no-op join"), highlight);
         }
         break;
       }
       default:
-        lines = info.format_text(state, e, QObject::tr("joined"));
+        lines = info.format_text(state, e, QObject::tr("joined"), highlight);
         break;
       }
       break;
     }
     case matrix::Membership::LEAVE: {
       if(member.user() == member.sender()) {
-        lines = info.format_text(state, e, QObject::tr("left"));
+        lines = info.format_text(state, e, QObject::tr("left"), highlight);
       } else {
         auto gone = state.member_from_id(member.user());
         if(!gone) {
           qDebug() << "got leave for non-member" << member.user().value();
         }
-        lines = info.format_text(state, e, QObject::tr("kicked %1").arg(gone ? state.member_name(*gone) : member.user().value()));
+        lines = info.format_text(state, e, QObject::tr("kicked %1").arg(gone ? state.member_name(*gone) : member.user().value()), highlight);
       }
       break;
     }
@@ -224,17 +228,17 @@ Event::Event(const BlockRenderInfo &info, const matrix::RoomState &state, const
       auto banned = state.member_from_id(member.user());
       if(!banned) {
         qDebug() << "INTERNAL ERROR: displaying ban of unknown member" << member.user().value();
-        lines = info.format_text(state, e, QObject::tr("banned %1").arg(member.user().value()));
+        lines = info.format_text(state, e, QObject::tr("banned %1").arg(member.user().value()), highlight);
       } else {
-        lines = info.format_text(state, e, QObject::tr("banned %1").arg(state.member_name(*banned)));
+        lines = info.format_text(state, e, QObject::tr("banned %1").arg(state.member_name(*banned)), highlight);
       }
       break;
     }
     }
   } else if(e.type() == matrix::event::room::Create::tag()) {
-    lines = info.format_text(state, e, QObject::tr("created the room"));
+    lines = info.format_text(state, e, QObject::tr("created the room"), highlight);
   } else {
-    lines = info.format_text(state, e, QObject::tr("unrecognized event type %1").arg(e.type().value()));
+    lines = info.format_text(state, e, QObject::tr("unrecognized event type %1").arg(e.type().value()), highlight);
   }
   layouts = std::vector<QTextLayout>(lines.size());
   QTextOption body_options;
@@ -331,6 +335,7 @@ void Block::update_header(const BlockRenderInfo &info, const matrix::RoomState &
 }
 
 void Block::update_layout(const BlockRenderInfo &info) {
+  TRACE_SCOPE("Block::update_layout");
   auto metrics = info.metrics();
 
   {
@@ -374,6 +379,7 @@ void Block::update_layout(const BlockRenderInfo &info) {
 }
 
 void Event::update_layout(const BlockRenderInfo &g) {
+  TRACE_SCOPE("Event::update_layout");
   qreal height = 0;
   for(auto &layout : layouts) {
     layout.beginLayout();
@@ -525,17 +531,59 @@ static void populate_menu_link(const matrix::Room &room, QMenu &menu, const QUrl
     });
 }
 
+static void save_file(matrix::Session &session, const matrix::Content &content, const QString &path) {
+  auto file = new QFile(path);
+  if(!file->open(QIODevice::WriteOnly)) {
+    MessageBox::critical(QObject::tr("Error saving file"), QObject::tr("Couldn't open %1: %2").arg(path).arg(file->errorString()));
+    delete file;
+    return;
+  }
+  auto download = session.download(content, *file);
+  file->setParent(download);  // Flushed and closed when the download completes
+  QObject::connect(download, &matrix::ContentDownload::error, [path](const QString &msg) {
+      MessageBox::critical(QObject::tr("Error saving file"), QObject::tr("Couldn't download %1: %2").arg(path).arg(msg));
+    });
+}
+
+static void populate_menu_file(matrix::Room &room, QMenu &menu, const matrix::event::room::message::FileLike &file) {
+  optional<matrix::Content> content;
+  try {
+    content = matrix::Content(QUrl(file.url()));
+  } catch(const std::invalid_argument &) {
+    return;
+  }
+  QString name = file.body();
+  if(file.type() == matrix::event::room::message::File::tag()) {
+    name = matrix::event::room::message::File(file).filename();
+  }
+  QPointer<matrix::Session> session = &room.session();
+  auto save_action = menu.addAction(QIcon::fromTheme("document-save-as"), QObject::tr("&Save as..."));
+  QObject::connect(save_action, &QAction::triggered, [session, content, name]() {
+      const QString path = QFileDialog::getSaveFileName(nullptr, QObject::tr("Save file"), name);
+      if(path.isEmpty() || !session) return;
+      save_file(*session, *content, path);
+    });
+}
+
 void Event::populate_menu(matrix::Room &room, QMenu &menu, const QPointF &pos) const {
   auto target = link_at(pos);
   if(target) {
     populate_menu_link(room, menu, *target);
   }
+  if(data.type() == matrix::event::room::Message::tag() && !data.redacted()) {
+    matrix::event::room::Message msg(data);
+    if(is_file_like(msg.content())) {
+      menu.addSection(QObject::tr("File"));
+      populate_menu_file(room, menu, matrix::event::room::message::FileLike(msg.content()));
+    }
+  }
   menu.addSection(QObject::tr("Event"));
   const matrix::EventID &event_id = data.id();
   const matrix::RoomID &room_id = room.id();
   QPointer<matrix::Session> session = &room.session();
 
   auto redact_action = menu.addAction(QIcon::fromTheme("edit-delete"), QObject::tr("&Redact..."));
+  redact_action->setEnabled(status == Status::CONFIRMED);
   QObject::connect(redact_action, &QAction::triggered, [session, room_id, event_id]() {
       auto dialog = new RedactDialog;
       dialog->setAttribute(Qt::WA_DeleteOnClose);
@@ -663,6 +711,11 @@ void Block::draw(const BlockRenderInfo &info, QPainter &p, QPointF offset, const
     if(event->data.type() != matrix::event::room::Message::tag()) {
       p.setPen(info.palette().color(QPalette::Dark));
     }
+    if(event->status == Event::Status::PENDING) {
+      p.setOpacity(0.5);
+    } else if(event->status == Event::Status::FAILED) {
+      p.setPen(Qt::red);
+    }
     QRectF event_bounds;
     for(const auto &layout : event->layouts) {
       sel(layout, local_offset);
@@ -706,6 +759,16 @@ QString Block::selection_text(const QFontMetrics &metrics, bool select_all,
   return result;
 }
 
+void Block::draw_backdrop(const BlockRenderInfo &info, QPainter &p, const QRectF &outline, const QColor &color) {
+  const auto radius = info.margin()*2;
+  p.save();
+  p.setRenderHint(QPainter::Antialiasing);
+  QPainterPath path;
+  path.addRoundedRect(outline, radius, radius);
+  p.fillPath(path, color);
+  p.restore();
+}
+
 size_t Block::size() const {
   return events_.size();
 }
@@ -807,3 +870,17 @@ void Block::event(matrix::Room &room, QWidget &container, const BlockRenderInfo
     break;
   }
 }
+
+void update_scroll_range(QScrollBar &scroll, int view_height, int content_height, bool grew_upward) {
+  const bool was_at_bottom = scroll.value() == scroll.maximum();
+  const int old_wrt_bottom = scroll.maximum() - scroll.value();
+  scroll.setMaximum(view_height > content_height ? 0 : content_height - view_height);
+  if(was_at_bottom) {
+    // Always remain at the bottom if we started there
+    scroll.setValue(scroll.maximum());
+  } else if(grew_upward) {
+    // Stay fixed relative to bottom if the top grew
+    scroll.setValue(old_wrt_bottom > scroll.maximum() ? 0 : scroll.maximum() - old_wrt_bottom);
+  }
+  // Otherwise we want to stay fixed relative to the top, i.e. do nothing
+}
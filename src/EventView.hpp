@@ -17,6 +17,7 @@
 
 class QShortcut;
 class QMenu;
+class QScrollBar;
 
 class Event;
 
@@ -37,7 +38,7 @@ public:
   const QPalette &palette() const { return palette_; }
 
   std::vector<std::pair<QString, QVector<QTextLayout::FormatRange>>>
-    format_text(const matrix::RoomState &state, const matrix::event::Room &evt, const QString &str) const;
+    format_text(const matrix::RoomState &state, const matrix::event::Room &evt, const QString &str, bool highlight) const;
 
 private:
   matrix::UserID self_;
@@ -48,11 +49,15 @@ private:
 
 class Event {
 public:
+  enum class Status { CONFIRMED, PENDING, FAILED };
+
   matrix::event::Room data;
   std::vector<QTextLayout> layouts;
   const std::chrono::time_point<std::chrono::system_clock, std::chrono::milliseconds> time;
+  Status status = Status::CONFIRMED;  // Local echoes aren't confirmed until the server's copy replaces data
 
-  Event(const BlockRenderInfo &, const matrix::RoomState &, const matrix::event::Room &);
+  Event(const BlockRenderInfo &, const matrix::RoomState &, const matrix::event::Room &, bool highlight = false);
+  // highlight should reflect the push rules' verdict on the event
   QRectF bounding_rect() const;
   void update_layout(const BlockRenderInfo &);
 
@@ -81,6 +86,8 @@ public:
             bool select_all,
             std::experimental::optional<QPointF> select_start,
             std::experimental::optional<QPointF> select_end) const;
+  static void draw_backdrop(const BlockRenderInfo &, QPainter &p, const QRectF &outline, const QColor &color);
+  // Rounded panel behind a block, and anything labeling it
   QRectF bounding_rect(const BlockRenderInfo &) const;
   QString selection_text(const QFontMetrics &, bool select_all,
                          std::experimental::optional<QPointF> select_start,
@@ -106,4 +113,8 @@ private:
   std::deque<Event *> events_;  // deque so we can add events to either end
 };
 
+void update_scroll_range(QScrollBar &scroll, int view_height, int content_height, bool grew_upward);
+// For views of blocks stacked up from the bottom: keeps following the bottom if already there, and otherwise holds the
+// visible content in place when content is added above it.
+
 #endif
@@ -0,0 +1,249 @@
+#include "FeedView.hpp"
+
+#include <chrono>
+#include <stdexcept>
+
+#include <QDebug>
+#include <QScrollBar>
+#include <QPainter>
+#include <QMouseEvent>
+#include <QToolTip>
+
+#include "matrix/Room.hpp"
+
+constexpr static size_t PAGE_SIZE = 50;
+constexpr static std::chrono::minutes BLOCK_MERGE_INTERVAL(2);
+constexpr static int RELOAD_DELAY = 250;  // ms; read receipts tend to arrive in bursts
+
+FeedView::FeedView(matrix::ActivityFeed &feed, matrix::ActivityFeed::Filter filter, const matrix::UserID &self, QWidget *parent)
+  : QAbstractScrollArea(parent), feed_(feed), filter_(filter), self_(self), content_height_(0), exhausted_(false),
+    avatars_(*viewport()) {
+  setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
+  setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
+  verticalScrollBar()->setSingleStep(20);  // Taken from QScrollArea
+  setMouseTracking(true);
+
+  reload_timer_.setSingleShot(true);
+  reload_timer_.setInterval(RELOAD_DELAY);
+  connect(&reload_timer_, &QTimer::timeout, this, &FeedView::reload);
+
+  connect(verticalScrollBar(), &QAbstractSlider::valueChanged, this, &FeedView::grow_backlog);
+  connect(&feed_, &matrix::ActivityFeed::added, this, [this](const matrix::ActivityFeed::Item &item) {
+      if(feed_.matches(filter_, item)) append(item);
+    });
+  connect(&feed_, &matrix::ActivityFeed::changed, [this]() {
+      if(!reload_timer_.isActive()) reload_timer_.start();
+    });
+
+  reload();
+}
+
+BlockRenderInfo FeedView::block_info() const {
+  return BlockRenderInfo(self_, palette(), font(), viewport()->contentsRect().width());
+}
+
+qreal FeedView::label_height() const {
+  return fontMetrics().lineSpacing();
+}
+
+qreal FeedView::group_height(const Group &group) const {
+  return label_height() + group.block.bounding_rect(block_info()).height() + block_info().spacing();
+}
+
+void FeedView::reload() {
+  reload_timer_.stop();
+  for(const auto &group : groups_) {
+    if(group.block.avatar()) avatars_.unref(*group.block.avatar());
+  }
+  groups_.clear();
+  events_.clear();
+  content_height_ = 0;
+  oldest_ = {};
+  exhausted_ = false;
+  grow_backlog();
+  verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+  viewport()->update();
+}
+
+void FeedView::grow_backlog() {
+  // Pages come from memory, so we can fill the whole trigger area at once
+  while(!exhausted_ && verticalScrollBar()->value() < viewport()->contentsRect().height()*2) {
+    const auto items = feed_.page(filter_, PAGE_SIZE, oldest_);
+    exhausted_ = items.size() < PAGE_SIZE;
+    for(const auto &item : items) {
+      prepend(item);
+    }
+    update_scrollbar(true);
+    if(items.empty()) break;
+  }
+}
+
+void FeedView::prepend(const matrix::ActivityFeed::Item &item) {
+  oldest_ = matrix::ActivityFeed::position(item);
+  const auto info = block_info();
+  events_.emplace_front(info, item.room->state(), item.event, item.highlight);
+  auto &event = events_.front();
+  if(!groups_.empty() && groups_.front().room == item.room
+     && groups_.front().block.sender_id() == item.event.sender()
+     && groups_.front().block.events().front()->time - event.time <= BLOCK_MERGE_INTERVAL) {
+    auto &group = groups_.front();
+    content_height_ -= group_height(group);
+    group.block.events().emplace_front(&event);
+    group.block.update_header(info, item.room->state());
+    content_height_ += group_height(group);
+  } else {
+    groups_.emplace_front(info, *item.room, event);
+    if(groups_.front().block.avatar()) avatars_.ref(*item.room, *groups_.front().block.avatar(), info.avatar_size());
+    content_height_ += group_height(groups_.front());
+  }
+}
+
+void FeedView::append(const matrix::ActivityFeed::Item &item) {
+  const auto info = block_info();
+  events_.emplace_back(info, item.room->state(), item.event, item.highlight);
+  auto &event = events_.back();
+  if(!groups_.empty() && groups_.back().room == item.room
+     && groups_.back().block.sender_id() == item.event.sender()
+     && event.time - groups_.back().block.events().back()->time <= BLOCK_MERGE_INTERVAL) {
+    auto &group = groups_.back();
+    content_height_ -= group_height(group);
+    group.block.events().emplace_back(&event);
+    group.block.update_header(info, item.room->state());
+    content_height_ += group_height(group);
+  } else {
+    groups_.emplace_back(info, *item.room, event);
+    if(groups_.back().block.avatar()) avatars_.ref(*item.room, *groups_.back().block.avatar(), info.avatar_size());
+    content_height_ += group_height(groups_.back());
+  }
+  if(!oldest_) oldest_ = matrix::ActivityFeed::position(item);
+  update_scrollbar(false);
+  viewport()->update();
+}
+
+void FeedView::update_scrollbar(bool grew_upward) {
+  update_scroll_range(*verticalScrollBar(), viewport()->contentsRect().height(), content_height_, grew_upward);
+}
+
+void FeedView::paintEvent(QPaintEvent *) {
+  const QRectF view_rect = viewport()->contentsRect();
+  QPainter painter(viewport());
+  painter.fillRect(view_rect, palette().color(QPalette::Dark));
+  painter.setPen(palette().color(QPalette::Text));
+  auto &scroll = *verticalScrollBar();
+  const auto info = block_info();
+  const qreal half_spacing = info.spacing()/2.0;
+  const qreal margin = info.margin();
+  const qreal label = label_height();
+  QPointF offset(0, view_rect.height() - (scroll.value() - scroll.maximum()));
+  QFont label_font = font();
+  label_font.setBold(true);
+  visible_groups_.clear();
+  for(auto it = groups_.rbegin(); it != groups_.rend(); ++it) {
+    const auto bounds = it->block.bounding_rect(info);
+    offset.ry() -= bounds.height() + half_spacing;
+    const qreal top = offset.y() - label;
+    if(top + label + bounds.height() + half_spacing < view_rect.top()) break;
+    if(top - half_spacing < view_rect.bottom()) {
+      visible_groups_.push_back(VisibleGroup{&*it, bounds.translated(offset)});
+      const QRectF outline(0, top - half_spacing, view_rect.width(), label + bounds.height() + info.spacing());
+      Block::draw_backdrop(info, painter, outline, palette().color(QPalette::Base));
+      {
+        painter.save();
+        painter.setFont(label_font);
+        painter.setPen(palette().color(QPalette::Link));
+        const QRectF label_rect(margin, top, view_rect.width() - 2*margin, label);
+        painter.drawText(label_rect, Qt::AlignLeft | Qt::AlignVCenter,
+                         QFontMetrics(label_font).elidedText(it->room->pretty_name(), Qt::ElideRight, label_rect.width()));
+        painter.restore();
+      }
+      it->block.draw(info, painter, offset, avatars_.pixmap(it->block.avatar(), info.avatar_size()), hasFocus(), false, {}, {});
+    }
+    offset.ry() -= label + half_spacing;
+  }
+  if(groups_.empty()) {
+    painter.drawText(view_rect, Qt::AlignCenter,
+                     filter_ == matrix::ActivityFeed::Filter::MENTIONS ? tr("No mentions") : tr("No unread messages"));
+  }
+}
+
+void FeedView::resizeEvent(QResizeEvent *e) {
+  verticalScrollBar()->setPageStep(viewport()->contentsRect().height() * 0.75);
+
+  if(e->size().width() != e->oldSize().width()) {
+    // Linebreaks may have changed, so we need to lay everything out again
+    const auto info = block_info();
+    for(auto &event : events_) {
+      event.update_layout(info);
+    }
+    content_height_ = 0;
+    for(auto &group : groups_) {
+      group.block.update_layout(info);
+      content_height_ += group_height(group);
+    }
+  }
+
+  update_scrollbar(false);
+  grow_backlog();
+}
+
+void FeedView::showEvent(QShowEvent *) {
+  grow_backlog();
+}
+
+QSize FeedView::sizeHint() const {
+  auto metrics = fontMetrics();
+  return QSize(metrics.width('x')*80 + block_info().avatar_size() + verticalScrollBar()->sizeHint().width(), metrics.lineSpacing()*30);
+}
+
+FeedView::VisibleGroup *FeedView::group_at(const QPointF &p) {
+  for(auto &x : visible_groups_) {
+    if(x.bounds.contains(p)) return &x;
+  }
+  return nullptr;
+}
+
+void FeedView::dispatch_event(const QPointF &p, QEvent *e) {
+  if(auto g = group_at(p)) {
+    g->group->block.event(*g->group->room, *viewport(), block_info(), p - g->bounds.topLeft(), e);
+  }
+}
+
+void FeedView::mousePressEvent(QMouseEvent *event) {
+  dispatch_event(event->localPos(), event);
+}
+
+void FeedView::mouseReleaseEvent(QMouseEvent *event) {
+  dispatch_event(event->localPos(), event);
+}
+
+void FeedView::mouseMoveEvent(QMouseEvent *event) {
+  viewport()->setCursor(Qt::ArrowCursor);
+  dispatch_event(event->localPos(), event);
+}
+
+void FeedView::mouseDoubleClickEvent(QMouseEvent *event) {
+  auto g = group_at(event->localPos());
+  if(!g) return;
+  auto &block = g->group->block;
+  auto hit = block.event_at(fontMetrics(), event->localPos() - g->bounds.topLeft());
+  const auto &target = hit ? hit.event->data : block.events().front()->data;
+  activated(g->group->room->id(), target.id());
+}
+
+void FeedView::contextMenuEvent(QContextMenuEvent *event) {
+  dispatch_event(QPointF(event->pos()), event);
+}
+
+bool FeedView::viewportEvent(QEvent *e) {
+  if(e->type() == QEvent::ToolTip) {
+    auto help = static_cast<QHelpEvent*>(e);
+    help->ignore();
+    dispatch_event(QPointF(help->pos()), help);
+    if(!help->isAccepted()) {
+      QToolTip::hideText();
+    }
+
+    return true;
+  }
+  return QAbstractScrollArea::viewportEvent(e);
+}
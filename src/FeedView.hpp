@@ -0,0 +1,78 @@
+#ifndef NATIVE_CHAT_FEED_VIEW_HPP_
+#define NATIVE_CHAT_FEED_VIEW_HPP_
+
+#include <deque>
+#include <vector>
+
+#include <QAbstractScrollArea>
+#include <QTimer>
+
+#include "matrix/ActivityFeed.hpp"
+
+#include "EventView.hpp"
+#include "AvatarCache.hpp"
+
+class FeedView : public QAbstractScrollArea {
+  Q_OBJECT
+
+public:
+  FeedView(matrix::ActivityFeed &feed, matrix::ActivityFeed::Filter filter, const matrix::UserID &self, QWidget *parent = nullptr);
+  // Messages from every room, oldest at the top. Older pages are merged in on demand as the user scrolls up.
+
+  QSize sizeHint() const override;
+
+signals:
+  void activated(const matrix::RoomID &room, const matrix::EventID &event);
+
+protected:
+  void paintEvent(QPaintEvent *event) override;
+  void resizeEvent(QResizeEvent *event) override;
+  void showEvent(QShowEvent *event) override;
+  void mousePressEvent(QMouseEvent *event) override;
+  void mouseReleaseEvent(QMouseEvent *event) override;
+  void mouseMoveEvent(QMouseEvent *event) override;
+  void mouseDoubleClickEvent(QMouseEvent *event) override;
+  void contextMenuEvent(QContextMenuEvent *event) override;
+  bool viewportEvent(QEvent *event) override;
+
+private:
+  struct Group {
+    matrix::Room *room;
+    Block block;                // Consecutive messages from one sender in one room
+
+    Group(const BlockRenderInfo &info, matrix::Room &r, Event &e) : room(&r), block(info, r.state(), e) {}
+  };
+
+  struct VisibleGroup {
+    Group *group;
+    QRectF bounds;              // Of the block, relative to view
+  };
+
+  matrix::ActivityFeed &feed_;
+  const matrix::ActivityFeed::Filter filter_;
+  const matrix::UserID self_;
+  std::deque<Event> events_;   // deque so we can add events to either end without moving them
+  std::deque<Group> groups_;
+  qreal content_height_;
+  std::experimental::optional<matrix::ActivityFeed::Position> oldest_;
+  // Of the earliest item shown, from which to continue paging
+  bool exhausted_;             // true iff every matching item is loaded
+  AvatarCache avatars_;
+  std::vector<VisibleGroup> visible_groups_;
+  QTimer reload_timer_;
+
+  BlockRenderInfo block_info() const;
+  qreal label_height() const;
+  qreal group_height(const Group &group) const;
+
+  void reload();
+  void grow_backlog();
+  void prepend(const matrix::ActivityFeed::Item &item);
+  void append(const matrix::ActivityFeed::Item &item);
+  void update_scrollbar(bool grew_upward);
+
+  VisibleGroup *group_at(const QPointF &p);
+  void dispatch_event(const QPointF &p, QEvent *e);
+};
+
+#endif
@@ -8,19 +8,29 @@
 #include <QLabel>
 #include <QSystemTrayIcon>
 #include <QDebug>
+#include <QJsonArray>
+#include <QJsonObject>
 
 #include "matrix/Room.hpp"
 #include "matrix/Session.hpp"
 
 #include "sort.hpp"
 #include "RoomView.hpp"
+#include "TimelineView.hpp"
 #include "ChatWindow.hpp"
 #include "JoinDialog.hpp"
+#include "SearchDialog.hpp"
+#include "RoomSwitcher.hpp"
+#include "FeedView.hpp"
 #include "MessageBox.hpp"
 
+static constexpr int WARM_UP_DELAY = 200;
+// ms the pointer must rest on a room before it's warmed up, so that sweeping across the list fetches nothing
+
 MainWindow::MainWindow(matrix::Session &session)
     : ui(new Ui::MainWindow), session_(session),
-      progress_(new QProgressBar(this)), sync_label_(new QLabel(this)) {
+      progress_(new QProgressBar(this)), sync_label_(new QLabel(this)),
+      feed_(session), room_list_model_(session), finder_(session) {
   ui->setupUi(this);
 
   ui->status_bar->addPermanentWidget(sync_label_);
@@ -53,6 +63,28 @@ MainWindow::MainWindow(matrix::Session &session)
       dialog->open();
     });
 
+  connect(ui->action_switch_room, &QAction::triggered, [this]() {
+      auto dialog = new RoomSwitcher(finder_, this);
+      dialog->setAttribute(Qt::WA_DeleteOnClose);
+      connect(dialog, &RoomSwitcher::activated, this, &MainWindow::open_room);
+      dialog->show();
+    });
+
+  ui->action_search->setShortcuts(QKeySequence::Find);
+  connect(ui->action_search, &QAction::triggered, [this]() {
+      auto dialog = new SearchDialog(session_, this);
+      dialog->setAttribute(Qt::WA_DeleteOnClose);
+      connect(dialog, &SearchDialog::activated, this, &MainWindow::open_event);
+      dialog->show();
+    });
+
+  connect(ui->action_mentions, &QAction::triggered, [this]() {
+      show_feed(matrix::ActivityFeed::Filter::MENTIONS, tr("Mentions"));
+    });
+  connect(ui->action_unread, &QAction::triggered, [this]() {
+      show_feed(matrix::ActivityFeed::Filter::UNREAD, tr("Unread messages"));
+    });
+
   connect(&session_, &matrix::Session::error, [this](QString msg) {
       qDebug() << "Session error: " << msg;
     });
@@ -60,12 +92,15 @@ MainWindow::MainWindow(matrix::Session &session)
   connect(&session_, &matrix::Session::synced_changed, [this]() {
       if(session_.synced()) {
         sync_label_->hide();
-      } else {
+      } else if(!session_.offline()) {
         sync_label_->setText(tr("Disconnected"));
         sync_label_->show();
       }
     });
 
+  connect(ui->action_work_offline, &QAction::toggled, &session_, &matrix::Session::set_offline);
+  connect(&session_, &matrix::Session::offline_changed, this, &MainWindow::offline_changed);
+
   connect(&session_, &matrix::Session::sync_progress, this, &MainWindow::sync_progress);
   connect(&session_, &matrix::Session::sync_complete, [this]() {
       progress_->hide();
@@ -76,29 +111,26 @@ MainWindow::MainWindow(matrix::Session &session)
   ui->action_quit->setShortcuts(QKeySequence::Quit);
   connect(ui->action_quit, &QAction::triggered, this, &MainWindow::quit);
 
-  connect(ui->room_list, &QListWidget::itemActivated, [this](QListWidgetItem *){
+  room_list_model_.set_font(ui->room_list->font());
+  ui->room_list->setModel(&room_list_model_);
+  ui->room_list->setMouseTracking(true);
+  hover_timer_.setSingleShot(true);
+  hover_timer_.setInterval(WARM_UP_DELAY);
+  connect(&hover_timer_, &QTimer::timeout, [this]() {
+      if(ui->room_list->viewport()->underMouse()) warm_up(hovered_);
+    });
+  connect(ui->room_list, &QAbstractItemView::entered, [this](const QModelIndex &index) {
+      hovered_ = index;
+      hover_timer_.start();
+    });
+  connect(ui->room_list, &QAbstractItemView::viewportEntered, &hover_timer_, &QTimer::stop);
+  connect(ui->room_list->selectionModel(), &QItemSelectionModel::currentChanged, this, &MainWindow::warm_up);
+
+  connect(ui->room_list, &QAbstractItemView::activated, [this](const QModelIndex &){
       std::unordered_set<ChatWindow *> windows;
-      for(auto item : ui->room_list->selectedItems()) {
-        auto &room = *reinterpret_cast<matrix::Room *>(item->data(Qt::UserRole).value<void*>());
-        ChatWindow *window = nullptr;
-        auto &i = rooms_.at(room.id());
-        if(i.window) {
-          window = i.window;   // Focus in existing window
-        } else if(last_focused_) {
-          window = last_focused_; // Add to most recently used window
-        } else {
-          // Select arbitrary window
-          for(auto &j : rooms_) {
-            if(j.second.window) {
-              window = j.second.window;
-              break;
-            }
-          }
-          if(!window) {
-            // Create first window
-            window = spawn_chat_window();
-          }
-        }
+      for(const auto &index : ui->room_list->selectionModel()->selectedIndexes()) {
+        auto &room = RoomListModel::room(index);
+        ChatWindow *window = window_for(room);
         window->add_or_focus(room);
         windows.insert(window);
       }
@@ -109,9 +141,14 @@ MainWindow::MainWindow(matrix::Session &session)
     });
 
   sync_progress(0, -1);
+  offline_changed();
   for(auto room : session_.rooms()) {
     joined(*room);
   }
+
+  restore_layout();
+  connect(QCoreApplication::instance(), &QCoreApplication::aboutToQuit, this, &MainWindow::save_layout);
+  connect(this, &MainWindow::log_out, this, &MainWindow::save_layout);
 }
 
 MainWindow::~MainWindow() {
@@ -125,45 +162,68 @@ MainWindow::~MainWindow() {
   delete ui;
 }
 
+ChatWindow *MainWindow::window_for(const matrix::Room &room) {
+  auto &i = rooms_.at(room.id());
+  if(i.window) return i.window;   // Focus in existing window
+  if(last_focused_) return last_focused_; // Add to most recently used window
+  // Select arbitrary window
+  for(auto &j : rooms_) {
+    if(j.second.window) return j.second.window;
+  }
+  // Create first window
+  return spawn_chat_window();
+}
+
+void MainWindow::open_room(const matrix::RoomID &id) {
+  auto room = session_.room_from_id(id);
+  if(!room) return;
+  auto window = window_for(*room);
+  window->add_or_focus(*room);
+  window->show();
+  window->activateWindow();
+}
+
+void MainWindow::open_event(const matrix::RoomID &id, const matrix::EventID &event) {
+  auto room = session_.room_from_id(id);
+  if(!room) return;             // Left since the search
+  auto window = window_for(*room);
+  auto view = window->add_or_focus(*room);
+  window->show();
+  window->activateWindow();
+  view->jump_to(event);
+}
+
+void MainWindow::show_feed(matrix::ActivityFeed::Filter filter, const QString &title) {
+  auto view = new FeedView(feed_, filter, session_.user_id(), this);
+  view->setWindowFlags(Qt::Window);
+  view->setAttribute(Qt::WA_DeleteOnClose);
+  view->setWindowTitle(title);
+  connect(view, &FeedView::activated, this, &MainWindow::open_event);
+  view->show();
+}
+
+void MainWindow::warm_up(const QModelIndex &index) {
+  if(!index.isValid()) return;
+  auto &room = RoomListModel::room(index);
+  auto &info = rooms_.at(room.id());
+  if(info.window || info.warm) return;  // Already open or prefetched
+  info.warm = true;
+  TimelineView::warm_up(room, *this);
+}
+
 void MainWindow::joined(matrix::Room &room) {
-  auto &i = rooms_.emplace(
-    std::piecewise_construct,
-    std::forward_as_tuple(room.id()),
-    std::forward_as_tuple()).first->second;
-  i.item = new QListWidgetItem;
-  i.item->setData(Qt::UserRole, QVariant::fromValue(reinterpret_cast<void*>(&room)));
-  // TODO: Sorting
-  ui->room_list->addItem(i.item);
-  i.display_name = room.pretty_name_highlights();
-  i.highlight_count = room.highlight_count() + room.notification_count();
-  i.has_unread = room.has_unread();
-  update_room(i);
+  rooms_.emplace(room.id(), RoomInfo());
 
   connect(&room, &matrix::Room::highlight_count_changed, [this, &room](uint64_t old) {
-      update_room(room);
       if(old <= room.highlight_count()) {
         highlight(room.id());
       }
     });
   connect(&room, &matrix::Room::notification_count_changed, [this, &room](uint64_t old) {
-      update_room(room);
       if(old <= room.notification_count()) {
         highlight(room.id());
       }
     });
-  auto &&just_update = [this, &room]() { update_room(room); };
-  connect(&room, &matrix::Room::name_changed, just_update);
-  connect(&room, &matrix::Room::canonical_alias_changed, just_update);
-  connect(&room, &matrix::Room::aliases_changed, just_update);
-  connect(&room, &matrix::Room::membership_changed, just_update);
-  connect(&room, &matrix::Room::receipts_changed, just_update);
-  connect(&room, &matrix::Room::message, [this, &room]() {
-      if(room.has_unread()) {
-        auto &i = rooms_.at(room.id());
-        i.has_unread = true;
-        update_room(i);
-      }
-    });
 }
 
 void MainWindow::highlight(const matrix::RoomID &room) {
@@ -175,19 +235,15 @@ void MainWindow::highlight(const matrix::RoomID &room) {
   QApplication::alert(window);
 }
 
-void MainWindow::update_room(matrix::Room &room) {
-  auto &i = rooms_.at(room.id());
-  i.display_name = room.pretty_name_highlights();
-  i.highlight_count = room.highlight_count() + room.notification_count();
-  i.has_unread = room.has_unread();
-  update_room(i);
-}
-
-void MainWindow::update_room(RoomInfo &info) {
-  info.item->setText(info.display_name);
-  auto f = font();
-  f.setBold(info.highlight_count != 0 || info.has_unread);
-  info.item->setFont(f);
+void MainWindow::offline_changed() {
+  ui->action_work_offline->setChecked(session_.offline());
+  if(session_.offline()) {
+    progress_->hide();
+    sync_label_->setText(tr("Offline"));
+    sync_label_->show();
+  } else if(!session_.synced()) {
+    sync_progress(0, -1);
+  }
 }
 
 void MainWindow::sync_progress(qint64 received, qint64 total) {
@@ -222,6 +278,51 @@ void RoomWindowBridge::check_release(const matrix::RoomID &room) {
   if(room_.id() == room) deleteLater();
 }
 
+void MainWindow::save_layout() {
+  std::vector<ChatWindow *> windows;
+  for(const auto &room : rooms_) {
+    auto window = room.second.window;
+    if(window && std::find(windows.begin(), windows.end(), window) == windows.end()) windows.push_back(window);
+  }
+
+  QJsonArray ws;
+  for(auto window : windows) {
+    QJsonArray rooms;
+    for(auto view : window->views()) {
+      QJsonObject r{{"id", view->room().id().value()}};
+      if(auto anchor = view->anchor()) r["anchor"] = anchor->value();
+      rooms.push_back(r);
+    }
+    ws.push_back(QJsonObject{
+        {"geometry", QString::fromLatin1(window->saveGeometry().toBase64())},
+        {"current", window->focused_room().value()},
+        {"rooms", rooms}
+      });
+  }
+  session_.store_layout(QJsonObject{{"windows", ws}});
+}
+
+void MainWindow::restore_layout() {
+  const auto layout = session_.load_layout();
+  for(const auto &w : layout["windows"].toArray()) {
+    const auto o = w.toObject();
+    ChatWindow *window = nullptr;
+    for(const auto &r : o["rooms"].toArray()) {
+      const auto ro = r.toObject();
+      auto room = session_.room_from_id(matrix::RoomID(ro["id"].toString()));
+      if(!room || rooms_.at(room->id()).window) continue;  // Left, or listed twice
+      if(!window) window = spawn_chat_window();
+      auto view = window->add_or_focus(*room);
+      if(ro["anchor"].isString()) view->restore_anchor(matrix::EventID(ro["anchor"].toString()));
+    }
+    if(!window) continue;
+    auto current = session_.room_from_id(matrix::RoomID(o["current"].toString()));
+    if(current && rooms_.at(current->id()).window == window) window->add_or_focus(*current);
+    window->restoreGeometry(QByteArray::fromBase64(o["geometry"].toString().toLatin1()));
+    window->show();
+  }
+}
+
 ChatWindow *MainWindow::spawn_chat_window() {
   // We don't create these as children to prevent Qt from hinting to WMs that they should be floating
   auto window = new ChatWindow;
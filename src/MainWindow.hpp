@@ -5,14 +5,19 @@
 
 #include <QMainWindow>
 #include <QPointer>
+#include <QTimer>
+#include <QPersistentModelIndex>
 
 #include "matrix/Matrix.hpp"
 #include "matrix/ID.hpp"
+#include "matrix/ActivityFeed.hpp"
+#include "matrix/RoomFinder.hpp"
+
+#include "RoomListModel.hpp"
 
 class QProgressBar;
 class QLabel;
 class ChatWindow;
-class QListWidgetItem;
 
 namespace Ui {
 class MainWindow;
@@ -37,10 +42,7 @@ signals:
 private:
   struct RoomInfo {
     ChatWindow *window = nullptr;
-    QListWidgetItem *item = nullptr;
-    bool has_unread = false;
-    QString display_name;
-    size_t highlight_count = 0;
+    bool warm = false;          // Backlog and avatars already prefetched
   };
 
   Ui::MainWindow *ui;
@@ -48,15 +50,27 @@ private:
   QProgressBar *progress_;
   QLabel *sync_label_;
   QPointer<ChatWindow> last_focused_;
+  matrix::ActivityFeed feed_;
+  RoomListModel room_list_model_;
+  matrix::RoomFinder finder_;
+  QTimer hover_timer_;
+  QPersistentModelIndex hovered_;
+  // Room to warm up if the pointer rests on it
 
   std::unordered_map<matrix::RoomID, RoomInfo> rooms_;
 
   void joined(matrix::Room &room);
   void highlight(const matrix::RoomID &room);
-  void update_room(RoomInfo &info);
-  void update_room(matrix::Room &room);
   void sync_progress(qint64 received, qint64 total);
+  void offline_changed();
+  void warm_up(const QModelIndex &index);
+  ChatWindow *window_for(const matrix::Room &room);
+  void open_room(const matrix::RoomID &room);
+  void open_event(const matrix::RoomID &room, const matrix::EventID &event);
+  void show_feed(matrix::ActivityFeed::Filter filter, const QString &title);
   ChatWindow *spawn_chat_window();
+  void save_layout();
+  void restore_layout();
 };
 
 class RoomWindowBridge : public QObject {
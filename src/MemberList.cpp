@@ -3,57 +3,104 @@
 #include <QScrollBar>
 
 #include "matrix/Room.hpp"
+#include "matrix/Trace.hpp"
 
-QString MemberList::Compare::key(const QString &n) {
-  int i = 0;
-  while((n[i] == '@') && (i < n.size())) {
-    ++i;
+MemberListModel::MemberListModel(const matrix::Room &room, QObject *parent) : QAbstractListModel(parent), room_(room) {
+  TRACE_OPERATION("MemberListModel::MemberListModel");
+  const auto entries = room.member_index().entries();
+  rows_.reserve(entries.size());
+  for(const auto &entry : entries) {
+    rows_.push_back(Row{entry.id, entry.name});
   }
-  if(i == n.size()) return n.toCaseFolded();
-  return QString(n.data() + i, n.size() - i).toCaseFolded();
+  connect(&room, &matrix::Room::member_rank_changed, this,
+          [this](const matrix::UserID &id, const matrix::MemberIndex::Change &change) {
+            rank_changed(id, change.from, change.to);
+          });
 }
 
-MemberList::MemberList(const matrix::RoomState &s, QWidget *parent) : QListWidget(parent) {
-  auto initial_members = s.members();
-  for(const auto &member : initial_members) {
-    members_.insert(std::make_pair(s.member_name(*member), member->id()));
+void MemberListModel::rank_changed(const matrix::UserID &id, std::experimental::optional<size_t> from,
+                                   std::experimental::optional<size_t> to) {
+  if(from && to) {
+    if(rows_[*from].name != room_.member_index().entries()[*to].name) {
+      // Go through removal and insertion so views remeasure the row
+      rank_changed(id, from, {});
+      rank_changed(id, {}, to);
+      return;
+    }
+    if(*from == *to) return;
+    const int f = *from, t = *to;
+    beginMoveRows(QModelIndex(), f, f, QModelIndex(), t > f ? t + 1 : t);
+    Row row = std::move(rows_[f]);
+    rows_.erase(rows_.begin() + f);
+    rows_.insert(rows_.begin() + t, std::move(row));
+    endMoveRows();
+  } else if(from) {
+    beginRemoveRows(QModelIndex(), *from, *from);
+    rows_.erase(rows_.begin() + *from);
+    endRemoveRows();
+  } else if(to) {
+    beginInsertRows(QModelIndex(), *to, *to);
+    rows_.insert(rows_.begin() + *to, Row{id, room_.member_index().entries()[*to].name});
+    endInsertRows();
   }
-  update_members();
 }
 
-void MemberList::member_display_changed(const matrix::RoomState &s, const matrix::Member &m, const QString &old) {
-  auto erased = members_.erase(old);
-  if(!erased) {
-    QString msg = "member name changed from unknown name " + old + " to " + s.member_name(m);
-    throw std::logic_error(msg.toStdString().c_str());
+int MemberListModel::rowCount(const QModelIndex &parent) const {
+  if(parent.isValid()) return 0;
+  return rows_.size();
+}
+
+QVariant MemberListModel::data(const QModelIndex &index, int role) const {
+  if(!index.isValid() || static_cast<size_t>(index.row()) >= rows_.size()) return QVariant();
+  const auto &entry = rows_[index.row()];
+  switch(role) {
+  case Qt::DisplayRole: return entry.name;
+  case Qt::ToolTipRole: return entry.id.value();
+  case Qt::UserRole: return entry.id.value();
+  default: return QVariant();
   }
-  members_.insert(std::make_pair(s.member_name(m), m.id()));
-  update_members();
 }
 
-void MemberList::membership_changed(const matrix::RoomState &s, const matrix::Member &m) {
-  if(membership_displayable(m.membership())) {
-    members_.insert(std::make_pair(s.member_name(m), m.id()));
-  } else {
-    members_.erase(s.member_name(m));
+MemberList::MemberList(const matrix::Room &room, QWidget *parent) : QListView(parent), model_(room) {
+  setUniformItemSizes(true);
+  setModel(&model_);
+  connect(&model_, &QAbstractItemModel::rowsInserted, [this](const QModelIndex &, int first, int last) {
+      rows_inserted(first, last);
+    });
+  connect(&model_, &QAbstractItemModel::rowsAboutToBeRemoved, [this](const QModelIndex &, int first, int last) {
+      rows_removing(first, last);
+    });
+  rows_inserted(0, model_.rowCount() - 1);
+}
+
+void MemberList::rows_inserted(int first, int last) {
+  TRACE_OPERATION("MemberList::rows_inserted");
+  const auto metrics = fontMetrics();
+  for(int i = first; i <= last; ++i) {
+    widths_.insert(metrics.width(model_.index(i).data().toString()));
   }
-  update_members();
+  update_size(model_.rowCount());
 }
 
-void MemberList::update_members() {
-  clear();
-  for(const auto &member : members_) {
-    auto item = new QListWidgetItem;
-    item->setText(member.first);
-    item->setToolTip(member.second.value());
-    item->setData(Qt::UserRole, member.second.value());
-    addItem(item);
+void MemberList::rows_removing(int first, int last) {
+  const auto metrics = fontMetrics();
+  for(int i = first; i <= last; ++i) {
+    auto it = widths_.find(metrics.width(model_.index(i).data().toString()));
+    if(it != widths_.end()) widths_.erase(it);
   }
-  setVisible(count() > 2);
+  update_size(model_.rowCount() - (last - first + 1));
+}
+
+void MemberList::update_size(int rows) {
+  setVisible(rows > 2);
   auto margins = contentsMargins();
-  size_hint_ = QSize(sizeHintForColumn(0) + verticalScrollBar()->sizeHint().width() + margins.left() + margins.right(),
-                     fontMetrics().lineSpacing() + horizontalScrollBar()->sizeHint().height());
-  updateGeometry();
+  const int widest = widths_.empty() ? 0 : *widths_.rbegin();
+  const QSize hint(widest + 2*frameWidth() + verticalScrollBar()->sizeHint().width() + margins.left() + margins.right(),
+                   fontMetrics().lineSpacing() + horizontalScrollBar()->sizeHint().height());
+  if(hint != size_hint_) {
+    size_hint_ = hint;
+    updateGeometry();
+  }
 }
 
 QSize MemberList::sizeHint() const {
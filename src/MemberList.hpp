@@ -1,39 +1,53 @@
 #ifndef NATIVE_CLIENT_MEMBER_LIST_HPP_
 #define NATIVE_CLIENT_MEMBER_LIST_HPP_
 
-#include <map>
+#include <vector>
+#include <set>
+#include <experimental/optional>
 
-#include <QListWidget>
+#include <QListView>
+#include <QAbstractListModel>
 
 #include "matrix/ID.hpp"
 
 namespace matrix {
-class Member;
-class RoomState;
+class Room;
 }
 
-class MemberList : public QListWidget {
+class MemberListModel : public QAbstractListModel {
 public:
-  MemberList(const matrix::RoomState &, QWidget *parent = nullptr);
+  MemberListModel(const matrix::Room &, QObject *parent = nullptr);
 
-  void member_display_changed(const matrix::RoomState &, const matrix::Member &, const QString &old);
-  void membership_changed(const matrix::RoomState &, const matrix::Member &);
-
-  QSize sizeHint() const override;
+  int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+  QVariant data(const QModelIndex &index, int role) const override;
 
 private:
-  class Compare {
-  public:
-    bool operator()(const QString &a, const QString &b) const { return key(a) < key(b); }
-
-  private:
-    static QString key(const QString &n);
+  struct Row {
+    matrix::UserID id;
+    QString name;
   };
 
-  std::map<QString, const matrix::UserID, Compare> members_;
+  const matrix::Room &room_;
+  std::vector<Row> rows_;  // Mirrors the room's member index
+
+  void rank_changed(const matrix::UserID &id, std::experimental::optional<size_t> from,
+                    std::experimental::optional<size_t> to);
+};
+
+class MemberList : public QListView {
+public:
+  MemberList(const matrix::Room &, QWidget *parent = nullptr);
+
+  QSize sizeHint() const override;
+
+private:
+  MemberListModel model_;
+  std::multiset<int> widths_;   // Of every displayed name, so the widest is known without measuring them all again
   QSize size_hint_;             // cache to avoid recomputing
 
-  void update_members();
+  void rows_inserted(int first, int last);
+  void rows_removing(int first, int last);
+  void update_size(int rows);
 };
 
 #endif
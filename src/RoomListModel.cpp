@@ -0,0 +1,139 @@
+#include "RoomListModel.hpp"
+
+#include <algorithm>
+#include <tuple>
+
+#include "matrix/Room.hpp"
+#include "matrix/Session.hpp"
+
+#include "sort.hpp"
+
+bool RoomListModel::before(const Key &a, const Key &b) {
+  return std::forward_as_tuple(b.highlight, b.unread, b.last_activity, a.sort_key, a.id)
+    < std::forward_as_tuple(a.highlight, a.unread, a.last_activity, b.sort_key, b.id);
+}
+
+static uint64_t last_activity(const matrix::Room &room) {
+  for(auto batch = room.buffer().crbegin(); batch != room.buffer().crend(); ++batch) {
+    if(!batch->events.empty()) return batch->events.back().origin_server_ts();
+  }
+  return 0;
+}
+
+RoomListModel::RoomListModel(matrix::Session &session, QObject *parent) : QAbstractListModel(parent) {
+  bold_font_.setBold(true);
+  auto rooms = session.rooms();
+  rows_.reserve(rooms.size());
+  keys_.reserve(rooms.size());
+  for(auto room : rooms) {
+    joined(*room);
+  }
+  connect(&session, &matrix::Session::joined, this, &RoomListModel::joined);
+}
+
+matrix::Room &RoomListModel::room(const QModelIndex &index) {
+  return *reinterpret_cast<matrix::Room *>(index.data(Qt::UserRole).value<void*>());
+}
+
+std::vector<RoomListModel::Row>::iterator RoomListModel::find(const Key &key) {
+  return std::lower_bound(rows_.begin(), rows_.end(), key, [](const Row &r, const Key &k) { return before(r.key, k); });
+}
+
+void RoomListModel::joined(matrix::Room &room) {
+  if(keys_.count(room.id())) return;
+  const auto name = room.pretty_name_highlights();
+  Key key{room.highlight_count() != 0 || room.notification_count() != 0, room.has_unread(), last_activity(room),
+          room_sort_key(name), room.id()};
+  auto it = find(key);
+  const int row = it - rows_.begin();
+  beginInsertRows(QModelIndex(), row, row);
+  keys_.emplace(room.id(), key);
+  rows_.insert(it, Row{std::move(key), name, &room, room.pretty_name_version(), room.highlight_count()});
+  endInsertRows();
+
+  auto &&just_update = [this, &room]() { update(room); };
+  connect(&room, &matrix::Room::highlight_count_changed, this, just_update);
+  connect(&room, &matrix::Room::notification_count_changed, this, just_update);
+  connect(&room, &matrix::Room::name_changed, this, just_update);
+  connect(&room, &matrix::Room::canonical_alias_changed, this, just_update);
+  connect(&room, &matrix::Room::aliases_changed, this, just_update);
+  connect(&room, &matrix::Room::membership_changed, this, just_update);
+  connect(&room, &matrix::Room::receipts_changed, this, just_update);
+  connect(&room, &matrix::Room::message, this, [this, &room](const matrix::event::Room &evt) {
+      update(room, evt.origin_server_ts());
+    });
+}
+
+void RoomListModel::update(matrix::Room &room, uint64_t activity) {
+  auto &key = keys_.at(room.id());
+  auto it = find(key);
+  if(it == rows_.end() || it->key.id != room.id()) {
+    // sort_key was computed under a different locale; fall back to a scan rather than corrupting the list
+    it = std::find_if(rows_.begin(), rows_.end(), [&](const Row &r) { return r.room == &room; });
+  }
+  const int from = it - rows_.begin();
+
+  Row row{key, it->name, &room, room.pretty_name_version(), room.highlight_count()};
+  if(row.name_version != it->name_version || row.name_highlights != it->name_highlights) {
+    row.name = room.pretty_name_highlights();
+  }
+  row.key.highlight = room.highlight_count() != 0 || room.notification_count() != 0;
+  row.key.unread = room.has_unread();
+  row.key.last_activity = std::max(row.key.last_activity, activity);
+  if(row.name != it->name) row.key.sort_key = room_sort_key(row.name);
+
+  const bool display_changed = row.name != it->name || row.key.highlight != it->key.highlight
+    || row.key.unread != it->key.unread;
+  const bool neighbors_before = (it == rows_.begin() || before((it-1)->key, row.key));
+  const bool neighbors_after = (it+1 == rows_.end() || before(row.key, (it+1)->key));
+  key = row.key;
+  if(neighbors_before && neighbors_after) {
+    // Still in order; update in place
+    *it = std::move(row);
+    if(display_changed) dataChanged(index(from), index(from));
+    return;
+  }
+
+  // Find the destination among the other rows
+  int to;
+  if(!neighbors_before) {
+    to = std::lower_bound(rows_.begin(), it, row.key, [](const Row &r, const Key &k) { return before(r.key, k); })
+      - rows_.begin();
+  } else {
+    to = std::lower_bound(it + 1, rows_.end(), row.key, [](const Row &r, const Key &k) { return before(r.key, k); })
+      - rows_.begin() - 1;
+  }
+  beginMoveRows(QModelIndex(), from, from, QModelIndex(), to > from ? to + 1 : to);
+  *it = std::move(row);
+  if(to < from) {
+    std::rotate(rows_.begin() + to, it, it + 1);
+  } else {
+    std::rotate(it, it + 1, rows_.begin() + to + 1);
+  }
+  endMoveRows();
+  if(display_changed) dataChanged(index(to), index(to));
+}
+
+void RoomListModel::set_font(const QFont &font) {
+  font_ = font;
+  bold_font_ = font;
+  bold_font_.setBold(true);
+  if(!rows_.empty()) dataChanged(index(0), index(rows_.size() - 1), {Qt::FontRole});
+}
+
+int RoomListModel::rowCount(const QModelIndex &parent) const {
+  if(parent.isValid()) return 0;
+  return rows_.size();
+}
+
+QVariant RoomListModel::data(const QModelIndex &index, int role) const {
+  if(!index.isValid() || static_cast<size_t>(index.row()) >= rows_.size()) return QVariant();
+  const auto &row = rows_[index.row()];
+  switch(role) {
+  case Qt::DisplayRole: return row.name;
+  case Qt::ToolTipRole: return row.key.id.value();
+  case Qt::FontRole: return (row.key.highlight || row.key.unread) ? bold_font_ : font_;
+  case Qt::UserRole: return QVariant::fromValue(reinterpret_cast<void*>(row.room));
+  default: return QVariant();
+  }
+}
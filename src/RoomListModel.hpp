@@ -0,0 +1,54 @@
+#ifndef NATIVE_CHAT_ROOM_LIST_MODEL_HPP_
+#define NATIVE_CHAT_ROOM_LIST_MODEL_HPP_
+
+#include <vector>
+#include <unordered_map>
+
+#include <QAbstractListModel>
+#include <QFont>
+
+#include "matrix/ID.hpp"
+
+namespace matrix {
+class Room;
+class Session;
+}
+
+class RoomListModel : public QAbstractListModel {
+public:
+  RoomListModel(matrix::Session &session, QObject *parent = nullptr);
+
+  static matrix::Room &room(const QModelIndex &index);
+
+  int rowCount(const QModelIndex &parent = QModelIndex()) const override;
+  QVariant data(const QModelIndex &index, int role) const override;
+
+  void set_font(const QFont &font);
+
+private:
+  struct Key {
+    bool highlight;
+    bool unread;
+    uint64_t last_activity;
+    QString sort_key;
+    matrix::RoomID id;
+  };
+
+  struct Row {
+    Key key;
+    QString name;
+    matrix::Room *room;
+    uint64_t name_version, name_highlights;  // Inputs to name, to skip recomputing it when unchanged
+  };
+
+  std::vector<Row> rows_;       // Highlighted first, then unread, then most recently active, then by name
+  std::unordered_map<matrix::RoomID, Key> keys_;  // Current key of each row, to find it again
+  QFont font_, bold_font_;
+
+  static bool before(const Key &a, const Key &b);
+  void joined(matrix::Room &room);
+  void update(matrix::Room &room, uint64_t activity = 0);
+  std::vector<Row>::iterator find(const Key &key);
+};
+
+#endif
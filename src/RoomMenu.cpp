@@ -2,41 +2,38 @@
 
 #include <QFileDialog>
 #include <QPointer>
-#include <QFile>
 #include <QFileInfo>
-#include <QMimeDatabase>
 
-#include "matrix/Session.hpp"
+#include "matrix/UploadQueue.hpp"
 #include "MessageBox.hpp"
 
-RoomMenu::RoomMenu(matrix::Room &room, QWidget *parent) : QMenu(parent), room_(room) {
+static const QSize DOWNSCALED_IMAGE_SIZE(2048, 2048);
+
+RoomMenu::RoomMenu(matrix::Room &room, QWidget *parent)
+  : QMenu(parent), room_(room) {
   auto file_dialog = new QFileDialog(parent);
-  auto upload = addAction(QIcon::fromTheme("document-open"), tr("Upload &file..."));
+  file_dialog->setFileMode(QFileDialog::ExistingFiles);
+  auto upload = addAction(QIcon::fromTheme("document-open"), tr("Upload &files..."));
   connect(upload, &QAction::triggered, file_dialog, &QDialog::open);
-  connect(file_dialog, &QFileDialog::fileSelected, this, &RoomMenu::upload_file);
+  connect(file_dialog, &QFileDialog::filesSelected, this, &RoomMenu::upload_files);
+  auto downscale = addAction(tr("&Downscale uploaded images"));
+  downscale->setCheckable(true);
+  downscale->setChecked(room_.uploads().max_image_size().isValid());  // The queue outlives this menu
+  connect(downscale, &QAction::toggled, [this](bool checked) {
+      room_.uploads().set_max_image_size(checked ? DOWNSCALED_IMAGE_SIZE : QSize());
+    });
   addSeparator();
   auto leave = addAction(QIcon::fromTheme("system-log-out"), tr("Leave"));
   connect(leave, &QAction::triggered, &room_, &matrix::Room::leave);
+
+  QPointer<QWidget> parent_widget(parent);
+  connect(&room_.uploads(), &matrix::UploadQueue::error, this, [parent_widget](const QString &path, const QString &msg) {
+      MessageBox::critical(tr("Error uploading file"), tr("Couldn't upload %1: %2").arg(QFileInfo(path).fileName()).arg(msg), parent_widget);
+    });
 }
 
-void RoomMenu::upload_file(const QString &path) {
-  auto file = std::make_shared<QFile>(path);
-  QFileInfo info(*file);
-  if(!file->open(QIODevice::ReadOnly)) {
-    MessageBox::critical(tr("Error opening file"), tr("Couldn't open %1: %2").arg(info.fileName()).arg(file->errorString()), parentWidget());
-    return;
+void RoomMenu::upload_files(const QStringList &paths) {
+  for(const auto &path : paths) {
+    room_.uploads().enqueue(path);
   }
-
-  const QString &type = QMimeDatabase().mimeTypeForFile(info).name();
-  auto reply = room_.session().upload(*file, type, info.fileName());
-  QPointer<matrix::Room> room(&room_);
-  // This closure captures 'file' to ensure its outlives the network request
-  connect(reply, &matrix::ContentPost::success, [file, room, info, type](const QString &uri) {
-      if(!room) return;
-      room->send_file(uri, info.fileName(), type, info.size());
-    });
-  QPointer<QWidget> parent(parentWidget());
-  connect(reply, &matrix::ContentPost::error, [parent, info](const QString &msg) {
-      MessageBox::critical(tr("Error uploading file"), tr("Couldn't upload %1: %2").arg(info.fileName()).arg(msg), parent);
-    });
 }
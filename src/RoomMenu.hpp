@@ -14,7 +14,7 @@ public:
 private:
   matrix::Room &room_;
 
-  void upload_file(const QString &path);
+  void upload_files(const QStringList &paths);
 };
 
 #endif
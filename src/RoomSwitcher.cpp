@@ -0,0 +1,56 @@
+#include "RoomSwitcher.hpp"
+#include "ui_RoomSwitcher.h"
+
+#include <QKeyEvent>
+
+#include "matrix/Room.hpp"
+#include "matrix/RoomFinder.hpp"
+
+static constexpr size_t RESULT_LIMIT = 50;
+
+RoomSwitcher::RoomSwitcher(const matrix::RoomFinder &finder, QWidget *parent)
+  : QDialog(parent), ui(new Ui::RoomSwitcher), finder_(finder) {
+  ui->setupUi(this);
+
+  ui->query->installEventFilter(this);
+  connect(ui->query, &QLineEdit::textChanged, this, &RoomSwitcher::search);
+  connect(ui->query, &QLineEdit::returnPressed, this, &RoomSwitcher::activate);
+  connect(ui->results, &QListWidget::itemActivated, this, &RoomSwitcher::activate);
+}
+
+RoomSwitcher::~RoomSwitcher() { delete ui; }
+
+bool RoomSwitcher::eventFilter(QObject *object, QEvent *event) {
+  if(object == ui->query && event->type() == QEvent::KeyPress) {
+    // Let the results be navigated without leaving the query
+    switch(static_cast<QKeyEvent *>(event)->key()) {
+    case Qt::Key_Up:
+    case Qt::Key_Down:
+    case Qt::Key_PageUp:
+    case Qt::Key_PageDown:
+      QCoreApplication::sendEvent(ui->results, event);
+      return true;
+    default:
+      break;
+    }
+  }
+  return QDialog::eventFilter(object, event);
+}
+
+void RoomSwitcher::search(const QString &query) {
+  ui->results->clear();
+  for(const auto &result : finder_.find(query, RESULT_LIMIT)) {
+    auto item = new QListWidgetItem(result.room->pretty_name());
+    item->setToolTip(result.room->id().value());
+    item->setData(Qt::UserRole, result.room->id().value());
+    ui->results->addItem(item);
+  }
+  ui->results->setCurrentRow(0);
+}
+
+void RoomSwitcher::activate() {
+  auto item = ui->results->currentItem();
+  if(!item) return;
+  activated(matrix::RoomID(item->data(Qt::UserRole).toString()));
+  accept();
+}
@@ -0,0 +1,37 @@
+#ifndef NATIVE_CHAT_ROOM_SWITCHER_HPP_
+#define NATIVE_CHAT_ROOM_SWITCHER_HPP_
+
+#include <QDialog>
+
+#include "matrix/ID.hpp"
+
+namespace Ui {
+class RoomSwitcher;
+}
+
+namespace matrix {
+class RoomFinder;
+}
+
+class RoomSwitcher : public QDialog {
+  Q_OBJECT
+
+public:
+  RoomSwitcher(const matrix::RoomFinder &finder, QWidget *parent = nullptr);
+  ~RoomSwitcher();
+
+signals:
+  void activated(const matrix::RoomID &room);
+
+protected:
+  bool eventFilter(QObject *object, QEvent *event) override;
+
+private:
+  Ui::RoomSwitcher *ui;
+  const matrix::RoomFinder &finder_;
+
+  void search(const QString &query);
+  void activate();
+};
+
+#endif
@@ -7,6 +7,7 @@
 #include <QCursor>
 #include <QScrollBar>
 #include <QDebug>
+#include <QDateTime>
 
 #include "matrix/Room.hpp"
 #include "matrix/Member.hpp"
@@ -17,9 +18,12 @@
 #include "RoomMenu.hpp"
 #include "MemberList.hpp"
 
+static constexpr size_t COMPLETION_LIMIT = 32;
+// Candidates cycled through by tab completion
+
 RoomView::RoomView(matrix::Room &room, QWidget *parent)
   : QWidget(parent), ui(new Ui::RoomView),
-    timeline_view_(new TimelineView(room, this)), entry_(new EntryBox(this)), member_list_(new MemberList(room.state(), this)),
+    timeline_view_(new TimelineView(room, this)), entry_(new EntryBox(this)), member_list_(new MemberList(room, this)),
     room_(room) {
   ui->setupUi(this);
 
@@ -43,26 +47,16 @@ RoomView::RoomView(matrix::Room &room, QWidget *parent)
       timeline_view_->verticalScrollBar()->triggerAction(QAbstractSlider::SliderPageStepAdd);
     });
   connect(entry_, &EntryBox::activity, timeline_view_, &TimelineView::read_events);
+  entry_->set_completer([this](const QString &prefix) { return room_.complete(prefix, COMPLETION_LIMIT); });
 
   connect(&room_, &matrix::Room::message, this, &RoomView::message);
+  connect(&room_, &matrix::Room::local_echo, this, &RoomView::local_echo);
+  connect(&room_, &matrix::Room::local_echo_failed, timeline_view_, &TimelineView::local_echo_failed);
   connect(&room_, &matrix::Room::error, timeline_view_, &TimelineView::push_error);
 
-  connect(&room_, &matrix::Room::membership_changed, this, &RoomView::membership_changed);
-  connect(&room_, &matrix::Room::member_name_changed, this, &RoomView::member_name_changed);
-
   connect(&room_, &matrix::Room::discontinuity, timeline_view_, &TimelineView::reset);
   connect(&room_, &matrix::Room::prev_batch, timeline_view_, &TimelineView::end_batch);
 
-  auto replay_state = room_.initial_state();
-  for(const auto &batch : room_.buffer()) {
-    timeline_view_->end_batch(batch.prev_batch);
-    for(const auto &event : batch.events) {
-      if(auto s = event.to_state()) replay_state.apply(*s);
-      append_message(replay_state, event);
-      replay_state.prune_departed();
-    }
-  }
-
   connect(&room_, &matrix::Room::topic_changed, this, &RoomView::topic_changed);
   topic_changed();
 }
@@ -73,12 +67,12 @@ void RoomView::message(const matrix::event::Room &evt) {
   append_message(room_.state(), evt);
 }
 
-void RoomView::member_name_changed(const matrix::Member &member, QString old) {
-  member_list_->member_display_changed(room_.state(), member, old);
-}
-
-void RoomView::membership_changed(const matrix::Member &member) {
-  member_list_->membership_changed(room_.state(), member);
+void RoomView::local_echo(const matrix::Room::PendingEvent &evt) {
+  try {
+    timeline_view_->push_local_echo(room_.state(), evt);
+  } catch(const matrix::malformed_event &e) {
+    qDebug() << "WARNING:" << room_.pretty_name() << "not displaying malformed event:" << e.what();
+  }
 }
 
 void RoomView::append_message(const matrix::RoomState &state, const matrix::event::Room &msg) {
@@ -104,6 +98,18 @@ void RoomView::topic_changed() {
 void RoomView::command(const QString &name, const QString &args) {
   if(name == "me") {
     room_.send_emote(args);
+  } else if(name == "jump") {
+    const auto target = args.trimmed();
+    if(target.startsWith('$')) {
+      timeline_view_->jump_to(matrix::EventID(target));
+    } else {
+      auto time = QDateTime::fromString(target, Qt::ISODate);
+      if(time.isValid()) {
+        timeline_view_->jump_to_time(time);
+      } else {
+        timeline_view_->push_error(tr("Expected an event ID or ISO 8601 date, got: %1").arg(target));
+      }
+    }
   } else if(name == "join") {
     auto req = room_.session().join(args);
     connect(req, &matrix::JoinRequest::error, timeline_view_, &TimelineView::push_error);
@@ -112,6 +118,18 @@ void RoomView::command(const QString &name, const QString &args) {
   }
 }
 
+void RoomView::jump_to(const matrix::EventID &event) {
+  timeline_view_->jump_to(event);
+}
+
+std::experimental::optional<matrix::EventID> RoomView::anchor() const {
+  return timeline_view_->anchor();
+}
+
+void RoomView::restore_anchor(const matrix::EventID &event) {
+  timeline_view_->restore_anchor(event);
+}
+
 void RoomView::selected() {
   timeline_view_->read_events();
 }
@@ -5,21 +5,12 @@
 
 #include "QStringHash.hpp"
 
+#include "matrix/Room.hpp"
+
 namespace Ui {
 class RoomView;
 }
 
-namespace matrix {
-class Room;
-class RoomState;
-class Member;
-enum class Membership;
-
-namespace event {
-class Room;
-}
-}
-
 class TimelineView;
 class EntryBox;
 class MemberList;
@@ -38,6 +29,12 @@ public:
   void selected();
   // Notify that user action has brought the room into view. Triggers read receipts.
 
+  void jump_to(const matrix::EventID &event);
+
+  std::experimental::optional<matrix::EventID> anchor() const;
+  void restore_anchor(const matrix::EventID &event);
+  // See TimelineView
+
 private:
   Ui::RoomView *ui;
   TimelineView *timeline_view_;
@@ -46,8 +43,7 @@ private:
   matrix::Room &room_;
 
   void message(const matrix::event::Room &);
-  void membership_changed(const matrix::Member &);
-  void member_name_changed(const matrix::Member &, QString);
+  void local_echo(const matrix::Room::PendingEvent &);
   void topic_changed();
   void append_message(const matrix::RoomState &, const matrix::event::Room &);
   void command(const QString &name, const QString &args);
@@ -46,7 +46,8 @@ RoomViewList::RoomViewList(QWidget *parent) : QListWidget(parent), menu_(new QMe
 }
 
 RoomViewList::RoomInfo::RoomInfo(QListWidgetItem *i, const matrix::Room &r)
-  : item{i}, has_unread{false}, name{r.pretty_name_highlights()}, highlight_count{r.highlight_count() + r.notification_count()}
+  : item{i}, has_unread{false}, name{r.pretty_name_highlights()}, highlight_count{r.highlight_count() + r.notification_count()},
+    name_version{r.pretty_name_version()}
     {}
 
 void RoomViewList::add(matrix::Room &room) {
@@ -81,9 +82,16 @@ void RoomViewList::activate(const matrix::RoomID &room) {
 
 void RoomViewList::update_display(matrix::Room &room) {
   auto &i = items_.at(room.id());
+  const size_t highlight_count = room.highlight_count() + room.notification_count();
+  const bool has_unread = room.has_unread();
+  if(i.name_version == room.pretty_name_version() && i.highlight_count == highlight_count && i.has_unread == has_unread
+     && !i.item->text().isEmpty()) {
+    return;
+  }
+  i.name_version = room.pretty_name_version();
   i.name = room.pretty_name_highlights();
-  i.highlight_count = room.highlight_count() + room.notification_count();
-  i.has_unread = room.has_unread();
+  i.highlight_count = highlight_count;
+  i.has_unread = has_unread;
   update_item(i);
 }
 
@@ -42,6 +42,7 @@ private:
     bool has_unread;
     QString name;
     size_t highlight_count;
+    uint64_t name_version;
   };
 
   std::unordered_map<matrix::RoomID, RoomInfo> items_;
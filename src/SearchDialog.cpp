@@ -0,0 +1,57 @@
+#include "SearchDialog.hpp"
+#include "ui_SearchDialog.h"
+
+#include <chrono>
+
+#include <QDateTime>
+
+#include "matrix/Session.hpp"
+
+static constexpr size_t RESULT_LIMIT = 50;
+
+static constexpr int SEARCH_DELAY = 150;  // ms
+
+static constexpr int ROOM_ROLE = Qt::UserRole;
+static constexpr int EVENT_ROLE = Qt::UserRole + 1;
+
+SearchDialog::SearchDialog(matrix::Session &session, QWidget *parent)
+  : QDialog(parent), ui(new Ui::SearchDialog), session_(session) {
+  ui->setupUi(this);
+
+  search_timer_.setSingleShot(true);
+  search_timer_.setInterval(SEARCH_DELAY);
+  connect(&search_timer_, &QTimer::timeout, this, &SearchDialog::search);
+  connect(ui->query, &QLineEdit::textChanged, &search_timer_, static_cast<void (QTimer::*)()>(&QTimer::start));
+  connect(ui->results, &QListWidget::itemActivated, [this](QListWidgetItem *item) {
+      activated(matrix::RoomID(item->data(ROOM_ROLE).toString()), matrix::EventID(item->data(EVENT_ROLE).toString()));
+    });
+}
+
+SearchDialog::~SearchDialog() { delete ui; }
+
+void SearchDialog::search() {
+  ui->results->clear();
+  ui->status->clear();
+  const QString query = ui->query->text();
+  if(query.trimmed().isEmpty()) return;
+
+  const auto start = std::chrono::steady_clock::now();
+  const auto hits = session_.search(query, RESULT_LIMIT);
+  const auto elapsed = std::chrono::duration_cast<std::chrono::duration<double, std::milli>>(std::chrono::steady_clock::now() - start);
+
+  for(const auto &hit : hits) {
+    QString room_name = hit.room.value();
+    QString sender_name = hit.sender.value();
+    if(auto room = session_.room_from_id(hit.room)) {
+      room_name = room->pretty_name();
+      if(auto member = room->state().member_from_id(hit.sender)) sender_name = room->state().member_name(*member);
+    }
+    auto item = new QListWidgetItem(tr("%1 — %2: %3").arg(room_name).arg(sender_name).arg(hit.snippet));
+    item->setToolTip(QDateTime::fromMSecsSinceEpoch(hit.origin_server_ts).toString(Qt::DefaultLocaleLongDate));
+    item->setData(ROOM_ROLE, hit.room.value());
+    item->setData(EVENT_ROLE, hit.event.value());
+    ui->results->addItem(item);
+  }
+
+  ui->status->setText(tr("%n result(s) in %1 ms", "", static_cast<int>(hits.size())).arg(elapsed.count(), 0, 'f', 1));
+}
@@ -0,0 +1,35 @@
+#ifndef NATIVE_CHAT_SEARCH_DIALOG_HPP_
+#define NATIVE_CHAT_SEARCH_DIALOG_HPP_
+
+#include <QDialog>
+#include <QTimer>
+
+#include "matrix/ID.hpp"
+
+namespace Ui {
+class SearchDialog;
+}
+
+namespace matrix {
+class Session;
+}
+
+class SearchDialog : public QDialog {
+  Q_OBJECT
+
+public:
+  SearchDialog(matrix::Session &session, QWidget *parent = nullptr);
+  ~SearchDialog();
+
+signals:
+  void activated(const matrix::RoomID &room, const matrix::EventID &event);
+
+private:
+  Ui::SearchDialog *ui;
+  matrix::Session &session_;
+  QTimer search_timer_;         // Restarted on each edit, so that a query is only run once typing pauses
+
+  void search();
+};
+
+#endif
@@ -1,7 +1,9 @@
 #include "TimelineView.hpp"
 
 #include <chrono>
+#include <algorithm>
 #include <cmath>
+#include <stdexcept>
 
 #include <QDebug>
 #include <QScrollBar>
@@ -12,9 +14,9 @@
 #include <QMenu>
 #include <QTimer>
 #include <QToolTip>
-#include <QMimeDatabase>
 
 #include "matrix/Session.hpp"
+#include "matrix/Trace.hpp"
 #include "Spinner.hpp"
 
 using std::experimental::optional;
@@ -30,11 +32,10 @@ TimelineView::TimelineView(matrix::Room &room, QWidget *parent)
     : QAbstractScrollArea(parent), room_(room), initial_state_(room.initial_state()), total_events_(0),
       head_color_alternate_(true), backlog_growing_(false), backlog_growable_(true), backlog_grow_cancelled_(false),
       min_backlog_size_(50), content_height_(0),
-      avatar_unset_(QIcon::fromTheme("unknown")),
-      avatar_loading_(QIcon::fromTheme("image-loading", avatar_unset_)),
+      avatars_(*viewport()),
       copy_(new QShortcut(QKeySequence::Copy, this)),
       grabbed_focus_(nullptr),
-      unread_events_(0) {
+      unread_events_(0), detached_(false), forward_growing_(false), jump_generation_(0) {
   setHorizontalScrollBarPolicy(Qt::ScrollBarAlwaysOff);
   setVerticalScrollBarPolicy(Qt::ScrollBarAlwaysOn);
   verticalScrollBar()->setSingleStep(20);  // Taken from QScrollArea
@@ -49,6 +50,7 @@ TimelineView::TimelineView(matrix::Room &room, QWidget *parent)
   connect(verticalScrollBar(), &QAbstractSlider::valueChanged, [this](int value) {
       (void)value;
       grow_backlog();
+      grow_forward();
     });
   connect(copy_, &QShortcut::activated, this, &TimelineView::copy);
 
@@ -61,13 +63,99 @@ TimelineView::TimelineView(matrix::Room &room, QWidget *parent)
     Spinner::paint(palette().color(QPalette::Shadow), palette().color(QPalette::Base), painter, extent);
     spinner_.setDevicePixelRatio(devicePixelRatioF());
   }
+
+  replay_buffer();
+}
+
+void TimelineView::replay_buffer() {
+  auto state = room_.initial_state();
+  std::unordered_set<QString, QStringHash> echoed;
+  for(const auto &batch : room_.buffer()) {
+    end_batch(batch.prev_batch);
+    for(const auto &event : batch.events) {
+      if(auto s = event.to_state()) state.apply(*s);
+      if(!event.redacted()) {
+        try {
+          push_back(state, event);
+        } catch(const matrix::malformed_event &e) {
+          qDebug() << "WARNING:" << room_.pretty_name() << "discarding malformed event:" << e.what();
+          qDebug() << event.json();
+        }
+      }
+      state.prune_departed();
+      if(auto u = event.unsigned_data()) echoed.insert(u->value("transaction_id").toString());
+    }
+  }
+
+  for(const auto &event : room_.pending_events()) {
+    if(echoed.count(event.transaction_id)) continue;
+    try {
+      push_local_echo(room_.state(), event);
+    } catch(const matrix::malformed_event &e) {
+      qDebug() << "WARNING:" << room_.pretty_name() << "not displaying malformed event:" << e.what();
+    }
+  }
 }
 
 void TimelineView::push_back(const matrix::RoomState &state, const matrix::event::Room &in) {
+  if(detached_) return;  // Picked up from the room's buffer when we return to live
+  TRACE_SCOPE("TimelineView::push_back");
+
+  if(in.sender() == room_.session().user_id()) {
+    if(auto u = in.unsigned_data()) {
+      auto it = local_echoes_.find(u->value("transaction_id").toString());
+      if(it != local_echoes_.end()) {
+        // Our own event has come back. Its content is what we sent, so the existing layout stays valid.
+        it->second->data = in;
+        it->second->status = Event::Status::CONFIRMED;
+        local_echoes_.erase(it);
+        viewport()->update();
+        return;
+      }
+    }
+  }
+
+  append(state, in);
+
+  unread_events_ += 1;
+}
+
+void TimelineView::push_local_echo(const matrix::RoomState &state, const matrix::Room::PendingEvent &e) {
+  if(detached_) {
+    // The user's writing, so they want to see the present. This replays all pending events, including e.
+    return_to_live();
+    return;
+  }
+  if(batches_.empty()) return;  // No timeline yet; the event will show up when it's received
+
+  using namespace std::chrono;
+  const auto now = duration_cast<milliseconds>(system_clock::now().time_since_epoch()).count();
+  matrix::event::Room evt(matrix::event::Identifiable(matrix::Event(QJsonObject{
+          {"type", e.type},
+          {"content", e.content},
+          {"event_id", "$local." + e.transaction_id},
+          {"sender", room_.session().user_id().value()},
+          {"origin_server_ts", static_cast<double>(now)},
+          {"unsigned", QJsonObject{{"transaction_id", e.transaction_id}}}
+        })));
+  auto &event = append(state, evt);
+  event.status = Event::Status::PENDING;
+  local_echoes_[e.transaction_id] = &event;
+}
+
+void TimelineView::local_echo_failed(const QString &transaction_id) {
+  auto it = local_echoes_.find(transaction_id);
+  if(it == local_echoes_.end()) return;
+  it->second->status = Event::Status::FAILED;
+  local_echoes_.erase(it);
+  viewport()->update();
+}
+
+Event &TimelineView::append(const matrix::RoomState &state, const matrix::event::Room &in) {
   backlog_growable_ &= in.type() != matrix::event::room::Create::tag();
 
   assert(!batches_.empty());
-  batches_.back().events.emplace_back(block_info(), state, in);
+  batches_.back().events.emplace_back(block_info(), state, in, room_.is_highlight(in));
   auto &event = batches_.back().events.back();
 
   if(!blocks_.empty()
@@ -96,10 +184,15 @@ void TimelineView::push_back(const matrix::RoomState &state, const matrix::event
 
   viewport()->update();
 
-  unread_events_ += 1;
+  return event;
 }
 
 void TimelineView::end_batch(const matrix::TimelineCursor &token) {
+  if(detached_) return;
+  start_batch(token);
+}
+
+void TimelineView::start_batch(const matrix::TimelineCursor &token) {
   if(batches_.empty()) {
     prev_batch_ = token;
   } else {
@@ -122,23 +215,12 @@ BlockRenderInfo TimelineView::block_info() const {
 }
 
 void TimelineView::update_scrollbar(bool grew_upward) {
-  const auto view_height = viewport()->contentsRect().height();
-  auto &scroll = *verticalScrollBar();
-  const int fake_height = content_height_ + scrollback_status_size();
-  const bool was_at_bottom = scroll.value() == scroll.maximum();
-  const int old_wrt_bottom = scroll.maximum() - scroll.value();
-  scroll.setMaximum(view_height > fake_height ? 0 : fake_height - view_height);
-  if(was_at_bottom) {
-    // Always remain at the bottom if we started there
-    scroll.setValue(scroll.maximum());
-  } else if(grew_upward) {
-    // Stay fixed relative to bottom if the top grew
-    scroll.setValue(old_wrt_bottom > scroll.maximum() ? 0 : scroll.maximum() - old_wrt_bottom);
-  }
-  // Otherwise we want to stay fixed relative to the top, i.e. do nothing
+  update_scroll_range(*verticalScrollBar(), viewport()->contentsRect().height(), content_height_ + scrollback_status_size(),
+                      grew_upward);
 }
 
 void TimelineView::paintEvent(QPaintEvent *) {
+  TRACE_OPERATION("TimelineView::paintEvent");
   const QRectF view_rect = viewport()->contentsRect();
   QPainter painter(viewport());
   painter.fillRect(view_rect, palette().color(QPalette::Dark));
@@ -147,7 +229,6 @@ void TimelineView::paintEvent(QPaintEvent *) {
   QPointF offset(0, view_rect.height() - (scroll.value() - scroll.maximum()));
   const float half_spacing = block_info().spacing()/2.0;
   bool alternate = head_color_alternate_;
-  const int margin = block_info().margin();
   visible_blocks_.clear();
   SelectionScanner ss(selection_);
   for(auto it = blocks_.rbegin(); it != blocks_.rend(); ++it) {
@@ -160,29 +241,11 @@ void TimelineView::paintEvent(QPaintEvent *) {
     }
     if(offset.y() - half_spacing < view_rect.bottom()) {
       visible_blocks_.push_back(VisibleBlock{&*it, bounds.translated(offset)});
-      {
-        const QRectF outline(offset.x(), offset.y() - half_spacing,
-                             view_rect.width(), bounds.height() + block_info().spacing() + 0.5 / devicePixelRatioF());
-        painter.save();
-        painter.setRenderHint(QPainter::Antialiasing);
-        QPainterPath path;
-        path.addRoundedRect(outline, margin*2, margin*2);
-        painter.fillPath(path, palette().color(alternate ? QPalette::AlternateBase : QPalette::Base));
-        painter.restore();
-      }
-      QPixmap avatar_pixmap;
-      const auto av_size = block_info().avatar_size();
-      if(it->avatar()) {
-        auto a = avatars_.at(*it->avatar());
-        if(a.pixmap.isNull()) {
-          avatar_pixmap = avatar_loading_.pixmap(av_size, av_size);
-        } else {
-          avatar_pixmap = a.pixmap;
-        }
-      } else {
-        avatar_pixmap = avatar_unset_.pixmap(av_size, av_size);
-      }
-      it->draw(block_info(), painter, offset, avatar_pixmap, hasFocus(), ss.fully_selected(&*it), ss.start_point(), ss.end_point());
+      const QRectF outline(offset.x(), offset.y() - half_spacing,
+                           view_rect.width(), bounds.height() + block_info().spacing() + 0.5 / devicePixelRatioF());
+      Block::draw_backdrop(block_info(), painter, outline, palette().color(alternate ? QPalette::AlternateBase : QPalette::Base));
+      it->draw(block_info(), painter, offset, avatars_.pixmap(it->avatar(), block_info().avatar_size()), hasFocus(),
+               ss.fully_selected(&*it), ss.start_point(), ss.end_point());
     }
     offset.ry() -= half_spacing;
     alternate = !alternate;
@@ -207,6 +270,7 @@ void TimelineView::resizeEvent(QResizeEvent *e) {
 
   if(e->size().width() != e->oldSize().width()) {
     // Linebreaks may have changed, so we need to lay everything out again
+    TRACE_OPERATION("TimelineView::relayout");
     content_height_ = 0;
     const auto s = block_info().spacing();
     for(auto &batch : batches_) {
@@ -224,6 +288,10 @@ void TimelineView::resizeEvent(QResizeEvent *e) {
   // Required uncondtionally since height *and* width matter due to text wrapping. Placed after content_height_ changes
   // to ensure they're accounted for.
 
+  if(pending_anchor_) {
+    restore_anchor(*pending_anchor_);
+  }
+
   grow_backlog();  // In case we can newly see the end
 }
 
@@ -232,6 +300,38 @@ void TimelineView::showEvent(QShowEvent *e) {
   grow_backlog();  // Make sure we have something to display ASAP
 }
 
+static QFont view_font() {
+  // The application font QApplication::font(const QWidget *) would choose for a TimelineView, without constructing one
+  for(auto meta = &TimelineView::staticMetaObject; meta; meta = meta->superClass()) {
+    const QFont font = QApplication::font(meta->className());
+    if(font != QApplication::font()) return font;
+  }
+  return QApplication::font();
+}
+
+void TimelineView::warm_up(matrix::Room &room, const QWidget &context) {
+  if(!room.buffer().empty()) {
+    room.prefetch_messages(matrix::Direction::BACKWARD, room.buffer().front().prev_batch, BACKLOG_BATCH_SIZE);
+  }
+
+  // Must match the requests made by ref_avatar. A view lives in a window of its own, so context's font is no guide.
+  const auto size = BlockRenderInfo(room.session().user_id(), context.palette(), view_font(), 0).avatar_size();
+  const QSize thumbnail_size = context.devicePixelRatioF() * QSize(size, size);
+  std::unordered_set<matrix::UserID> senders;
+  for(const auto &batch : room.buffer()) {
+    for(const auto &event : batch.events) {
+      senders.insert(event.sender());
+    }
+  }
+  for(const auto &sender : senders) {
+    auto member = room.state().member_from_id(sender);
+    if(!member || !member->avatar_url()) continue;
+    try {
+      room.session().get_thumbnail(matrix::Content(*member->avatar_url()), thumbnail_size);
+    } catch(const std::invalid_argument &) {}
+  }
+}
+
 void TimelineView::grow_backlog() {
   if(verticalScrollBar()->value() >= scrollback_trigger_size() || backlog_growing_ || !backlog_growable_ || !prev_batch_) return;
   backlog_growing_ = true;
@@ -249,6 +349,7 @@ void TimelineView::backlog_grow_error() {
 }
 
 void TimelineView::prepend_batch(const matrix::TimelineCursor &start, const matrix::TimelineCursor &end, gsl::span<const matrix::event::Room> events) {
+  TRACE_OPERATION("TimelineView::prepend_batch");
   backlog_growing_ = false;
   if(backlog_grow_cancelled_) {
     backlog_grow_cancelled_ = false;
@@ -267,7 +368,7 @@ void TimelineView::prepend_batch(const matrix::TimelineCursor &start, const matr
         // Make sure a just-departed member is accounted for in e.g. display name and disambiguation lookups
         initial_state_.ensure_member(matrix::event::room::Member(matrix::event::room::State(e))); 
       }
-      batch.events.emplace_front(block_info(), initial_state_, e);
+      batch.events.emplace_front(block_info(), initial_state_, e, room_.is_highlight(e));
     } catch(const matrix::malformed_event &ex) {
       initial_state_.prune_departed();
 
@@ -287,7 +388,7 @@ void TimelineView::prepend_batch(const matrix::TimelineCursor &start, const matr
       const optional<matrix::Content> &new_avatar = blocks_.front().avatar();
       if(new_avatar != original_avatar) {
         if(original_avatar) {
-          unref_avatar(*original_avatar);
+          avatars_.unref(*original_avatar);
         }
         if(new_avatar) {
           ref_avatar(*new_avatar);
@@ -309,6 +410,11 @@ void TimelineView::prepend_batch(const matrix::TimelineCursor &start, const matr
 
   update_scrollbar(true);
 
+  if(backlog_growable_ && events.size() != 0) {
+    // Fetch the next page while the user reads this one
+    room_.prefetch_messages(matrix::Direction::BACKWARD, *prev_batch_, BACKLOG_BATCH_SIZE);
+  }
+
   grow_backlog();  // Check if the user is still seeing blank space.
   viewport()->update();
 }
@@ -357,7 +463,7 @@ void TimelineView::prune_backlog() {
     while(&blocks_.front() != end_block) {
       auto &block = blocks_.front();
       height_lost += block.bounding_rect(block_info()).height() + block_info().spacing();
-      if(block.avatar()) unref_avatar(*block.avatar());
+      if(block.avatar()) avatars_.unref(*block.avatar());
       pop_front_block();
     }
 
@@ -371,7 +477,7 @@ void TimelineView::prune_backlog() {
     // Free end_block if necessary, and compute final height change
     int final_first_block_height;
     if(blocks_.front().events().empty()) {
-      if(blocks_.front().avatar()) unref_avatar(*blocks_.front().avatar());
+      if(blocks_.front().avatar()) avatars_.unref(*blocks_.front().avatar());
       pop_front_block();
       final_first_block_height = 0;
     } else {
@@ -379,6 +485,12 @@ void TimelineView::prune_backlog() {
     }
     height_lost += original_first_block_height - final_first_block_height;
 
+    for(const auto &event : batch.events) {
+      if(event.status == Event::Status::PENDING) {
+        local_echoes_.erase(event.data.unsigned_data()->value("transaction_id").toString());
+      }
+    }
+
     events_removed += batch.size();
     total_events_ -= batch.size();
     content_height_ -= height_lost;
@@ -401,42 +513,206 @@ void TimelineView::pop_front_block() {
   blocks_.pop_front();
 }
 
-void TimelineView::set_avatar(const matrix::Content &content, const QString &type, const QString &disposition,
-                              const QByteArray &data) {
-  (void)disposition;
-  auto it = avatars_.find(content);
-  if(it == avatars_.end()) return;  // Avatar is no longer necessary
-
-  QPixmap pixmap;
-  pixmap.loadFromData(data, QMimeDatabase().mimeTypeForName(type.toUtf8()).preferredSuffix().toUtf8().constData());
-  if(pixmap.isNull()) pixmap.loadFromData(data);
-
-  const auto size = block_info().avatar_size() * devicePixelRatioF();
-  if(pixmap.width() > size || pixmap.height() > size)
-    pixmap = pixmap.scaled(size, size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
-  pixmap.setDevicePixelRatio(devicePixelRatioF());
-  avatars_.at(content).pixmap = pixmap;
-  viewport()->update();
-}
-
-void TimelineView::unref_avatar(const matrix::Content &content) {
-  auto it = avatars_.find(content);
-  --it->second.references;
-  if(it->second.references == 0) {
-    avatars_.erase(it);
-  }
+void TimelineView::reset() {
+  if(detached_) return;
+  clear();
 }
 
-void TimelineView::reset() {
+void TimelineView::clear() {
+  selection_ = {};
+  grabbed_focus_ = nullptr;
+  visible_blocks_.clear();
   batches_.clear();
   blocks_.clear();
   avatars_.clear();
+  local_echoes_.clear();
   initial_state_ = room_.initial_state();
   total_events_ = 0;
   backlog_growable_ = true;
   content_height_ = 0;
   prev_batch_ = {};  // Should be filled in again before control returns to the main loop
   if(backlog_growing_) backlog_grow_cancelled_ = true;
+  next_batch_ = {};
+  forward_growing_ = false;
+  unread_events_ = 0;
+}
+
+void TimelineView::jump_to(const matrix::EventID &event) {
+  const auto generation = ++jump_generation_;
+  auto reply = room_.get_context(event, BACKLOG_BATCH_SIZE);
+  connect(reply, &matrix::EventContext::finished, this,
+          [this, generation](const matrix::TimelineCursor &start, const matrix::TimelineCursor &end,
+                             gsl::span<const matrix::event::Room> before, const matrix::event::Room &target,
+                             gsl::span<const matrix::event::Room> after, gsl::span<const matrix::event::room::State> state) {
+      if(generation == jump_generation_) show_context(start, end, before, target, after, state);
+    });
+  connect(reply, &matrix::EventContext::error, this, &TimelineView::push_error);
+}
+
+void TimelineView::jump_to_time(const QDateTime &time) {
+  auto reply = room_.get_event_at(time.toMSecsSinceEpoch(), matrix::Direction::FORWARD);
+  connect(reply, &matrix::EventLookup::finished, this, [this](const matrix::EventID &event) { jump_to(event); });
+  connect(reply, &matrix::EventLookup::error, this, &TimelineView::push_error);
+}
+
+optional<matrix::EventID> TimelineView::anchor() const {
+  const auto &scroll = *verticalScrollBar();
+  if(detached_ || scroll.value() == scroll.maximum()) return {};
+  const auto center = viewport()->contentsRect().center().y();
+  for(const auto &visible : visible_blocks_) {
+    if(visible.bounds.top() <= center && center <= visible.bounds.bottom()) {
+      const auto &events = visible.block->events();
+      for(auto it = events.rbegin(); it != events.rend(); ++it) {
+        if((*it)->status == Event::Status::CONFIRMED) return (*it)->data.id();
+      }
+    }
+  }
+  return {};
+}
+
+void TimelineView::restore_anchor(const matrix::EventID &event) {
+  pending_anchor_ = {};
+  for(const auto &block : blocks_) {
+    for(const auto e : block.events()) {
+      if(e->data.id() == event) {
+        if(viewport()->contentsRect().height() == 0) {
+          pending_anchor_ = event;  // Not laid out yet
+        } else {
+          scroll_to(*e);
+        }
+        return;
+      }
+    }
+  }
+}
+
+void TimelineView::return_to_live() {
+  if(!detached_) return;
+  ++jump_generation_;
+  detached_ = false;
+  clear();
+  replay_buffer();
+  update_scrollbar(false);
+  verticalScrollBar()->setValue(verticalScrollBar()->maximum());
+  viewport()->update();
+}
+
+void TimelineView::show_context(const matrix::TimelineCursor &start, const matrix::TimelineCursor &end,
+                                gsl::span<const matrix::event::Room> before, const matrix::event::Room &target,
+                                gsl::span<const matrix::event::Room> after, gsl::span<const matrix::event::room::State> state) {
+  std::vector<const matrix::event::Room *> events;  // Chronological
+  events.reserve(before.size() + 1 + after.size());
+  for(auto i = before.size(); i > 0; --i) events.push_back(&before[i-1]);
+  events.push_back(&target);
+  for(const auto &e : after) events.push_back(&e);
+
+  // We're given the state at the end of the segment, so unwind it to find the state at the beginning
+  matrix::RoomState initial;
+  for(const auto &e : state) initial.apply(e);
+  initial.prune_departed();
+  for(auto it = events.crbegin(); it != events.crend(); ++it) {
+    if(auto s = (*it)->to_state()) initial.revert(*s);
+  }
+
+  clear();
+  detached_ = true;
+  initial_state_ = initial;
+  detached_state_ = initial;
+  start_batch(start);
+  next_batch_ = end;
+
+  const Event *target_view = nullptr;
+  for(const auto e : events) {
+    if(auto s = e->to_state()) detached_state_.apply(*s);
+    if(!e->redacted()) {
+      try {
+        auto &view = append(detached_state_, *e);
+        if(e == &target) target_view = &view;
+      } catch(const matrix::malformed_event &ex) {
+        qDebug() << "WARNING: Skipping malformed event:" << ex.what();
+        qDebug() << e->json();
+      }
+    }
+    detached_state_.prune_departed();
+  }
+
+  if(target_view) scroll_to(*target_view);
+  viewport()->update();
+  grow_backlog();
+  grow_forward();
+}
+
+void TimelineView::scroll_to(const Event &event) {
+  // Mirrors the layout in paintEvent
+  const auto spacing = block_info().spacing();
+  qreal below = 0;
+  for(auto it = blocks_.crbegin(); it != blocks_.crend(); ++it) {
+    const auto height = it->bounding_rect(block_info()).height();
+    if(std::find(it->events().begin(), it->events().end(), &event) != it->events().end()) {
+      auto &scroll = *verticalScrollBar();
+      const int value = scroll.maximum() + viewport()->contentsRect().height() / 2. - below - height / 2. - spacing / 2.;
+      scroll.setValue(std::max(0, std::min(scroll.maximum(), value)));
+      return;
+    }
+    below += height + spacing;
+  }
+}
+
+void TimelineView::grow_forward() {
+  const auto &scroll = *verticalScrollBar();
+  if(!detached_ || forward_growing_ || !next_batch_ || scroll.maximum() - scroll.value() >= scrollback_trigger_size()) return;
+  forward_growing_ = true;
+  const auto generation = jump_generation_;
+  auto reply = room_.get_messages(matrix::Direction::FORWARD, *next_batch_, BACKLOG_BATCH_SIZE);
+  connect(reply, &matrix::MessageFetch::finished, this,
+          [this, generation](const matrix::TimelineCursor &start, const matrix::TimelineCursor &end, gsl::span<const matrix::event::Room> events) {
+      if(generation == jump_generation_) append_batch(start, end, events);
+    });
+  connect(reply, &matrix::MessageFetch::error, this, [this, generation](const QString &msg) {
+      if(generation != jump_generation_) return;
+      forward_growing_ = false;
+      push_error(msg);
+    });
+}
+
+void TimelineView::append_batch(const matrix::TimelineCursor &start, const matrix::TimelineCursor &end, gsl::span<const matrix::event::Room> events) {
+  forward_growing_ = false;
+
+  if(events.size() == 0) {
+    // Nothing newer exists, so the live timeline is all that's left
+    return_to_live();
+    return;
+  }
+  std::unordered_set<matrix::EventID> live;
+  for(const auto &batch : room_.buffer()) {
+    for(const auto &e : batch.events) {
+      live.insert(e.id());
+    }
+  }
+  for(const auto &e : events) {
+    if(live.count(e.id())) {
+      // Gap closed
+      return_to_live();
+      return;
+    }
+  }
+
+  start_batch(start);
+  for(const auto &e : events) {
+    if(auto s = e.to_state()) detached_state_.apply(*s);
+    if(!e.redacted()) {
+      try {
+        append(detached_state_, e);
+      } catch(const matrix::malformed_event &ex) {
+        qDebug() << "WARNING: Skipping malformed event:" << ex.what();
+        qDebug() << e.json();
+      }
+    }
+    detached_state_.prune_departed();
+  }
+  next_batch_ = end;
+
+  grow_forward();  // Check if the user is still at the bottom
 }
 
 void TimelineView::mousePressEvent(QMouseEvent *event) {
@@ -548,6 +824,7 @@ QSize TimelineView::minimumSizeHint() const {
 void TimelineView::focusOutEvent(QFocusEvent *e) {
   dispatch_event({}, e);
   grabbed_focus_ = nullptr;
+  room_.flush_read_receipt();
 
   // Taken from QWidgetTextControl
   if(e->reason() != Qt::ActiveWindowFocusReason
@@ -575,17 +852,7 @@ bool TimelineView::viewportEvent(QEvent *e) {
 }
 
 void TimelineView::ref_avatar(const matrix::Content &content) {
-  auto result = avatars_.emplace(std::piecewise_construct,
-                                 std::forward_as_tuple(content),
-                                 std::forward_as_tuple());
-  if(result.second) {
-    // New avatar, download it
-    const auto size = block_info().avatar_size();
-    auto reply = room_.session().get_thumbnail(result.first->first, devicePixelRatioF() * QSize(size, size));
-    connect(reply, &matrix::ContentFetch::finished, this, &TimelineView::set_avatar);
-    connect(reply, &matrix::ContentFetch::error, &room_, &matrix::Room::error);
-  }
-  ++result.first->second.references;
+  avatars_.ref(room_, content, block_info().avatar_size());
 }
 
 TimelineView::VisibleBlock *TimelineView::dispatch_event(const optional<QPointF> &p, QEvent *e) {
@@ -606,16 +873,22 @@ void TimelineView::push_error(const QString &msg) {
 }
 
 void TimelineView::read_events() {
+  if(detached_) return;  // Old history doesn't count
   if(blocks_.empty() || unread_events_ == 0) return; // Nothing to have read
 
-  optional<matrix::EventID> id;
+  const Event *target = nullptr;
   if(verticalScrollBar()->value() == verticalScrollBar()->maximum()) {
     // Shortcut for the common case; also ensures accuracy when being called after a message is added but before a
-    // repaint
-    if(!blocks_.empty()) {
-      id = blocks_.back().events().back()->data.id();
-      unread_events_ = 0;
+    // repaint. Local echoes have no ID the server would recognize, so skip past them.
+    for(auto block = blocks_.crbegin(); block != blocks_.crend() && !target; ++block) {
+      for(auto event = block->events().crbegin(); event != block->events().crend(); ++event) {
+        if((*event)->status == Event::Status::CONFIRMED) {
+          target = *event;
+          break;
+        }
+      }
     }
+    unread_events_ = 0;
   } else {
     const QRectF view_rect = viewport()->contentsRect();
     const auto &front = visible_blocks_.front();
@@ -631,16 +904,16 @@ void TimelineView::read_events() {
       }
     }
     if(visible_index) {
-      id = front.block->events()[*visible_index]->data.id();
+      target = front.block->events()[*visible_index];
       hidden_events += front.block->events().size() - (1 + *visible_index);
     } else if(visible_blocks_.size() > 1) {
-      id = visible_blocks_[1].block->events().back()->data.id();
+      target = visible_blocks_[1].block->events().back();
       hidden_events += front.block->events().size();
     }
     if(hidden_events >= unread_events_) return; // Don't re-issue redundant receipts
     unread_events_ = hidden_events;
   }
-  if(id) {
-    room_.send_read_receipt(*id);
+  if(target && target->status == Event::Status::CONFIRMED) {
+    room_.send_read_receipt(target->data);
   }
 }
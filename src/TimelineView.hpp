@@ -10,8 +10,8 @@
 
 #include <QAbstractScrollArea>
 #include <QTextLayout>
-#include <QIcon>
 #include <QPixmap>
+#include <QDateTime>
 
 #include "matrix/Event.hpp"
 #include "matrix/Room.hpp"
@@ -19,6 +19,7 @@
 
 #include "QStringHash.hpp"
 #include "EventView.hpp"
+#include "AvatarCache.hpp"
 
 class TimelineView : public QAbstractScrollArea {
   Q_OBJECT
@@ -31,9 +32,25 @@ public:
 
   void push_back(const matrix::RoomState &state, const matrix::event::Room &e);
 
+  void push_local_echo(const matrix::RoomState &state, const matrix::Room::PendingEvent &e);
+  // Displays an event that's been queued for sending. It's replaced by the server's copy when that arrives in push_back.
+  void local_echo_failed(const QString &transaction_id);
+
   void reset();
   // Call if a gap arises in events
 
+  void jump_to(const matrix::EventID &event);
+  void jump_to_time(const QDateTime &time);
+  // Detaches the view from the live timeline to show the surroundings of an event, which can then be paginated in both
+  // directions. The view reattaches when forward pagination meets the live timeline.
+  void return_to_live();
+  bool detached() const { return detached_; }
+
+  std::experimental::optional<matrix::EventID> anchor() const;
+  // Event at the center of the view, or nothing if the view is following the live timeline
+  void restore_anchor(const matrix::EventID &event);
+  // Scrolls to an anchor once laid out, if it's among the locally available events
+
   QSize sizeHint() const override;
   QSize minimumSizeHint() const override;
 
@@ -44,6 +61,10 @@ public:
   void read_events();
   // Send read receipt for the most recent visible event
 
+  static void warm_up(matrix::Room &room, const QWidget &context);
+  // Fetches what a new view of room would request first, i.e. its first page of backlog and recent senders' avatars, so
+  // that it can be shown without delay. context supplies the screen the view is expected to appear on.
+
 protected:
   void paintEvent(QPaintEvent *event) override;
   void resizeEvent(QResizeEvent *event) override;
@@ -63,11 +84,6 @@ private:
     size_t size() const;
   };
 
-  struct Avatar {
-    size_t references = 0;
-    QPixmap pixmap;
-  };
-
   struct Selection {
     Block *start;               // Point where selection began
     QPointF start_pos;           // relative to start origin
@@ -135,24 +151,39 @@ private:
   size_t min_backlog_size_;
   qreal content_height_;
   std::experimental::optional<matrix::TimelineCursor> prev_batch_;  // Token for the batch immediately prior to the first message
-  std::unordered_map<matrix::Content, Avatar> avatars_;
-  QIcon avatar_unset_, avatar_loading_;
+  AvatarCache avatars_;
   std::experimental::optional<Selection> selection_;
   QShortcut *copy_;
   std::vector<VisibleBlock> visible_blocks_;
   QPixmap spinner_;
   Block *grabbed_focus_;
   size_t unread_events_;
+  std::unordered_map<QString, Event *, QStringHash> local_echoes_;  // Pending events by transaction ID
+  bool detached_;
+  matrix::RoomState detached_state_;  // State at the end of the detached segment
+  std::experimental::optional<matrix::TimelineCursor> next_batch_;  // Token for the batch after the detached segment
+  bool forward_growing_;
+  unsigned jump_generation_;  // Incremented whenever the detached segment is replaced, to ignore stale responses
+  std::experimental::optional<matrix::EventID> pending_anchor_;  // To scroll to after the next resize
 
   void update_scrollbar(bool grew_upward);
 
+  Event &append(const matrix::RoomState &state, const matrix::event::Room &e);
+  void start_batch(const matrix::TimelineCursor &token);
+  void clear();
+  void replay_buffer();
+  void show_context(const matrix::TimelineCursor &start, const matrix::TimelineCursor &end,
+                    gsl::span<const matrix::event::Room> before, const matrix::event::Room &event,
+                    gsl::span<const matrix::event::Room> after, gsl::span<const matrix::event::room::State> state);
+  void grow_forward();
+  void append_batch(const matrix::TimelineCursor &start, const matrix::TimelineCursor &end, gsl::span<const matrix::event::Room> events);
+  void scroll_to(const Event &event);
+
   void grow_backlog();
   void prepend_batch(const matrix::TimelineCursor &start, const matrix::TimelineCursor &end, gsl::span<const matrix::event::Room> events);
   void backlog_grow_error();
   int scrollback_trigger_size() const;
   int scrollback_status_size() const;
-  void set_avatar(const matrix::Content &content, const QString &type, const QString &disposition, const QByteArray &data);
-  void unref_avatar(const matrix::Content &);
   void copy();
   void pop_front_block();
   QString selection_text() const;
@@ -0,0 +1,209 @@
+#include "Watchdog.hpp"
+
+#include <algorithm>
+#include <vector>
+
+#include <QCoreApplication>
+#include <QEvent>
+#include <QDateTime>
+#include <QFileInfo>
+#include <QFile>
+#include <QDir>
+#include <QTextStream>
+#include <QDebug>
+
+#include "matrix/Trace.hpp"
+
+#if defined(Q_OS_LINUX) || defined(Q_OS_MAC)
+#define NACHAT_WATCHDOG_STACKS
+#include <csignal>
+#include <cstdlib>
+#include <pthread.h>
+#include <execinfo.h>
+#endif
+
+constexpr std::chrono::milliseconds Watchdog::DEFAULT_THRESHOLD;
+
+static constexpr std::chrono::milliseconds PING_INTERVAL{50};
+// Between an answer and the next ping. Stalls shorter than this plus the threshold may go unnoticed.
+
+static constexpr qint64 MAX_LOG_SIZE = 1024 * 1024;
+static constexpr int LOG_GENERATIONS = 3;
+// Including the current log
+
+static const QEvent::Type PING_EVENT = static_cast<QEvent::Type>(QEvent::registerEventType());
+
+namespace {
+
+class Ping : public QEvent {
+public:
+  explicit Ping(uint64_t sequence) : QEvent(PING_EVENT), sequence{sequence} {}
+
+  const uint64_t sequence;
+};
+
+using std::chrono::duration_cast;
+using std::chrono::milliseconds;
+
+qint64 ms(std::chrono::steady_clock::duration d) { return duration_cast<milliseconds>(d).count(); }
+
+}
+
+#ifdef NACHAT_WATCHDOG_STACKS
+namespace {
+
+constexpr int SAMPLE_SIGNAL = SIGUSR2;
+// Unused by Qt. SIGPROF would be more fitting, but would confuse profilers.
+
+constexpr int MAX_FRAMES = 64;
+constexpr int SKIPPED_FRAMES = 2;
+// The handler and the signal trampoline
+
+constexpr milliseconds SAMPLE_TIMEOUT{50};
+// The GUI thread might be blocked with signals masked, or inside a system call that doesn't return early
+
+pthread_t gui_thread;
+void *frames[MAX_FRAMES];
+std::atomic<int> frame_count{0};
+std::atomic<bool> sampled{false};
+
+void handle_sample(int) {
+  // backtrace is not formally async-signal-safe, but is once warmed up, and is what every crash reporter uses
+  frame_count.store(backtrace(frames, MAX_FRAMES));
+  sampled.store(true);
+}
+
+void install_sampler() {
+  gui_thread = pthread_self();
+  void *warm[1];
+  backtrace(warm, 1);           // Loads the unwinder now, rather than allocating inside the handler
+  struct sigaction action;
+  action.sa_handler = handle_sample;
+  sigemptyset(&action.sa_mask);
+  action.sa_flags = SA_RESTART;
+  sigaction(SAMPLE_SIGNAL, &action, nullptr);
+}
+
+QStringList sample_stack() {
+  QStringList result;
+  sampled.store(false);
+  if(pthread_kill(gui_thread, SAMPLE_SIGNAL) != 0) return result;
+  const auto deadline = std::chrono::steady_clock::now() + SAMPLE_TIMEOUT;
+  while(!sampled.load()) {
+    if(std::chrono::steady_clock::now() > deadline) return result;
+    std::this_thread::sleep_for(milliseconds(1));
+  }
+  const int count = frame_count.load();
+  char **symbols = backtrace_symbols(frames, count);
+  if(!symbols) return result;
+  for(int i = SKIPPED_FRAMES; i < count; ++i) {
+    result << QString::fromLocal8Bit(symbols[i]);
+  }
+  std::free(symbols);
+  return result;
+}
+
+}
+#else
+static void install_sampler() {}
+static QStringList sample_stack() { return QStringList(); }
+#endif
+
+Watchdog::Watchdog(const QString &log_path, std::chrono::milliseconds threshold, QObject *parent)
+  : QObject(parent), log_path_(log_path), threshold_(threshold), gui_operation_(matrix::trace::current_operation()) {
+  QDir().mkpath(QFileInfo(log_path_).absolutePath());
+  install_sampler();
+  thread_ = std::thread([this]() { run(); });
+}
+
+Watchdog::~Watchdog() {
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopping_ = true;
+  }
+  wake_.notify_one();
+  thread_.join();
+  write_summary();
+}
+
+void Watchdog::customEvent(QEvent *event) {
+  if(event->type() != PING_EVENT) return;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    answered_ = static_cast<Ping *>(event)->sequence;
+  }
+  wake_.notify_one();
+}
+
+void Watchdog::run() {
+  uint64_t sent = 0;
+  std::unique_lock<std::mutex> lock(mutex_);
+  while(!stopping_) {
+    const uint64_t sequence = ++sent;
+    const auto sent_at = std::chrono::steady_clock::now();
+    QCoreApplication::postEvent(this, new Ping(sequence));
+    auto answered = [&]() { return stopping_ || answered_ >= sequence; };
+    if(!wake_.wait_for(lock, threshold_, answered)) {
+      // Sample while the stall is under way; by the time it ends, the culprit has returned
+      Stall stall;
+      const char *operation = gui_operation_.load(std::memory_order_relaxed);
+      stall.operation = operation ? QString(operation) : QString("(unmarked)");
+      lock.unlock();
+      stall.stack = sample_stack();
+      lock.lock();
+      wake_.wait(lock, answered);
+      if(stopping_) break;      // Quitting is allowed to be slow
+      stall.duration = std::chrono::steady_clock::now() - sent_at;
+      lock.unlock();
+      record(stall);
+      lock.lock();
+    }
+    wake_.wait_for(lock, PING_INTERVAL, [this]() { return stopping_; });
+  }
+}
+
+void Watchdog::record(const Stall &stall) {
+  auto &totals = totals_[stall.operation];
+  ++totals.count;
+  totals.total += stall.duration;
+  totals.worst = std::max(totals.worst, stall.duration);
+
+  qDebug() << "GUI stalled for" << ms(stall.duration) << "ms in" << stall.operation;
+
+  rotate();
+  QFile file(log_path_);
+  if(!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) return;
+  QTextStream out(&file);
+  out << QDateTime::currentDateTime().toString(Qt::ISODate) << " stalled " << ms(stall.duration) << " ms in "
+      << stall.operation << " (" << totals.count << " stalls, " << ms(totals.total) << " ms total, "
+      << ms(totals.worst) << " ms worst)\n";
+  for(const auto &frame : stall.stack) {
+    out << "  " << frame << "\n";
+  }
+}
+
+void Watchdog::write_summary() {
+  if(totals_.empty()) return;
+  std::vector<std::pair<QString, Totals>> ranked(totals_.begin(), totals_.end());
+  std::sort(ranked.begin(), ranked.end(), [](const std::pair<QString, Totals> &a, const std::pair<QString, Totals> &b) {
+      return a.second.total > b.second.total;
+    });
+  rotate();
+  QFile file(log_path_);
+  if(!file.open(QIODevice::WriteOnly | QIODevice::Append | QIODevice::Text)) return;
+  QTextStream out(&file);
+  out << QDateTime::currentDateTime().toString(Qt::ISODate) << " summary, by total time stalled:\n";
+  for(const auto &x : ranked) {
+    out << "  " << x.first << ": " << x.second.count << " stalls, " << ms(x.second.total) << " ms total, "
+        << ms(x.second.worst) << " ms worst\n";
+  }
+}
+
+void Watchdog::rotate() {
+  if(QFileInfo(log_path_).size() < MAX_LOG_SIZE) return;
+  QFile::remove(log_path_ + "." + QString::number(LOG_GENERATIONS - 1));
+  for(int i = LOG_GENERATIONS - 2; i > 0; --i) {
+    QFile::rename(log_path_ + "." + QString::number(i), log_path_ + "." + QString::number(i + 1));
+  }
+  QFile::rename(log_path_, log_path_ + ".1");
+}
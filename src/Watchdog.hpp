@@ -0,0 +1,65 @@
+#ifndef NATIVE_CHAT_WATCHDOG_HPP_
+#define NATIVE_CHAT_WATCHDOG_HPP_
+
+#include <chrono>
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <atomic>
+#include <unordered_map>
+
+#include <QObject>
+#include <QStringList>
+
+#include "QStringHash.hpp"
+
+// Notices when the GUI thread stops servicing its event loop, and logs what it was doing.
+//
+// A thread of our own posts a ping to the GUI thread and waits for it to be answered. Once an answer is overdue, it
+// notes the innermost operation marked with TRACE_OPERATION on the GUI thread and, where supported, samples its stack;
+// when the answer finally arrives, the stall is appended to a log along with running totals for that operation. The log
+// is rotated as it grows, and closed with a summary ranking operations by total time stalled.
+
+class Watchdog : public QObject {
+public:
+  static constexpr std::chrono::milliseconds DEFAULT_THRESHOLD{100};
+
+  explicit Watchdog(const QString &log_path, std::chrono::milliseconds threshold = DEFAULT_THRESHOLD,
+                    QObject *parent = nullptr);
+  // Must be constructed on the GUI thread
+  ~Watchdog();
+
+protected:
+  void customEvent(QEvent *event) override;
+
+private:
+  struct Stall {
+    QString operation;
+    std::chrono::steady_clock::duration duration;
+    QStringList stack;
+  };
+
+  struct Totals {
+    uint64_t count = 0;
+    std::chrono::steady_clock::duration total{0}, worst{0};
+  };
+
+  const QString log_path_;
+  const std::chrono::milliseconds threshold_;
+  std::atomic<const char *> &gui_operation_;
+  std::unordered_map<QString, Totals, QStringHash> totals_;  // Touched only by thread_
+
+  std::mutex mutex_;
+  std::condition_variable wake_;
+  bool stopping_ = false;
+  uint64_t answered_ = 0;       // Sequence number of the latest ping the GUI thread has answered
+
+  std::thread thread_;
+
+  void run();
+  void record(const Stall &stall);
+  void write_summary();
+  void rotate();
+};
+
+#endif
@@ -0,0 +1,149 @@
+#include "fixtures.hpp"
+
+#include <QJsonArray>
+#include <QDateTime>
+#include <QStandardPaths>
+#include <QDir>
+#include <QStringBuilder>
+
+#include "matrix/Capture.hpp"
+
+namespace fixtures {
+
+const matrix::UserID self("@self:bench.invalid");
+
+static uint64_t counter = 0;
+
+static uint64_t now_ms() { return QDateTime::currentMSecsSinceEpoch(); }
+
+QString user(size_t i) {
+  return QString("@user%1:bench.invalid").arg(i);
+}
+
+QString event_id() {
+  return QString("$%1:bench.invalid").arg(++counter);
+}
+
+QJsonObject message(const QString &sender, const QString &body) {
+  return QJsonObject{
+    {"event_id", event_id()},
+    {"type", "m.room.message"},
+    {"sender", sender},
+    {"origin_server_ts", static_cast<double>(now_ms())},
+    {"content", QJsonObject{{"msgtype", "m.text"}, {"body", body}}},
+    {"unsigned", QJsonObject()}
+  };
+}
+
+QJsonObject member(const QString &user, const QString &displayname) {
+  return QJsonObject{
+    {"event_id", event_id()},
+    {"type", "m.room.member"},
+    {"sender", user},
+    {"state_key", user},
+    {"origin_server_ts", static_cast<double>(now_ms())},
+    {"content", QJsonObject{{"membership", "join"}, {"displayname", displayname}}},
+    {"unsigned", QJsonObject()}
+  };
+}
+
+QString rich_body(size_t i) {
+  return QString("user%1: have you seen https://example.com/%1/page?x=1 and *this*? "
+                 "It's been discussed at length in #room%1:bench.invalid, see also www.example.org and "
+                 "mailto:someone@example.com for details. %1 more words to pad it out a bit.").arg(i);
+}
+
+QJsonObject joined_room(std::vector<QJsonObject> timeline, const QJsonObject &receipts) {
+  QJsonArray events;
+  for(auto &e : timeline) {
+    events.append(std::move(e));
+  }
+  QJsonArray ephemeral;
+  if(!receipts.isEmpty()) ephemeral.append(QJsonObject{{"type", "m.receipt"}, {"content", receipts}});
+  return QJsonObject{
+    {"timeline", QJsonObject{{"events", events}, {"limited", false}, {"prev_batch", QString("t%1").arg(counter)}}},
+    {"ephemeral", QJsonObject{{"events", ephemeral}}}
+  };
+}
+
+QJsonObject sync(const QString &room, const QJsonObject &joined) {
+  return QJsonObject{
+    {"next_batch", QString("s%1").arg(++counter)},
+    {"rooms", QJsonObject{{"join", QJsonObject{{room, joined}}}}}
+  };
+}
+
+QJsonObject receipts(const QString &event, size_t first_user, size_t count) {
+  QJsonObject readers;
+  const double ts = now_ms();
+  for(size_t i = first_user; i < first_user + count; ++i) {
+    readers[user(i)] = QJsonObject{{"ts", ts}};
+  }
+  return QJsonObject{{event, QJsonObject{{"m.read", readers}}}};
+}
+
+QJsonObject busy_sync(size_t rooms, size_t members, size_t messages) {
+  QJsonObject join;
+  for(size_t r = 0; r < rooms; ++r) {
+    std::vector<QJsonObject> timeline;
+    timeline.reserve(members + messages);
+    for(size_t i = 0; i < members; ++i) {
+      timeline.push_back(member(user(i), QString("User %1").arg(i)));
+    }
+    for(size_t i = 0; i < messages; ++i) {
+      timeline.push_back(message(user(members ? i % members : 0), rich_body(i)));
+    }
+    join[QString("!busy%1:bench.invalid").arg(r)] = joined_room(std::move(timeline));
+  }
+  return QJsonObject{
+    {"next_batch", QString("s%1").arg(++counter)},
+    {"rooms", QJsonObject{{"join", join}}}
+  };
+}
+
+std::vector<QByteArray> recorded_syncs() {
+  std::vector<QByteArray> result;
+  const auto path = QString::fromLocal8Bit(qgetenv("NACHAT_BENCH_CAPTURE"));
+  if(path.isEmpty()) return result;
+  for(auto &record : matrix::capture::read(path)) {
+    if(record.path.endsWith("/sync") && record.status == 200) result.push_back(std::move(record.body));
+  }
+  return result;
+}
+
+static std::unique_ptr<Environment> environment;
+
+Environment &Environment::get() {
+  if(!environment) environment.reset(new Environment);
+  return *environment;
+}
+
+void Environment::destroy() {
+  environment.reset();
+}
+
+Environment::Environment() : universe_(net_) {
+  QStandardPaths::setTestModeEnabled(true);
+  QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).removeRecursively();
+  QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)).removeRecursively();
+  session_ = matrix::Session::create(universe_, QUrl("https://bench.invalid"), self, "bench");
+  session_->set_offline(true);  // Everything comes from apply_sync
+}
+
+matrix::Room &Environment::room(const QString &name, size_t members, size_t messages) {
+  const QString id = "!" % name % ":bench.invalid";
+  if(auto existing = session_->room_from_id(matrix::RoomID(id))) return *existing;
+  std::vector<QJsonObject> timeline;
+  timeline.reserve(members + messages + 1);
+  timeline.push_back(member(self.value(), "Self"));
+  for(size_t i = 0; i < members; ++i) {
+    timeline.push_back(member(user(i), QString("User %1").arg(i)));
+  }
+  for(size_t i = 0; i < messages; ++i) {
+    timeline.push_back(message(user(members ? i % members : 0), rich_body(i)));
+  }
+  session_->apply_sync(sync(id, joined_room(std::move(timeline))));
+  return *session_->room_from_id(matrix::RoomID(id));
+}
+
+}
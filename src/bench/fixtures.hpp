@@ -0,0 +1,62 @@
+#ifndef NATIVE_CHAT_BENCH_FIXTURES_HPP_
+#define NATIVE_CHAT_BENCH_FIXTURES_HPP_
+
+#include <vector>
+#include <memory>
+
+#include <QJsonObject>
+#include <QNetworkAccessManager>
+
+#include "matrix/ID.hpp"
+#include "matrix/Matrix.hpp"
+#include "matrix/Session.hpp"
+
+// Synthetic data shaped like what a homeserver sends, and a session to feed it to
+
+namespace fixtures {
+
+extern const matrix::UserID self;
+
+QString user(size_t i);
+QString event_id();
+// Unique within the run
+
+QJsonObject message(const QString &sender, const QString &body);
+QJsonObject member(const QString &user, const QString &displayname);
+QString rich_body(size_t i);
+// Message text with the links, mentions and markup that formatting has to find
+
+QJsonObject joined_room(std::vector<QJsonObject> timeline, const QJsonObject &receipts = QJsonObject());
+QJsonObject sync(const QString &room, const QJsonObject &joined);
+QJsonObject receipts(const QString &event, size_t first_user, size_t count);
+// m.read receipt content for count users starting from first_user
+
+QJsonObject busy_sync(size_t rooms, size_t members, size_t messages);
+// Rooms with members joining and messages, as in an initial sync
+
+std::vector<QByteArray> recorded_syncs();
+// Bodies of the syncs in the capture named by NACHAT_BENCH_CAPTURE, if set
+
+class Environment {
+public:
+  static Environment &get();
+  // Created on first use, with a fresh cache
+  static void destroy();
+  // Must be called before the application object goes away
+
+  matrix::Session &session() { return *session_; }
+
+  matrix::Room &room(const QString &name, size_t members, size_t messages);
+  // A room with that many joined members and messages in its timeline, created on first request
+
+private:
+  QNetworkAccessManager net_;
+  matrix::Matrix universe_;
+  std::unique_ptr<matrix::Session> session_;
+
+  Environment();
+};
+
+}
+
+#endif
@@ -0,0 +1,33 @@
+#include <vector>
+#include <cstring>
+
+#include <benchmark/benchmark.h>
+
+#include <QApplication>
+
+#include "fixtures.hpp"
+
+// Microbenchmarks for the matrix library and timeline rendering. Results are printed as JSON unless another format is
+// requested, so runs can be diffed; see --help for Google Benchmark's options. Set NACHAT_BENCH_CAPTURE to a file
+// recorded with NACHAT_RECORD to include real-world syncs.
+
+int main(int argc, char *argv[]) {
+  QCoreApplication::setOrganizationName("nachat");
+  QCoreApplication::setApplicationName("nachat-bench");
+  if(!qEnvironmentVariableIsSet("QT_QPA_PLATFORM")) qputenv("QT_QPA_PLATFORM", "offscreen");
+  QApplication app(argc, argv);
+
+  std::vector<char *> args(argv, argv + argc);
+  bool format_given = false;
+  for(auto arg : args) {
+    format_given |= std::strncmp(arg, "--benchmark_format", std::strlen("--benchmark_format")) == 0;
+  }
+  char json[] = "--benchmark_format=json";
+  if(!format_given) args.push_back(json);
+  int count = args.size();
+
+  benchmark::Initialize(&count, args.data());
+  benchmark::RunSpecifiedBenchmarks();
+  fixtures::Environment::destroy();
+  return 0;
+}
@@ -0,0 +1,125 @@
+#include <benchmark/benchmark.h>
+
+#include <QJsonDocument>
+#include <QJsonArray>
+
+#include "matrix/proto.hpp"
+#include "matrix/Room.hpp"
+
+#include "fixtures.hpp"
+
+using namespace matrix;
+
+static void parse_sync_json(benchmark::State &state) {
+  const auto data = QJsonDocument(fixtures::busy_sync(state.range(0), 20, 50)).toJson(QJsonDocument::Compact);
+  while(state.KeepRunning()) {
+    benchmark::DoNotOptimize(parse_sync(QJsonDocument::fromJson(data).object()));
+  }
+  state.SetBytesProcessed(state.iterations() * data.size());
+}
+BENCHMARK(parse_sync_json)->Arg(1)->Arg(10)->Arg(100);
+
+static void parse_sync_object(benchmark::State &state) {
+  const auto object = fixtures::busy_sync(state.range(0), 20, 50);
+  while(state.KeepRunning()) {
+    benchmark::DoNotOptimize(parse_sync(object));
+  }
+}
+BENCHMARK(parse_sync_object)->Arg(1)->Arg(10)->Arg(100);
+
+static void parse_sync_recorded(benchmark::State &state, const std::vector<QByteArray> &syncs) {
+  size_t bytes = 0;
+  for(const auto &x : syncs) {
+    bytes += x.size();
+  }
+  while(state.KeepRunning()) {
+    for(const auto &x : syncs) {
+      benchmark::DoNotOptimize(parse_sync(QJsonDocument::fromJson(x).object()));
+    }
+  }
+  state.SetBytesProcessed(state.iterations() * bytes);
+}
+
+static void event_message(benchmark::State &state) {
+  const auto json = fixtures::message(fixtures::user(0), fixtures::rich_body(0));
+  while(state.KeepRunning()) {
+    benchmark::DoNotOptimize(event::room::Message(event::Room(event::Identifiable(Event(json)))));
+  }
+}
+BENCHMARK(event_message);
+
+static void event_member(benchmark::State &state) {
+  const auto json = fixtures::member(fixtures::user(0), "User 0");
+  while(state.KeepRunning()) {
+    benchmark::DoNotOptimize(event::room::Member(event::room::State(event::Room(event::Identifiable(Event(json))))));
+  }
+}
+BENCHMARK(event_member);
+
+static void room_state_member_storm(benchmark::State &state) {
+  // Everyone joins at once, as when a large room is first synced, with colliding display names to disambiguate
+  std::vector<event::room::State> joins;
+  for(int64_t i = 0; i < state.range(0); ++i) {
+    joins.emplace_back(event::Room(event::Identifiable(Event(
+      fixtures::member(fixtures::user(i), QString("User %1").arg(i % 16))))));
+  }
+  while(state.KeepRunning()) {
+    RoomState s;
+    for(const auto &e : joins) {
+      s.apply(e);
+    }
+    benchmark::DoNotOptimize(s.members());
+  }
+  state.SetItemsProcessed(state.iterations() * joins.size());
+}
+BENCHMARK(room_state_member_storm)->Arg(100)->Arg(1000)->Arg(10000)->Unit(benchmark::kMillisecond);
+
+static void room_dispatch_receipts(benchmark::State &state) {
+  // One new message per sync, read by a crowd
+  const size_t members = state.range(0);
+  auto &env = fixtures::Environment::get();
+  env.session().set_buffer_size(50);
+  const auto &room = env.room(QString("receipts%1").arg(members), members, 10);
+  while(state.KeepRunning()) {
+    state.PauseTiming();
+    auto msg = fixtures::message(fixtures::user(0), "hello");
+    const auto id = msg["event_id"].toString();
+    const auto sync = fixtures::sync(room.id().value(), fixtures::joined_room({std::move(msg)},
+                                                                               fixtures::receipts(id, 0, members)));
+    state.ResumeTiming();
+    env.session().apply_sync(sync);
+  }
+}
+BENCHMARK(room_dispatch_receipts)->Arg(10)->Arg(100)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+static void room_has_unread(benchmark::State &state) {
+  // Our receipt is on the oldest event, so the whole buffer is searched
+  const size_t messages = state.range(0);
+  auto &env = fixtures::Environment::get();
+  env.session().set_buffer_size(messages);
+  auto &room = env.room(QString("unread%1").arg(messages), 20, messages);
+  const auto &first = room.buffer().front().events.front();
+  env.session().apply_sync(fixtures::sync(room.id().value(), fixtures::joined_room(
+    {}, QJsonObject{{first.id().value(), QJsonObject{{"m.read", QJsonObject{{fixtures::self.value(), QJsonObject{{"ts", 0}}}}}}}})));
+  while(state.KeepRunning()) {
+    benchmark::DoNotOptimize(room.has_unread());
+  }
+}
+BENCHMARK(room_has_unread)->Arg(50)->Arg(500)->Arg(5000);
+
+static void session_cache_state(benchmark::State &state) {
+  const size_t members = state.range(0);
+  auto &env = fixtures::Environment::get();
+  env.session().set_buffer_size(50);
+  const auto &room = env.room(QString("cache%1").arg(members), members, 50);
+  while(state.KeepRunning()) {
+    env.session().cache_state(room);
+  }
+}
+BENCHMARK(session_cache_state)->Arg(10)->Arg(1000)->Unit(benchmark::kMillisecond);
+
+static const bool recorded_registered = []() {
+  auto syncs = fixtures::recorded_syncs();
+  if(!syncs.empty()) benchmark::RegisterBenchmark("parse_sync_recorded", parse_sync_recorded, std::move(syncs));
+  return true;
+}();
@@ -0,0 +1,101 @@
+#include <deque>
+
+#include <benchmark/benchmark.h>
+
+#include <QApplication>
+
+#include "matrix/Room.hpp"
+
+#include "EventView.hpp"
+#include "TimelineView.hpp"
+
+#include "fixtures.hpp"
+
+static constexpr qreal VIEW_WIDTH = 600;
+
+static BlockRenderInfo render_info() {
+  return BlockRenderInfo(fixtures::self, QApplication::palette(), QApplication::font(), VIEW_WIDTH);
+}
+
+static std::vector<matrix::event::Room> messages(size_t count) {
+  std::vector<matrix::event::Room> result;
+  result.reserve(count);
+  for(size_t i = 0; i < count; ++i) {
+    result.emplace_back(matrix::event::Identifiable(matrix::Event(
+      fixtures::message(fixtures::user(i % 4), fixtures::rich_body(i)))));
+  }
+  return result;
+}
+
+static void format_text(benchmark::State &state) {
+  auto &room = fixtures::Environment::get().room("format", 20, 0);
+  const auto info = render_info();
+  const auto events = messages(64);
+  size_t i = 0;
+  while(state.KeepRunning()) {
+    const auto &e = events[i++ % events.size()];
+    benchmark::DoNotOptimize(info.format_text(room.state(), e, e.content().json()["body"].toString(), false));
+  }
+}
+BENCHMARK(format_text);
+
+static void event_layout(benchmark::State &state) {
+  auto &room = fixtures::Environment::get().room("event_layout", 20, 0);
+  const auto info = render_info();
+  const auto events = messages(64);
+  size_t i = 0;
+  while(state.KeepRunning()) {
+    Event e(info, room.state(), events[i++ % events.size()]);
+    benchmark::DoNotOptimize(e.bounding_rect());
+  }
+}
+BENCHMARK(event_layout);
+
+static void event_relayout(benchmark::State &state) {
+  // As on resize
+  auto &room = fixtures::Environment::get().room("event_relayout", 20, 0);
+  auto info = render_info();
+  const auto events = messages(1);
+  Event e(info, room.state(), events.front());
+  qreal width = VIEW_WIDTH;
+  while(state.KeepRunning()) {
+    width = width == VIEW_WIDTH ? VIEW_WIDTH / 2 : VIEW_WIDTH;
+    e.update_layout(BlockRenderInfo(fixtures::self, QApplication::palette(), QApplication::font(), width));
+    benchmark::DoNotOptimize(e.bounding_rect());
+  }
+}
+BENCHMARK(event_relayout);
+
+static void block_layout(benchmark::State &state) {
+  // A block of consecutive messages from one sender
+  auto &room = fixtures::Environment::get().room("block_layout", 20, 0);
+  const auto info = render_info();
+  std::deque<Event> events;
+  for(const auto &e : messages(state.range(0))) {
+    events.emplace_back(info, room.state(), e);
+  }
+  while(state.KeepRunning()) {
+    Block block(info, room.state(), events.front());
+    for(auto it = events.begin() + 1; it != events.end(); ++it) {
+      block.events().push_back(&*it);
+    }
+    block.update_layout(info);
+    benchmark::DoNotOptimize(block.bounding_rect(info));
+  }
+}
+BENCHMARK(block_layout)->Arg(1)->Arg(10)->Arg(50);
+
+static void timeline_push_back(benchmark::State &state) {
+  // Once the backlog passes its minimum, every new event prunes
+  auto &room = fixtures::Environment::get().room("timeline", 20, 0);
+  TimelineView view(room);
+  view.resize(static_cast<int>(VIEW_WIDTH), 400);
+  view.end_batch(matrix::TimelineCursor("t0"));
+  const auto events = messages(256);
+  size_t i = 0;
+  while(state.KeepRunning()) {
+    view.push_back(room.state(), events[i++ % events.size()]);
+    if(i % 50 == 0) view.end_batch(matrix::TimelineCursor(QString("t%1").arg(i)));
+  }
+}
+BENCHMARK(timeline_push_back);
@@ -0,0 +1,284 @@
+#include "Server.hpp"
+
+#include <algorithm>
+
+#include <QTcpSocket>
+#include <QTimer>
+#include <QUrlQuery>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QImage>
+#include <QColor>
+#include <QBuffer>
+
+#include "World.hpp"
+
+using std::experimental::optional;
+
+static constexpr int MEDIA_CACHE_SIZE = 16 * 1024 * 1024;
+
+static constexpr int MEDIA_SIZE = 256;
+// Dimensions of full-size images; thumbnails are rendered at the requested size, up to this
+
+static constexpr int MAX_SYNC_TIMEOUT_MS = 60 * 1000;
+
+static QByteArray reason(int status) {
+  switch(status) {
+  case 200: return "OK";
+  case 400: return "Bad Request";
+  case 401: return "Unauthorized";
+  case 403: return "Forbidden";
+  case 404: return "Not Found";
+  default: return "Error";
+  }
+}
+
+Server::Server(World &world, QObject *parent) : QObject(parent), world_(world), media_(MEDIA_CACHE_SIZE) {
+  connect(&server_, &QTcpServer::newConnection, this, &Server::accept);
+  connect(&world_, &World::changed, this, &Server::wake);
+}
+
+bool Server::listen(const QHostAddress &address, quint16 port) {
+  return server_.listen(address, port);
+}
+
+void Server::accept() {
+  while(auto socket = server_.nextPendingConnection()) {
+    connections_.emplace(socket, Connection());
+    connect(socket, &QTcpSocket::readyRead, this, [this, socket]() { read(socket); });
+    connect(socket, &QTcpSocket::disconnected, this, [this, socket]() {
+        connections_.erase(socket);
+        pending_.erase(std::remove_if(pending_.begin(), pending_.end(),
+                                      [socket](const PendingSync &p) { return p.socket == socket; }),
+                       pending_.end());
+        socket->deleteLater();
+      });
+  }
+}
+
+void Server::read(QTcpSocket *socket) {
+  auto it = connections_.find(socket);
+  if(it == connections_.end()) return;
+  auto &c = it->second;
+  const auto data = socket->readAll();
+  stats_.bytes_in += data.size();
+  c.buffer += data;
+
+  while(!c.waiting) {
+    const int header_end = c.buffer.indexOf("\r\n\r\n");
+    if(header_end < 0) return;
+    const auto lines = c.buffer.left(header_end).split('\n');
+    const auto request_line = lines[0].trimmed().split(' ');
+    if(request_line.size() != 3) {
+      socket->disconnectFromHost();
+      return;
+    }
+    Request request;
+    request.method = request_line[0];
+    request.url = QUrl::fromEncoded(request_line[1]);
+    int length = 0;
+    for(int i = 1; i < lines.size(); ++i) {
+      const auto line = lines[i].trimmed();
+      const int colon = line.indexOf(':');
+      if(colon < 0) continue;
+      const auto name = line.left(colon).trimmed().toLower();
+      const auto value = line.mid(colon + 1).trimmed();
+      if(name == "content-length") {
+        length = value.toInt();
+      } else if(name == "authorization") {
+        request.authorization = value;
+      }
+    }
+    const int end = header_end + 4 + length;
+    if(c.buffer.size() < end) return;
+    request.body = c.buffer.mid(header_end + 4, length);
+    c.buffer.remove(0, end);
+    ++stats_.requests;
+    handle(socket, request);
+  }
+}
+
+void Server::handle(QTcpSocket *socket, const Request &request) {
+  QStringList path;
+  for(const auto &segment : request.url.path(QUrl::FullyEncoded).toUtf8().split('/')) {
+    if(!segment.isEmpty()) path.push_back(QUrl::fromPercentEncoding(segment));
+  }
+  const QUrlQuery query(request.url);
+  const auto &method = request.method;
+
+  if(path.size() < 4 || path[0] != "_matrix") {
+    fail(socket, 404, "M_UNRECOGNIZED", "Unrecognized request");
+    return;
+  }
+  const auto api = path[1];
+  const auto rest = path.mid(3);  // Past the version
+
+  if(api == "client" && rest == QStringList{"login"} && method == "POST") {
+    auto user = QJsonDocument::fromJson(request.body).object()["user"].toString();
+    if(user.startsWith('@')) user = user.mid(1, user.indexOf(':') - 1);
+    if(user.isEmpty()) {
+      fail(socket, 400, "M_BAD_JSON", "Missing user");
+      return;
+    }
+    const auto user_id = world_.log_in(user);
+    const auto token = QString("token%1").arg(stats_.requests);   // Unique, since it counts this request
+    sessions_[token] = user_id;
+    respond(socket, QJsonObject{{"user_id", user_id}, {"access_token", token}, {"home_server", World::SERVER_NAME}});
+    return;
+  }
+
+  auto token = query.queryItemValue("access_token");
+  if(token.isEmpty() && request.authorization.startsWith("Bearer ")) {
+    token = QString::fromUtf8(request.authorization.mid(7));
+  }
+  auto session = sessions_.find(token);
+  if(session == sessions_.end()) {
+    fail(socket, 401, "M_UNKNOWN_TOKEN", "Unrecognised access token");
+    return;
+  }
+  const QString user = session->second;
+
+  if(api == "media") {
+    if(method == "GET" && rest.size() == 3 && (rest[0] == "download" || rest[0] == "thumbnail")) {
+      media(socket, rest, query);
+    } else {
+      fail(socket, 404, "M_UNRECOGNIZED", "Unrecognized request");
+    }
+    return;
+  }
+
+  if(api == "client") {
+    if(rest == QStringList{"sync"} && method == "GET") {
+      sync(socket, user, query);
+      return;
+    }
+    if(rest == QStringList{"logout"} && method == "POST") {
+      sessions_.erase(session);
+      respond(socket, QJsonObject());
+      return;
+    }
+    if(rest.size() == 2 && rest[0] == "join" && method == "POST") {
+      if(auto id = world_.join(rest[1], user)) {
+        respond(socket, QJsonObject{{"room_id", *id}});
+      } else {
+        fail(socket, 404, "M_NOT_FOUND", "No such room");
+      }
+      return;
+    }
+    if(rest.size() == 3 && rest[0] == "rooms" && rest[2] == "messages" && method == "GET") {
+      if(auto page = world_.messages(rest[1], query.queryItemValue("from"), query.queryItemValue("dir") != "f",
+                                     query.queryItemValue("limit").toUInt())) {
+        respond(socket, *page);
+      } else {
+        fail(socket, 404, "M_NOT_FOUND", "No such room");
+      }
+      return;
+    }
+    if(rest.size() == 5 && rest[0] == "rooms" && rest[2] == "send" && method == "PUT") {
+      const auto content = QJsonDocument::fromJson(request.body).object();
+      if(auto id = world_.send(rest[1], user, rest[3], content, rest[4])) {
+        respond(socket, QJsonObject{{"event_id", *id}});
+      } else {
+        fail(socket, 403, "M_FORBIDDEN", "Not in room");
+      }
+      return;
+    }
+    if(rest.size() == 5 && rest[0] == "rooms" && rest[2] == "receipt" && method == "POST") {
+      if(world_.receipt(rest[1], user, rest[4])) {
+        respond(socket, QJsonObject());
+      } else {
+        fail(socket, 403, "M_FORBIDDEN", "Not in room");
+      }
+      return;
+    }
+  }
+
+  fail(socket, 404, "M_UNRECOGNIZED", "Unrecognized request");
+}
+
+void Server::sync(QTcpSocket *socket, const QString &user, const QUrlQuery &query) {
+  ++stats_.syncs;
+  optional<uint64_t> since;
+  {
+    const auto token = query.queryItemValue("since");
+    bool ok;
+    const uint64_t x = token.mid(1).toULongLong(&ok);
+    if(ok) since = x;
+  }
+  const int timeout = std::min(query.queryItemValue("timeout").toInt(), MAX_SYNC_TIMEOUT_MS);
+  if(!since || world_.position() > *since || timeout <= 0) {
+    respond(socket, world_.sync(user, since));
+    return;
+  }
+
+  const uint64_t id = next_sync_id_++;
+  connections_[socket].waiting = true;
+  pending_.push_back(PendingSync{id, socket, user, *since});
+  QTimer::singleShot(timeout, socket, [this, id]() { finish_sync(id); });
+}
+
+void Server::finish_sync(uint64_t id) {
+  auto it = std::find_if(pending_.begin(), pending_.end(), [id](const PendingSync &p) { return p.id == id; });
+  if(it == pending_.end()) return;   // Already answered
+  const auto p = *it;
+  pending_.erase(it);
+  respond(p.socket, world_.sync(p.user, p.since));
+  connections_[p.socket].waiting = false;
+  read(p.socket);   // Anything that arrived meanwhile
+}
+
+void Server::wake() {
+  std::vector<uint64_t> ready;
+  for(const auto &p : pending_) {
+    if(world_.position() > p.since) ready.push_back(p.id);
+  }
+  for(auto id : ready) {
+    finish_sync(id);
+  }
+}
+
+void Server::media(QTcpSocket *socket, const QStringList &path, const QUrlQuery &query) {
+  // Solid colour images, distinct per ID, so clients have real decoding and scaling work to do
+  int width = MEDIA_SIZE, height = MEDIA_SIZE;
+  if(path[0] == "thumbnail") {
+    width = std::min(std::max(query.queryItemValue("width").toInt(), 1), MEDIA_SIZE);
+    height = std::min(std::max(query.queryItemValue("height").toInt(), 1), MEDIA_SIZE);
+  }
+  const auto key = QString("%1/%2/%3x%4").arg(path[1], path[2]).arg(width).arg(height);
+  auto data = media_.object(key);
+  if(!data) {
+    QImage image(width, height, QImage::Format_RGB32);
+    image.fill(QColor::fromHsv(qHash(path[2]) % 360, 160, 200));
+    data = new QByteArray;
+    QBuffer buffer(data);
+    buffer.open(QIODevice::WriteOnly);
+    image.save(&buffer, "PNG");
+    buffer.close();
+    media_.insert(key, data, data->size());
+    data = media_.object(key);
+  }
+  // Content never changes, so let clients cache it as they would from a real server
+  respond(socket, 200, "image/png", data ? *data : QByteArray(), "Cache-Control: public, max-age=31536000\r\n");
+}
+
+void Server::respond(QTcpSocket *socket, int status, const QByteArray &type, const QByteArray &body,
+                     const QByteArray &headers) {
+  const QByteArray head =
+    "HTTP/1.1 " + QByteArray::number(status) + " " + reason(status) + "\r\n"
+    "Content-Type: " + type + "\r\n"
+    "Content-Length: " + QByteArray::number(body.size()) + "\r\n" +
+    headers +
+    "\r\n";
+  socket->write(head);
+  socket->write(body);
+  stats_.bytes_out += head.size() + body.size();
+}
+
+void Server::respond(QTcpSocket *socket, const QJsonObject &body) {
+  respond(socket, 200, "application/json", QJsonDocument(body).toJson(QJsonDocument::Compact));
+}
+
+void Server::fail(QTcpSocket *socket, int status, const QString &errcode, const QString &message) {
+  respond(socket, status, "application/json",
+          QJsonDocument(QJsonObject{{"errcode", errcode}, {"error", message}}).toJson(QJsonDocument::Compact));
+}
@@ -0,0 +1,79 @@
+#ifndef NATIVE_CHAT_FAKESERVER_SERVER_HPP_
+#define NATIVE_CHAT_FAKESERVER_SERVER_HPP_
+
+#include <vector>
+#include <unordered_map>
+
+#include <QObject>
+#include <QTcpServer>
+#include <QUrl>
+#include <QCache>
+
+#include "../QStringHash.hpp"
+
+class QTcpSocket;
+class QUrlQuery;
+class QJsonObject;
+
+class World;
+
+// Just enough HTTP/1.1 and client-server API to stand in for a homeserver on localhost. Requests on a connection are
+// handled in order, and a long-polling sync holds its connection until the world changes or the timeout passes.
+class Server : public QObject {
+  Q_OBJECT
+
+public:
+  explicit Server(World &world, QObject *parent = nullptr);
+
+  bool listen(const QHostAddress &address, quint16 port);
+  QString error_string() const { return server_.errorString(); }
+  quint16 port() const { return server_.serverPort(); }
+
+  struct Stats {
+    uint64_t requests = 0, syncs = 0, bytes_in = 0, bytes_out = 0;
+  };
+  const Stats &stats() const { return stats_; }
+
+private:
+  struct Request {
+    QByteArray method;
+    QUrl url;
+    QByteArray authorization;
+    QByteArray body;
+  };
+
+  struct Connection {
+    QByteArray buffer;          // Received but not yet handled
+    bool waiting = false;       // On a long poll, so later requests must wait
+  };
+
+  struct PendingSync {
+    uint64_t id;
+    QTcpSocket *socket;
+    QString user;
+    uint64_t since;
+  };
+
+  World &world_;
+  QTcpServer server_;
+  std::unordered_map<QTcpSocket *, Connection> connections_;
+  std::unordered_map<QString, QString, QStringHash> sessions_;  // User IDs by access token
+  std::vector<PendingSync> pending_;
+  uint64_t next_sync_id_ = 0;
+  QCache<QString, QByteArray> media_;  // Rendered images, by URL
+  Stats stats_;
+
+  void accept();
+  void read(QTcpSocket *socket);
+  void handle(QTcpSocket *socket, const Request &request);
+  void sync(QTcpSocket *socket, const QString &user, const QUrlQuery &query);
+  void finish_sync(uint64_t id);
+  void media(QTcpSocket *socket, const QStringList &path, const QUrlQuery &query);
+  void wake();
+  void respond(QTcpSocket *socket, int status, const QByteArray &type, const QByteArray &body,
+               const QByteArray &headers = QByteArray());
+  void respond(QTcpSocket *socket, const QJsonObject &body);
+  void fail(QTcpSocket *socket, int status, const QString &errcode, const QString &message);
+};
+
+#endif
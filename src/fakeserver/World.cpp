@@ -0,0 +1,292 @@
+#include "World.hpp"
+
+#include <algorithm>
+#include <map>
+
+#include <QDateTime>
+#include <QStringBuilder>
+#include <QJsonArray>
+
+using std::experimental::optional;
+
+constexpr char World::SERVER_NAME[];
+
+static constexpr int TICK_MS = 10;
+
+static constexpr uint64_t HISTORY_INTERVAL_MS = 60 * 1000;
+// Spacing of the messages that predate the server
+
+static constexpr size_t MESSAGES_LIMIT = 100;
+
+static uint64_t now_ms() { return QDateTime::currentMSecsSinceEpoch(); }
+
+static QString state_index(const QString &type, const QString &state_key) {
+  return type % QChar(0) % state_key;
+}
+
+static QString localpart(const QString &user) {
+  return user.mid(1, user.indexOf(':') - 1);
+}
+
+static uint64_t token_position(const QString &token, uint64_t otherwise) {
+  // Timeline tokens are the first position after a boundary, sync tokens the last position before one
+  bool ok;
+  const uint64_t x = token.mid(1).toULongLong(&ok);
+  if(!ok) return otherwise;
+  if(token.startsWith('t')) return x;
+  if(token.startsWith('s')) return x + 1;
+  return otherwise;
+}
+
+World::World(const Config &config, QObject *parent) : QObject(parent), config_(config), rng_(config.seed) {
+  const uint64_t start = now_ms() - config_.history * HISTORY_INTERVAL_MS;
+  const QString creator = member(0);
+  const QString empty;
+  std::uniform_int_distribution<size_t> who(0, std::max<size_t>(config_.members, 1) - 1);
+  rooms_.reserve(config_.rooms);
+  for(size_t i = 0; i < config_.rooms; ++i) {
+    rooms_.emplace_back();
+    auto &r = rooms_.back();
+    r.id = QString("!room%1:%2").arg(i).arg(SERVER_NAME);
+    r.alias = QString("#room%1:%2").arg(i).arg(SERVER_NAME);
+    room_ids_[r.id] = i;
+    room_ids_[r.alias] = i;
+
+    append(r, creator, "m.room.create", {{"creator", creator}}, start, &empty);
+    append(r, creator, "m.room.name", {{"name", QString("Room %1").arg(i)}}, start, &empty);
+    append(r, creator, "m.room.canonical_alias", {{"alias", r.alias}}, start, &empty);
+    append(r, creator, "m.room.power_levels", {{"users", QJsonObject{{creator, 100}}}, {"users_default", 0}}, start,
+           &empty);
+    for(size_t j = 0; j < config_.members; ++j) {
+      add_member(r, member(j), start);
+    }
+    for(size_t k = 0; k < config_.history; ++k) {
+      append(r, member(who(rng_)), "m.room.message",
+             {{"msgtype", "m.text"}, {"body", QString("Message %1 in room %2").arg(k).arg(i)}},
+             start + k * HISTORY_INTERVAL_MS);
+    }
+  }
+  connect(&tick_, &QTimer::timeout, this, &World::generate);
+}
+
+void World::start() {
+  clock_.start();
+  tick_.start(TICK_MS);
+}
+
+QString World::member(size_t i) const {
+  return QString("@user%1:%2").arg(i).arg(SERVER_NAME);
+}
+
+World::Room *World::room(const QString &id_or_alias) {
+  auto it = room_ids_.find(id_or_alias);
+  if(it == room_ids_.end()) return nullptr;
+  return &rooms_[it->second];
+}
+
+const World::Room *World::room(const QString &id_or_alias) const {
+  auto it = room_ids_.find(id_or_alias);
+  if(it == room_ids_.end()) return nullptr;
+  return &rooms_[it->second];
+}
+
+QString World::append(Room &room, const QString &sender, const QString &type, const QJsonObject &content, uint64_t ts,
+                      const QString *state_key) {
+  const uint64_t position = ++position_;
+  const QString id = QString("$%1:%2").arg(position).arg(SERVER_NAME);
+  QJsonObject json{
+    {"event_id", id},
+    {"type", type},
+    {"sender", sender},
+    {"origin_server_ts", static_cast<double>(ts)},
+    {"content", content},
+    {"unsigned", QJsonObject()}
+  };
+  if(state_key) {
+    json["state_key"] = *state_key;
+    room.state[state_index(type, *state_key)] = room.timeline.size();
+  }
+  room.timeline.push_back(Event{position, std::move(json)});
+  return id;
+}
+
+void World::add_member(Room &room, const QString &user, uint64_t ts) {
+  const auto name = localpart(user);
+  const QString avatar = "mxc://" % QString(SERVER_NAME) % "/avatar-" % name;
+  append(room, user, "m.room.member", {{"membership", "join"}, {"displayname", name}, {"avatar_url", avatar}}, ts, &user);
+  room.joined[user] = position_;
+}
+
+void World::set_receipt(Room &room, const QString &user, const QString &event, uint64_t ts) {
+  const uint64_t position = ++position_;
+  auto it = std::find_if(room.receipts.begin(), room.receipts.end(), [&](const Receipt &r) { return r.user == user; });
+  if(it == room.receipts.end()) {
+    room.receipts.push_back(Receipt{user, event, ts, position});
+  } else {
+    *it = Receipt{user, event, ts, position};
+  }
+}
+
+QString World::log_in(const QString &name) {
+  const QString user = "@" % name % ":" % QString(SERVER_NAME);
+  const uint64_t ts = now_ms();
+  bool joined_any = false;
+  for(auto &r : rooms_) {
+    if(r.joined.count(user)) continue;
+    add_member(r, user, ts);
+    joined_any = true;
+  }
+  if(joined_any) changed();
+  return user;
+}
+
+QJsonObject World::sync(const QString &user, optional<uint64_t> since) const {
+  QJsonObject join;
+  for(const auto &r : rooms_) {
+    auto it = r.joined.find(user);
+    if(it == r.joined.end()) continue;
+    // Rooms joined since the last sync are sent in full
+    auto o = sync_room(r, since && it->second <= *since ? since : optional<uint64_t>());
+    if(!o.isEmpty()) join[r.id] = o;
+  }
+  return QJsonObject{
+    {"next_batch", QString("s%1").arg(position_)},
+    {"rooms", QJsonObject{{"join", join}}}
+  };
+}
+
+QJsonObject World::sync_room(const Room &r, optional<uint64_t> since) const {
+  size_t begin = r.timeline.size();
+  while(begin > 0 && (!since || r.timeline[begin-1].position > *since)) {
+    --begin;
+  }
+  const size_t first = std::max(begin, r.timeline.size() - std::min(r.timeline.size(), config_.timeline_limit));
+
+  std::map<QString, QJsonObject> readers;   // By event
+  for(const auto &receipt : r.receipts) {
+    if(since && receipt.position <= *since) continue;
+    readers[receipt.event][receipt.user] = QJsonObject{{"ts", static_cast<double>(receipt.ts)}};
+  }
+
+  if(since && begin == r.timeline.size() && readers.empty()) return QJsonObject();
+
+  // State that the timeline doesn't convey: everything before it initially, and what a limited timeline skipped over
+  std::vector<size_t> state_indices;
+  for(const auto &x : r.state) {
+    if(x.second < first && (!since || x.second >= begin)) state_indices.push_back(x.second);
+  }
+  std::sort(state_indices.begin(), state_indices.end());
+  QJsonArray state;
+  for(auto i : state_indices) {
+    state.append(r.timeline[i].json);
+  }
+
+  QJsonArray timeline;
+  for(size_t i = first; i < r.timeline.size(); ++i) {
+    timeline.append(r.timeline[i].json);
+  }
+  const uint64_t prev = first < r.timeline.size() ? r.timeline[first].position : position_ + 1;
+
+  QJsonArray ephemeral;
+  if(!readers.empty()) {
+    QJsonObject content;
+    for(const auto &x : readers) {
+      content[x.first] = QJsonObject{{"m.read", x.second}};
+    }
+    ephemeral.append(QJsonObject{{"type", "m.receipt"}, {"content", content}});
+  }
+
+  return QJsonObject{
+    {"state", QJsonObject{{"events", state}}},
+    {"timeline", QJsonObject{
+        {"events", timeline},
+        {"limited", first > begin},
+        {"prev_batch", QString("t%1").arg(prev)}
+      }},
+    {"ephemeral", QJsonObject{{"events", ephemeral}}},
+    {"account_data", QJsonObject{{"events", QJsonArray()}}},
+    {"unread_notifications", QJsonObject()}
+  };
+}
+
+optional<QJsonObject> World::messages(const QString &id, const QString &from, bool backward, size_t limit) const {
+  auto r = room(id);
+  if(!r) return {};
+  if(limit == 0 || limit > MESSAGES_LIMIT) limit = MESSAGES_LIMIT;
+
+  const uint64_t boundary = token_position(from, backward ? position_ + 1 : 0);
+  auto it = std::lower_bound(r->timeline.begin(), r->timeline.end(), boundary,
+                             [](const Event &e, uint64_t p) { return e.position < p; });
+  QJsonArray chunk;
+  QString end = from;
+  if(backward) {
+    while(it != r->timeline.begin() && static_cast<size_t>(chunk.size()) < limit) {
+      --it;
+      chunk.append(it->json);
+      end = QString("t%1").arg(it->position);
+    }
+  } else {
+    for(; it != r->timeline.end() && static_cast<size_t>(chunk.size()) < limit; ++it) {
+      chunk.append(it->json);
+      end = QString("t%1").arg(it->position + 1);
+    }
+  }
+  return QJsonObject{{"start", from}, {"end", end}, {"chunk", chunk}};
+}
+
+optional<QString> World::send(const QString &id, const QString &sender, const QString &type,
+                              const QJsonObject &content, const QString &txn) {
+  auto r = room(id);
+  if(!r || !r->joined.count(sender)) return {};
+  const QString key = sender % '\n' % txn;
+  auto it = transactions_.find(key);
+  if(it != transactions_.end()) return it->second;
+  const auto event = append(*r, sender, type, content, now_ms());
+  transactions_[key] = event;
+  changed();
+  return event;
+}
+
+bool World::receipt(const QString &id, const QString &user, const QString &event) {
+  auto r = room(id);
+  if(!r || !r->joined.count(user)) return false;
+  set_receipt(*r, user, event, now_ms());
+  changed();
+  return true;
+}
+
+optional<QString> World::join(const QString &id_or_alias, const QString &user) {
+  auto r = room(id_or_alias);
+  if(!r) return {};
+  if(!r->joined.count(user)) {
+    add_member(*r, user, now_ms());
+    changed();
+  }
+  return r->id;
+}
+
+void World::generate() {
+  const double dt = clock_.restart() / 1000.0;
+  message_debt_ += config_.message_rate * dt;
+  receipt_debt_ += config_.receipt_rate * dt;
+  if(rooms_.empty() || config_.members == 0) return;
+
+  std::uniform_int_distribution<size_t> which_room(0, rooms_.size() - 1), who(0, config_.members - 1);
+  const uint64_t ts = now_ms();
+  bool any = false;
+  for(; message_debt_ >= 1; message_debt_ -= 1) {
+    auto &r = rooms_[which_room(rng_)];
+    append(r, member(who(rng_)), "m.room.message",
+           {{"msgtype", "m.text"}, {"body", QString("Generated message %1").arg(messages_generated_)}}, ts);
+    ++messages_generated_;
+    any = true;
+  }
+  for(; receipt_debt_ >= 1; receipt_debt_ -= 1) {
+    // Everyone reads up to the latest event, as in a busy room where people are paying attention
+    auto &r = rooms_[which_room(rng_)];
+    set_receipt(r, member(who(rng_)), r.timeline.back().json["event_id"].toString(), ts);
+    ++receipts_generated_;
+    any = true;
+  }
+  if(any) changed();
+}
@@ -0,0 +1,108 @@
+#ifndef NATIVE_CHAT_FAKESERVER_WORLD_HPP_
+#define NATIVE_CHAT_FAKESERVER_WORLD_HPP_
+
+#include <vector>
+#include <unordered_map>
+#include <random>
+#include <experimental/optional>
+
+#include <QObject>
+#include <QString>
+#include <QJsonObject>
+#include <QTimer>
+#include <QElapsedTimer>
+
+#include "../QStringHash.hpp"
+
+// Everything the fake homeserver knows, plus the synthetic load that keeps it changing. Every change, whether an event
+// or a receipt, takes the next position in a single stream, so a sync token is just a position.
+class World : public QObject {
+  Q_OBJECT
+
+public:
+  struct Config {
+    size_t rooms = 10;
+    size_t members = 50;        // In each room, besides whoever logs in
+    size_t history = 200;       // Messages in each room before the server starts
+    double message_rate = 1;    // Per second, across all rooms
+    double receipt_rate = 0;    // Likewise
+    size_t timeline_limit = 20; // Events per room in a sync before it's limited
+    uint32_t seed = 0;
+  };
+
+  static constexpr char SERVER_NAME[] = "fake.local";
+
+  explicit World(const Config &config, QObject *parent = nullptr);
+
+  void start();
+  // Begins generating load
+
+  uint64_t position() const { return position_; }
+  uint64_t messages_generated() const { return messages_generated_; }
+  uint64_t receipts_generated() const { return receipts_generated_; }
+
+  QString log_in(const QString &localpart);
+  // Returns the user's ID, joining them to every room if they're new
+
+  QJsonObject sync(const QString &user, std::experimental::optional<uint64_t> since) const;
+
+  std::experimental::optional<QJsonObject> messages(const QString &room, const QString &from, bool backward,
+                                                    size_t limit) const;
+  // None if there's no such room
+
+  std::experimental::optional<QString> send(const QString &room, const QString &sender, const QString &type,
+                                            const QJsonObject &content, const QString &txn);
+  // Returns the new event's ID, or the original's for a repeated transaction. None if the sender isn't in the room.
+
+  bool receipt(const QString &room, const QString &user, const QString &event);
+
+  std::experimental::optional<QString> join(const QString &id_or_alias, const QString &user);
+  // Returns the room's ID
+
+signals:
+  void changed();
+
+private:
+  struct Event {
+    uint64_t position;
+    QJsonObject json;
+  };
+
+  struct Receipt {
+    QString user, event;
+    uint64_t ts, position;
+  };
+
+  struct Room {
+    QString id, alias;
+    std::vector<Event> timeline;                        // Everything, including state, in order
+    std::unordered_map<QString, size_t, QStringHash> state;
+    // Index into timeline of the latest event for each type and state key, separated by a NUL
+    std::unordered_map<QString, uint64_t, QStringHash> joined;
+    // Position at which each member joined
+    std::vector<Receipt> receipts;                      // At most one per user
+  };
+
+  const Config config_;
+  std::mt19937 rng_;
+  std::vector<Room> rooms_;
+  std::unordered_map<QString, size_t, QStringHash> room_ids_;  // By ID and alias
+  std::unordered_map<QString, QString, QStringHash> transactions_;
+  uint64_t position_ = 0;
+  uint64_t messages_generated_ = 0, receipts_generated_ = 0;
+  double message_debt_ = 0, receipt_debt_ = 0;
+  QTimer tick_;
+  QElapsedTimer clock_;
+
+  Room *room(const QString &id_or_alias);
+  const Room *room(const QString &id_or_alias) const;
+  QString member(size_t i) const;
+  QString append(Room &room, const QString &sender, const QString &type, const QJsonObject &content, uint64_t ts,
+                 const QString *state_key = nullptr);
+  void add_member(Room &room, const QString &user, uint64_t ts);
+  void set_receipt(Room &room, const QString &user, const QString &event, uint64_t ts);
+  QJsonObject sync_room(const Room &room, std::experimental::optional<uint64_t> since) const;
+  void generate();
+};
+
+#endif
@@ -0,0 +1,67 @@
+#include <cstdio>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QHostAddress>
+#include <QTimer>
+
+#include "World.hpp"
+#include "Server.hpp"
+
+// A stand-in homeserver generating synthetic load, so clients can be measured end to end on one machine. Messages carry
+// the time they were generated in origin_server_ts, so a client on the same machine can compute delivery latency.
+
+int main(int argc, char *argv[]) {
+  QCoreApplication::setApplicationName("nachat-fakeserver");
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Fake Matrix homeserver for load testing");
+  parser.addHelpOption();
+  const QCommandLineOption port("port", "Port to listen on", "port", "8008");
+  const QCommandLineOption rooms("rooms", "Number of rooms", "n", "10");
+  const QCommandLineOption members("members", "Members of each room, besides whoever logs in", "n", "50");
+  const QCommandLineOption history("history", "Messages in each room at startup", "n", "200");
+  const QCommandLineOption rate("rate", "New messages per second, across all rooms", "n", "1");
+  const QCommandLineOption receipts("receipts", "Read receipts per second, across all rooms", "n", "0");
+  const QCommandLineOption timeline_limit("timeline-limit", "Events per room in a sync before it's limited", "n", "20");
+  const QCommandLineOption seed("seed", "Random seed", "n", "0");
+  const QCommandLineOption stats_interval("stats", "Seconds between statistics reports; 0 to disable", "s", "10");
+  parser.addOptions({port, rooms, members, history, rate, receipts, timeline_limit, seed, stats_interval});
+  parser.process(app);
+
+  World::Config config;
+  config.rooms = parser.value(rooms).toULongLong();
+  config.members = parser.value(members).toULongLong();
+  config.history = parser.value(history).toULongLong();
+  config.message_rate = parser.value(rate).toDouble();
+  config.receipt_rate = parser.value(receipts).toDouble();
+  config.timeline_limit = parser.value(timeline_limit).toULongLong();
+  config.seed = parser.value(seed).toUInt();
+
+  World world(config);
+  Server server(world);
+  if(!server.listen(QHostAddress::LocalHost, parser.value(port).toUShort())) {
+    std::fprintf(stderr, "couldn't listen: %s\n", server.error_string().toLocal8Bit().constData());
+    return 1;
+  }
+  std::printf("listening on http://localhost:%u with %zu rooms of %zu members\n", server.port(), config.rooms,
+              config.members);
+  std::fflush(stdout);
+  world.start();
+
+  QTimer stats;
+  QObject::connect(&stats, &QTimer::timeout, [&]() {
+      const auto &s = server.stats();
+      std::printf("%llu requests (%llu syncs), %llu bytes in, %llu bytes out; %llu messages, %llu receipts generated\n",
+                  static_cast<unsigned long long>(s.requests), static_cast<unsigned long long>(s.syncs),
+                  static_cast<unsigned long long>(s.bytes_in), static_cast<unsigned long long>(s.bytes_out),
+                  static_cast<unsigned long long>(world.messages_generated()),
+                  static_cast<unsigned long long>(world.receipts_generated()));
+      std::fflush(stdout);
+    });
+  const int interval = parser.value(stats_interval).toInt();
+  if(interval > 0) stats.start(interval * 1000);
+
+  return app.exec();
+}
@@ -0,0 +1,263 @@
+#include <cstdio>
+#include <memory>
+#include <algorithm>
+#include <functional>
+#include <unordered_map>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QNetworkAccessManager>
+#include <QStandardPaths>
+#include <QElapsedTimer>
+#include <QDateTime>
+#include <QTimer>
+#include <QFile>
+#include <QDir>
+
+#ifdef Q_OS_UNIX
+#include <unistd.h>
+#include <sys/resource.h>
+#endif
+
+#include "matrix/Matrix.hpp"
+#include "matrix/Session.hpp"
+
+#include "QStringHash.hpp"
+
+// Runs a session with no user interface, for profiling the matrix library and for soak tests, and reports throughput
+// periodically. Message latencies assume the server's clock agrees with ours, as it does for nachat-fakeserver on the
+// same machine.
+
+namespace {
+
+struct Latency {
+  uint64_t count = 0;
+  double total_ms = 0, max_ms = 0;
+
+  void add(double x) {
+    ++count;
+    total_ms += x;
+    max_ms = std::max(max_ms, x);
+  }
+  double mean() const { return count ? total_ms / count : 0; }
+};
+
+struct Counters {
+  uint64_t events = 0;
+  Latency delivery;             // From origin_server_ts to receipt, for others' messages
+  Latency echo;                 // From queueing a message to receiving it back
+  uint64_t history_events = 0;
+};
+
+double resident_mb() {
+#ifdef Q_OS_LINUX
+  QFile statm("/proc/self/statm");
+  if(statm.open(QIODevice::ReadOnly)) {
+    const auto fields = statm.readAll().split(' ');
+    if(fields.size() > 1) return fields[1].toDouble() * sysconf(_SC_PAGESIZE) / (1024.0 * 1024.0);
+  }
+#endif
+#ifdef Q_OS_UNIX
+  // Peak rather than current, which is the best we can do portably
+  struct rusage usage;
+  if(getrusage(RUSAGE_SELF, &usage) == 0) {
+#ifdef Q_OS_MAC
+    return usage.ru_maxrss / (1024.0 * 1024.0);
+#else
+    return usage.ru_maxrss / 1024.0;
+#endif
+  }
+#endif
+  return 0;
+}
+
+double ms(std::chrono::nanoseconds t) {
+  return std::chrono::duration<double, std::milli>(t).count();
+}
+
+}
+
+int main(int argc, char *argv[]) {
+  QCoreApplication::setOrganizationName("nachat");
+  QCoreApplication::setApplicationName("nachat-headless");
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Matrix client without a user interface, for measuring throughput");
+  parser.addHelpOption();
+  const QCommandLineOption homeserver("homeserver", "Homeserver URL", "url", "http://localhost:8008");
+  const QCommandLineOption username("user", "Username to log in with", "name");
+  const QCommandLineOption password("password", "Password; NACHAT_PASSWORD is used if not given", "password");
+  const QCommandLineOption fresh("fresh", "Discard this tool's cache first, so the first sync is a full one");
+  const QCommandLineOption history("history", "Pages of history to fetch from every room once synced", "n", "0");
+  const QCommandLineOption send_rate("send-rate", "Messages per second to send once synced", "n", "0");
+  const QCommandLineOption send_room("send-room", "Room ID to send to; defaults to the first", "id");
+  const QCommandLineOption interval("interval", "Seconds between reports", "s", "5");
+  const QCommandLineOption duration("duration", "Seconds to run for; 0 to run until interrupted", "s", "0");
+  parser.addOptions({homeserver, username, password, fresh, history, send_rate, send_room, interval, duration});
+  parser.process(app);
+  if(!parser.isSet(username)) parser.showHelp(1);
+
+  if(parser.isSet(fresh)) {
+    QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).removeRecursively();
+  }
+
+  QNetworkAccessManager net;
+  matrix::Matrix universe{net};
+  std::unique_ptr<matrix::Session> session;
+  Counters counters;
+  std::unordered_map<QString, qint64, QStringHash> echoes;  // Clock readings by transaction ID
+  QElapsedTimer clock;
+  QTimer sender, reporter;
+  uint64_t sent = 0;
+  bool live = false;            // Set once the first sync is processed; events before then are backlog, not deliveries
+
+  auto watch = [&](matrix::Room &room) {
+    QObject::connect(&room, &matrix::Room::message, [&](const matrix::event::Room &e) {
+        ++counters.events;
+        if(e.sender() != session->user_id()) {
+          if(live) {
+            counters.delivery.add(QDateTime::currentMSecsSinceEpoch() - static_cast<qint64>(e.origin_server_ts()));
+          }
+        } else if(auto u = e.unsigned_data()) {
+          auto it = echoes.find(u->value("transaction_id").toString());
+          if(it != echoes.end()) {
+            counters.echo.add(clock.elapsed() - it->second);
+            echoes.erase(it);
+          }
+        }
+      });
+    QObject::connect(&room, &matrix::Room::local_echo, [&](const matrix::Room::PendingEvent &e) {
+        echoes[e.transaction_id] = clock.elapsed();
+      });
+  };
+
+  auto page_history = [&]() {
+    const unsigned pages = parser.value(history).toUInt();
+    if(pages == 0) return;
+    auto outstanding = std::make_shared<size_t>(0);
+    auto started = std::make_shared<QElapsedTimer>();
+    started->start();
+    for(auto room : session->rooms()) {
+      if(room->buffer().empty()) continue;
+      ++*outstanding;
+      // Each page starts where the last ended
+      auto fetch_page = std::make_shared<std::function<void(matrix::TimelineCursor, unsigned)>>();
+      *fetch_page = [&, room, outstanding, started, fetch_page](matrix::TimelineCursor from, unsigned remaining) {
+        auto finish = [&, outstanding, started, fetch_page]() {
+          *fetch_page = nullptr;  // Break the cycle
+          if(--*outstanding == 0) {
+            std::printf("history: %llu events in %lld ms\n", static_cast<unsigned long long>(counters.history_events),
+                        static_cast<long long>(started->elapsed()));
+            std::fflush(stdout);
+          }
+        };
+        auto fetch = room->get_messages(matrix::Direction::BACKWARD, from);
+        QObject::connect(fetch, &matrix::MessageFetch::finished,
+                         [&, remaining, finish, fetch_page](const matrix::TimelineCursor &, const matrix::TimelineCursor &end,
+                                                            gsl::span<const matrix::event::Room> events) {
+                           counters.history_events += events.size();
+                           if(remaining > 1 && !events.empty()) {
+                             (*fetch_page)(end, remaining - 1);
+                           } else {
+                             finish();
+                           }
+                         });
+        QObject::connect(fetch, &matrix::MessageFetch::error, [finish](const QString &msg) {
+            std::fprintf(stderr, "history: %s\n", msg.toLocal8Bit().constData());
+            finish();
+          });
+      };
+      (*fetch_page)(room->buffer().front().prev_batch, pages);
+    }
+  };
+
+  auto start_sending = [&]() {
+    const double rate = parser.value(send_rate).toDouble();
+    if(rate <= 0) return;
+    auto rooms = session->rooms();
+    matrix::Room *target = rooms.empty() ? nullptr : rooms.front();
+    if(parser.isSet(send_room)) target = session->room_from_id(matrix::RoomID(parser.value(send_room)));
+    if(!target) {
+      std::fprintf(stderr, "no room to send to\n");
+      return;
+    }
+    QObject::connect(&sender, &QTimer::timeout, [&, target]() {
+        target->send_message(QString("nachat-headless message %1").arg(sent++));
+      });
+    sender.start(std::max(1, static_cast<int>(1000 / rate)));
+  };
+
+  matrix::Session::SyncStats last_stats;
+  Counters last;
+  qint64 last_time = 0;
+  auto report = [&]() {
+    const auto &stats = session->sync_stats();
+    const double seconds = std::max<qint64>(clock.elapsed() - last_time, 1) / 1000.0;
+    const uint64_t syncs = stats.syncs - last_stats.syncs;
+    std::printf("%.0fs: %.1f events/s, %.1f KB/s, %llu syncs (mean round trip %.1f ms, processing %.2f ms), "
+                "delivery %.1f ms mean %.1f ms max, echo %.1f ms mean, %.1f MB resident\n",
+                clock.elapsed() / 1000.0,
+                (counters.events - last.events) / seconds,
+                (stats.bytes - last_stats.bytes) / 1024.0 / seconds,
+                static_cast<unsigned long long>(syncs),
+                syncs ? ms(stats.round_trip - last_stats.round_trip) / syncs : 0.0,
+                syncs ? ms((stats.parse + stats.dispatch + stats.commit)
+                           - (last_stats.parse + last_stats.dispatch + last_stats.commit)) / syncs : 0.0,
+                counters.delivery.mean(), counters.delivery.max_ms,
+                counters.echo.mean(),
+                resident_mb());
+    std::fflush(stdout);
+    last_stats = stats;
+    last = counters;
+    last_time = clock.elapsed();
+  };
+
+  auto established = [&]() {
+    clock.start();
+    for(auto room : session->rooms()) {
+      watch(*room);
+    }
+    QObject::connect(session.get(), &matrix::Session::joined, watch);
+    QObject::connect(session.get(), &matrix::Session::error, [](const QString &msg) {
+        std::fprintf(stderr, "session error: %s\n", msg.toLocal8Bit().constData());
+      });
+    auto first_sync = std::make_shared<QMetaObject::Connection>();
+    *first_sync = QObject::connect(session.get(), &matrix::Session::sync_complete, [&, first_sync]() {
+        std::printf("first sync after %lld ms\n", static_cast<long long>(clock.elapsed()));
+        std::fflush(stdout);
+        QObject::disconnect(*first_sync);
+        live = true;
+        page_history();
+        start_sending();
+      });
+    QObject::connect(&reporter, &QTimer::timeout, report);
+    reporter.start(std::max(1, parser.value(interval).toInt()) * 1000);
+    const int limit = parser.value(duration).toInt();
+    if(limit > 0) {
+      QTimer::singleShot(limit * 1000, [&]() {
+          report();
+          app.quit();
+        });
+    }
+  };
+
+  QObject::connect(&universe, &matrix::Matrix::logged_in, [&](const matrix::UserID &user_id, const QString &token) {
+      session = matrix::Session::create(universe, parser.value(homeserver), user_id, token);
+      established();
+    });
+  QObject::connect(&universe, &matrix::Matrix::login_error, [&](const QString &msg) {
+      std::fprintf(stderr, "login failed: %s\n", msg.toLocal8Bit().constData());
+      app.exit(1);
+    });
+
+  const auto pass = parser.isSet(password) ? parser.value(password)
+                                           : QString::fromLocal8Bit(qgetenv("NACHAT_PASSWORD"));
+  universe.login(parser.value(homeserver), parser.value(username), pass);
+
+  const int result = app.exec();
+  sender.stop();
+  reporter.stop();
+  session.reset();
+  return result;
+}
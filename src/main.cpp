@@ -1,17 +1,47 @@
 #include <QtNetwork>
 #include <QApplication>
 #include <QSettings>
+#include <QElapsedTimer>
 
 #include "matrix/Matrix.hpp"
 #include "matrix/Session.hpp"
+#include "matrix/Capture.hpp"
 
 #include "LoginDialog.hpp"
 #include "MainWindow.hpp"
 #include "MessageBox.hpp"
+#include "Watchdog.hpp"
 
 #include "version.hpp"
 
+static constexpr qint64 MEDIA_CACHE_SIZE = 256 * 1024 * 1024;
+
+class FirstPaintLogger : public QObject {
+public:
+  FirstPaintLogger(const QElapsedTimer &startup, QWidget &window) : QObject(&window), startup_(startup) {
+    QCoreApplication::instance()->installEventFilter(this);
+  }
+  // Logs the time since startup at which any part of window is first painted, then deletes itself
+
+  bool eventFilter(QObject *watched, QEvent *event) override {
+    if(event->type() != QEvent::Paint || !watched->isWidgetType()
+       || static_cast<QWidget *>(watched)->window() != parent()) {
+      return false;
+    }
+    if(startup_.isValid()) qDebug() << "time to first paint:" << startup_.elapsed() << "ms";
+    QCoreApplication::instance()->removeEventFilter(this);
+    deleteLater();
+    return false;
+  }
+
+private:
+  const QElapsedTimer &startup_;
+};
+
 int main(int argc, char *argv[]) {
+  QElapsedTimer startup;
+  startup.start();
+
   printf("NaChat %s\n", version::string().toStdString().c_str());
 
   QCoreApplication::setOrganizationName("nachat");
@@ -21,8 +51,20 @@ int main(int argc, char *argv[]) {
   QApplication app(argc, argv);
   QSettings settings;
 
-  QNetworkAccessManager net;   // Create this on another thread for faster startup?
-  matrix::Matrix matrix{net};
+  const int stall_threshold = qEnvironmentVariableIntValue("NACHAT_STALL_THRESHOLD_MS");
+  Watchdog watchdog(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation) + "/stalls.log",
+                    stall_threshold > 0 ? std::chrono::milliseconds(stall_threshold) : Watchdog::DEFAULT_THRESHOLD);
+
+  auto net = matrix::capture::network_from_environment();
+  // Cheap to construct; its HTTP work already runs on a thread of its own
+  {
+    // Media is immutable, so this lets restored rooms show avatars and images without asking the server again
+    auto cache = new QNetworkDiskCache(net.get());
+    cache->setCacheDirectory(QStandardPaths::writableLocation(QStandardPaths::CacheLocation) + "/media");
+    cache->setMaximumCacheSize(MEDIA_CACHE_SIZE);
+    net->setCache(cache);
+  }
+  matrix::Matrix matrix{*net};
 
   LoginDialog login;
   std::unique_ptr<MainWindow> main_window;
@@ -38,14 +80,28 @@ int main(int argc, char *argv[]) {
 
         login.show();
       });
+    QObject::connect(session.get(), &matrix::Session::offline_changed, [&]() {
+        settings.setValue("session/offline", session->offline());
+      });
     main_window = std::make_unique<MainWindow>(*session);
     QObject::connect(main_window.get(), &MainWindow::quit, &app, &QApplication::quit);
     QObject::connect(main_window.get(), &MainWindow::log_out, session.get(), &matrix::Session::log_out);
     QObject::connect(main_window.get(), &MainWindow::log_out, [&settings]() {
         settings.remove("session/access_token");
         settings.remove("session/user_id");
+        settings.remove("session/offline");
       });
+    if(startup.isValid()) new FirstPaintLogger(startup, *main_window);
     main_window->show();
+
+    if(startup.isValid()) {
+      auto first_sync = std::make_shared<QMetaObject::Connection>();
+      *first_sync = QObject::connect(session.get(), &matrix::Session::sync_complete, [&startup, first_sync]() {
+          qDebug() << "time to first sync:" << startup.elapsed() << "ms";
+          startup.invalidate();
+          QObject::disconnect(*first_sync);
+        });
+    }
   };
 
   QObject::connect(&matrix, &matrix::Matrix::logged_in, [&](const matrix::UserID &user_id, const QString &access_token) {
@@ -74,7 +130,13 @@ int main(int argc, char *argv[]) {
   if(access_token.isNull() || homeserver.isNull() || user_id.isNull()) {
     login.show();
   } else {
+    // Only a restored session resumes offline; logging in is going online
+    const bool offline = settings.value("session/offline", false).toBool();
+    if(!offline && !dynamic_cast<matrix::capture::Replayer *>(net.get())) {
+      matrix.preconnect(homeserver.toString());
+    }
     session = matrix::Session::create(matrix, homeserver.toString(), matrix::UserID(user_id.toString()), access_token.toString());
+    session->set_offline(offline);
     session_established();
   }
 
@@ -0,0 +1,134 @@
+#include "ActivityFeed.hpp"
+
+#include <algorithm>
+#include <queue>
+
+#include "Session.hpp"
+#include "Room.hpp"
+
+namespace matrix {
+
+static constexpr size_t MAX_ENTRIES_PER_ROOM = 256;
+// Older entries are dropped. Rooms with more unread messages than this have bigger problems than the feed can solve.
+
+static uint64_t read_horizon(const Room &room) {
+  auto receipt = room.receipt_from(room.session().user_id());
+  // A receipt whose event has left the buffer still tells us when the user last read the room
+  return std::max(room.read_ts(), receipt ? receipt->ts : 0);
+}
+
+ActivityFeed::Position ActivityFeed::position(const Item &item) {
+  return Position{item.event.origin_server_ts(), item.room->id(), item.event.id()};
+}
+
+ActivityFeed::ActivityFeed(Session &session, QObject *parent) : QObject(parent), session_(session) {
+  for(auto room : session_.rooms()) {
+    track(*room);
+  }
+  connect(&session_, &Session::joined, this, &ActivityFeed::track);
+}
+
+void ActivityFeed::track(Room &room) {
+  auto &index = rooms_.emplace(room.id(), Index{&room, {}}).first->second;
+  for(const auto &batch : room.buffer()) {
+    for(const auto &event : batch.events) {
+      insert(index, event);
+    }
+  }
+
+  connect(&room, &Room::message, this, [this, &index](const event::Room &e) {
+      if(auto entry = insert(index, e)) {
+        added(Item{index.room, entry->event, entry->highlight});
+      }
+    });
+  connect(&room, &Room::receipts_changed, this, &ActivityFeed::changed);
+}
+
+const ActivityFeed::Entry *ActivityFeed::insert(Index &index, const event::Room &e) {
+  auto &entries = index.entries;
+  if(e.type() == EventType("m.room.redaction")) {
+    const EventID redacts(e.json()["redacts"].toString());
+    auto it = std::find_if(entries.begin(), entries.end(), [&](const Entry &x) { return x.event.id() == redacts; });
+    if(it != entries.end()) {
+      entries.erase(it);
+      changed();
+    }
+    return nullptr;
+  }
+  if(e.type() != event::room::Message::tag() || e.redacted() || e.sender() == session_.user_id()) return nullptr;
+
+  const uint64_t ts = e.origin_server_ts();
+  // Events nearly always arrive in order, so this is usually the end
+  auto position = std::upper_bound(entries.begin(), entries.end(), ts, [&](uint64_t t, const Entry &x) {
+      return std::forward_as_tuple(t, e.id()) < std::forward_as_tuple(x.ts, x.event.id());
+    });
+  auto it = entries.insert(position, Entry{ts, e, index.room->is_highlight(e)});
+  const Entry *result = &*it;
+  if(entries.size() > MAX_ENTRIES_PER_ROOM) {
+    if(result == &entries.front()) result = nullptr;
+    entries.pop_front();
+  }
+  return result;
+}
+
+bool ActivityFeed::matches(Filter filter, const Room &room, uint64_t ts, bool highlight) const {
+  switch(filter) {
+  case Filter::MENTIONS: return highlight;
+  case Filter::UNREAD: return ts > read_horizon(room);
+  }
+  return false;
+}
+
+std::vector<ActivityFeed::Item> ActivityFeed::page(Filter filter, size_t limit,
+                                                   const std::experimental::optional<Position> &before) const {
+  using Iterator = std::deque<Entry>::const_reverse_iterator;
+  struct Cursor {
+    const Index *index;
+    Iterator it;
+    uint64_t horizon;
+  };
+
+  // k-way merge over each room's index, newest first, without touching rooms that have nothing to contribute
+  auto older = [](const Cursor &a, const Cursor &b) {
+    return std::forward_as_tuple(a.it->ts, a.index->room->id(), a.it->event.id())
+      < std::forward_as_tuple(b.it->ts, b.index->room->id(), b.it->event.id());
+  };
+  std::priority_queue<Cursor, std::vector<Cursor>, decltype(older)> heads(older);
+  auto push = [&](Cursor c) {
+    for(; c.it != c.index->entries.crend(); ++c.it) {
+      if(filter == Filter::UNREAD) {
+        if(c.it->ts <= c.horizon) return;  // Everything older has been read too
+        break;
+      }
+      if(c.it->highlight) break;
+    }
+    if(c.it != c.index->entries.crend()) heads.push(c);
+  };
+
+  for(const auto &room : rooms_) {
+    const auto &entries = room.second.entries;
+    if(entries.empty()) continue;
+    const uint64_t horizon = filter == Filter::UNREAD ? read_horizon(*room.second.room) : 0;
+    if(filter == Filter::UNREAD && entries.back().ts <= horizon) continue;
+    auto end = entries.end();
+    if(before) {
+      const auto &id = room.second.room->id();
+      end = std::lower_bound(entries.begin(), entries.end(), *before, [&](const Entry &x, const Position &p) {
+          return std::forward_as_tuple(x.ts, id, x.event.id()) < std::tie(p.ts, p.room, p.event);
+        });
+    }
+    push(Cursor{&room.second, Iterator(end), horizon});
+  }
+
+  std::vector<Item> result;
+  while(result.size() < limit && !heads.empty()) {
+    auto c = heads.top();
+    heads.pop();
+    result.push_back(Item{c.index->room, c.it->event, c.it->highlight});
+    ++c.it;
+    push(c);
+  }
+  return result;
+}
+
+}
@@ -0,0 +1,84 @@
+#ifndef NATIVE_CHAT_MATRIX_ACTIVITY_FEED_HPP_
+#define NATIVE_CHAT_MATRIX_ACTIVITY_FEED_HPP_
+
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <tuple>
+#include <experimental/optional>
+
+#include <QObject>
+
+#include "Event.hpp"
+
+namespace matrix {
+
+class Session;
+class Room;
+
+class ActivityFeed : public QObject {
+  Q_OBJECT
+
+public:
+  enum class Filter {
+    MENTIONS,                   // Messages that highlight us
+    UNREAD                      // Messages we haven't read, including mentions
+  };
+
+  struct Item {
+    Room *room;
+    event::Room event;
+    bool highlight;
+  };
+
+  struct Position {
+    uint64_t ts;
+    RoomID room;
+    EventID event;
+  };
+  // Where an item falls in the feed. Timestamps collide, so the room and event break ties.
+
+  static Position position(const Item &item);
+
+  explicit ActivityFeed(Session &session, QObject *parent = nullptr);
+
+  std::vector<Item> page(Filter filter, size_t limit, const std::experimental::optional<Position> &before = {}) const;
+  // Up to limit items from all rooms positioned before before, most recent first
+
+  bool matches(Filter filter, const Item &item) const {
+    return matches(filter, *item.room, item.event.origin_server_ts(), item.highlight);
+  }
+
+signals:
+  void added(const Item &item);
+  // A new message arrived. It may not match every filter.
+  void changed();
+  // Items may have stopped matching, e.g. because they were read
+
+private:
+  struct Entry {
+    uint64_t ts;
+    event::Room event;
+    bool highlight;
+  };
+
+  struct Index {
+    Room *room;
+    std::deque<Entry> entries;  // Ordered by ts, then event ID
+  };
+
+  Session &session_;
+  std::unordered_map<RoomID, Index> rooms_;
+
+  void track(Room &room);
+  const Entry *insert(Index &index, const event::Room &event);
+  bool matches(Filter filter, const Room &room, uint64_t ts, bool highlight) const;
+};
+
+inline bool operator<(const ActivityFeed::Position &a, const ActivityFeed::Position &b) {
+  return std::tie(a.ts, a.room, a.event) < std::tie(b.ts, b.room, b.event);
+}
+
+}
+
+#endif
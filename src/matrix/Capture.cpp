@@ -0,0 +1,220 @@
+#include "Capture.hpp"
+
+#include <algorithm>
+
+#include <QTimer>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QDebug>
+
+namespace matrix {
+namespace capture {
+
+static constexpr quint32 MAGIC = 0x6e616368;  // "nach"
+static constexpr quint32 FORMAT_VERSION = 1;
+
+std::unique_ptr<QNetworkAccessManager> network_from_environment(QObject *parent) {
+  const auto record = QString::fromLocal8Bit(qgetenv("NACHAT_RECORD"));
+  if(!record.isEmpty()) {
+    qDebug() << "recording server traffic to" << record;
+    return std::make_unique<Recorder>(record, parent);
+  }
+  const auto replay = QString::fromLocal8Bit(qgetenv("NACHAT_REPLAY"));
+  if(!replay.isEmpty()) {
+    const bool realtime = qEnvironmentVariableIsSet("NACHAT_REPLAY_REALTIME");
+    qDebug() << "replaying server traffic from" << replay << (realtime ? "at recorded speed" : "at full speed");
+    return std::make_unique<Replayer>(replay, realtime, parent);
+  }
+  return std::make_unique<QNetworkAccessManager>(parent);
+}
+
+std::vector<Record> read(const QString &path) {
+  std::vector<Record> result;
+  QFile file(path);
+  if(!file.open(QIODevice::ReadOnly)) {
+    qWarning() << "couldn't open capture file" << path << ":" << file.errorString();
+    return result;
+  }
+  QDataStream stream(&file);
+  stream.setVersion(QDataStream::Qt_5_6);
+  quint32 magic, version;
+  stream >> magic >> version;
+  if(magic != MAGIC || version != FORMAT_VERSION) {
+    qWarning() << path << "is not a capture file this version understands";
+    return result;
+  }
+  while(!stream.atEnd()) {
+    QByteArray record;
+    stream >> record;
+    if(stream.status() != QDataStream::Ok) {
+      qWarning() << "capture file" << path << "is truncated after" << result.size() << "records";
+      break;
+    }
+    QDataStream s(record);
+    s.setVersion(QDataStream::Qt_5_6);
+    Record r;
+    qint32 status, error;
+    s >> r.elapsed >> r.path >> status >> r.headers >> r.body >> error >> r.error_string;
+    r.status = status;
+    r.error = static_cast<QNetworkReply::NetworkError>(error);
+    result.push_back(std::move(r));
+  }
+  return result;
+}
+
+CannedReply::CannedReply(QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent)
+  : QNetworkReply(parent) {
+  setOperation(op);
+  setRequest(request);
+  setUrl(request.url());
+}
+
+void CannedReply::complete(int status, const RawHeaders &headers, const QByteArray &body,
+                           NetworkError code, const QString &error_string) {
+  if(isFinished()) return;
+  if(status != 0) setAttribute(QNetworkRequest::HttpStatusCodeAttribute, status);
+  for(const auto &header : headers) {
+    setRawHeader(header.first, header.second);
+  }
+  body_ = body;
+  offset_ = 0;
+  open(ReadOnly | Unbuffered);
+  if(code != NoError) {
+    setError(code, error_string);
+    error(code);
+  }
+  metaDataChanged();
+  if(!body_.isEmpty()) {
+    downloadProgress(body_.size(), body_.size());
+    readyRead();
+  }
+  setFinished(true);
+  finished();
+}
+
+void CannedReply::abort() {
+  if(isFinished()) return;
+  if(on_abort_) {
+    on_abort_();
+  } else {
+    complete(0, {}, {}, OperationCanceledError, tr("Operation canceled"));
+  }
+}
+
+qint64 CannedReply::readData(char *data, qint64 max) {
+  const qint64 n = std::min(max, body_.size() - offset_);
+  if(n <= 0) return -1;
+  std::copy(body_.constData() + offset_, body_.constData() + offset_ + n, data);
+  offset_ += n;
+  return n;
+}
+
+Recorder::Recorder(const QString &path, QObject *parent) : QNetworkAccessManager(parent), file_(path) {
+  if(!file_.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+    qWarning() << "couldn't open capture file" << path << ":" << file_.errorString();
+    return;
+  }
+  stream_.setDevice(&file_);
+  stream_.setVersion(QDataStream::Qt_5_6);
+  stream_ << MAGIC << FORMAT_VERSION;
+  clock_.start();
+}
+
+QNetworkReply *Recorder::createRequest(Operation op, const QNetworkRequest &request, QIODevice *data) {
+  auto upstream = QNetworkAccessManager::createRequest(op, request, data);
+  auto reply = new CannedReply(op, request, this);
+  upstream->setParent(reply);
+  reply->set_abort_handler([upstream]() { upstream->abort(); });
+  connect(upstream, &QNetworkReply::downloadProgress, reply, &QNetworkReply::downloadProgress);
+  connect(upstream, &QNetworkReply::uploadProgress, reply, &QNetworkReply::uploadProgress);
+  connect(upstream, &QNetworkReply::finished, reply, [this, upstream, reply]() {
+      const int status = upstream->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+      const auto headers = upstream->rawHeaderPairs();
+      const auto body = upstream->readAll();
+      if(upstream->error() != QNetworkReply::OperationCanceledError) {
+        // Aborted requests depend on what the client was doing rather than the server, so replay can't use them
+        write(upstream->url(), status, headers, body, upstream->error(), upstream->errorString());
+      }
+      reply->complete(status, headers, body, upstream->error(), upstream->errorString());
+      upstream->deleteLater();
+    });
+  return reply;
+}
+
+static QByteArray redacted(const QByteArray &body) {
+  // Captures are shared to reproduce problems, so credentials handed out by e.g. /login must not end up in them
+  if(!body.contains("_token\"")) return body;  // Spares parsing every sync
+  const auto doc = QJsonDocument::fromJson(body);
+  if(!doc.isObject()) return body;
+  auto o = doc.object();
+  bool changed = false;
+  for(const auto key : {"access_token", "refresh_token"}) {
+    if(o.contains(key)) {
+      o[key] = "redacted";
+      changed = true;
+    }
+  }
+  return changed ? QJsonDocument(o).toJson(QJsonDocument::Compact) : body;
+}
+
+void Recorder::write(const QUrl &url, int status, const CannedReply::RawHeaders &headers, const QByteArray &body,
+                     QNetworkReply::NetworkError error, const QString &error_string) {
+  if(!file_.isOpen()) return;
+  QByteArray record;
+  {
+    QDataStream s(&record, QIODevice::WriteOnly);
+    s.setVersion(QDataStream::Qt_5_6);
+    // Only the path is kept, since replay matches on nothing else
+    s << static_cast<qint64>(clock_.elapsed()) << url.path() << static_cast<qint32>(status) << headers << redacted(body)
+      << static_cast<qint32>(error) << error_string;
+  }
+  stream_ << record;
+  file_.flush();
+}
+
+Replayer::Replayer(const QString &path, bool realtime, QObject *parent)
+  : QNetworkAccessManager(parent), realtime_(realtime) {
+  auto records = read(path);
+  for(auto &r : records) {
+    records_[r.path].push_back(std::move(r));
+  }
+  qDebug() << "loaded" << records.size() << "records," << remaining_syncs() << "of them syncs";
+  clock_.start();
+}
+
+size_t Replayer::remaining_syncs() const {
+  size_t result = 0;
+  for(const auto &x : records_) {
+    if(x.first.endsWith("/sync")) result += x.second.size();
+  }
+  return result;
+}
+
+QNetworkReply *Replayer::createRequest(Operation op, const QNetworkRequest &request, QIODevice *) {
+  auto reply = new CannedReply(op, request, this);
+  const auto path = request.url().path();
+  auto it = records_.find(path);
+  if(it == records_.end() || it->second.empty()) {
+    if(path.endsWith("/sync")) {
+      // Leave it hanging, like a long poll with nothing to report
+      QTimer::singleShot(0, this, &Replayer::exhausted);
+    } else {
+      QTimer::singleShot(0, reply, [reply]() {
+          reply->complete(404, {{"Content-Type", "application/json"}},
+                          R"({"errcode":"M_NOT_FOUND","error":"Not in capture"})",
+                          QNetworkReply::ContentNotFoundError, tr("Not in capture"));
+        });
+    }
+    return reply;
+  }
+  auto record = std::move(it->second.front());
+  it->second.pop_front();
+  const qint64 delay = realtime_ ? std::max<qint64>(0, record.elapsed - clock_.elapsed()) : 0;
+  QTimer::singleShot(delay, reply, [reply, record]() {
+      reply->complete(record.status, record.headers, record.body, record.error, record.error_string);
+    });
+  return reply;
+}
+
+}
+}
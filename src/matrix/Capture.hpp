@@ -0,0 +1,120 @@
+#ifndef NATIVE_CHAT_MATRIX_CAPTURE_HPP_
+#define NATIVE_CHAT_MATRIX_CAPTURE_HPP_
+
+#include <memory>
+#include <deque>
+#include <vector>
+#include <unordered_map>
+#include <functional>
+
+#include <QNetworkAccessManager>
+#include <QNetworkReply>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QDataStream>
+
+#include "../QStringHash.hpp"
+
+namespace matrix {
+
+// Record and replay of server traffic, so that performance can be measured against real-world traces without a
+// homeserver. Requests are intercepted beneath Session, so sync, backlog and media replies take exactly the paths they
+// would take live.
+//
+// A capture file is a header followed by length-prefixed records, each holding one complete reply in the order it
+// finished. Record from an empty cache so that the first sync carries full state.
+
+namespace capture {
+
+struct Record {
+  qint64 elapsed;               // Milliseconds from the start of recording to completion
+  QString path;                 // Of the request URL
+  int status;
+  QList<QPair<QByteArray, QByteArray>> headers;
+  QByteArray body;
+  QNetworkReply::NetworkError error;
+  QString error_string;
+};
+
+std::vector<Record> read(const QString &path);
+// Everything in a capture file, in recorded order. Logs and returns what it could if the file is unreadable.
+
+std::unique_ptr<QNetworkAccessManager> network_from_environment(QObject *parent = nullptr);
+// Records to the file named by NACHAT_RECORD or replays the one named by NACHAT_REPLAY, at recorded speed if
+// NACHAT_REPLAY_REALTIME is set and as fast as possible otherwise. Without either, returns an ordinary manager.
+
+class CannedReply : public QNetworkReply {
+  Q_OBJECT
+
+public:
+  using RawHeaders = QList<QPair<QByteArray, QByteArray>>;
+
+  CannedReply(QNetworkAccessManager::Operation op, const QNetworkRequest &request, QObject *parent = nullptr);
+
+  void complete(int status, const RawHeaders &headers, const QByteArray &body,
+                NetworkError error = NoError, const QString &error_string = QString());
+  // Emits the usual signals. Callers should defer this to the event loop, as a real reply would be.
+
+  void set_abort_handler(std::function<void()> f) { on_abort_ = std::move(f); }
+
+  void abort() override;
+  bool isSequential() const override { return true; }
+  qint64 bytesAvailable() const override { return body_.size() - offset_ + QNetworkReply::bytesAvailable(); }
+  qint64 size() const override { return body_.size(); }
+
+protected:
+  qint64 readData(char *data, qint64 max) override;
+
+private:
+  QByteArray body_;
+  qint64 offset_ = 0;
+  std::function<void()> on_abort_;
+};
+
+class Recorder : public QNetworkAccessManager {
+  Q_OBJECT
+
+public:
+  explicit Recorder(const QString &path, QObject *parent = nullptr);
+
+protected:
+  QNetworkReply *createRequest(Operation op, const QNetworkRequest &request, QIODevice *data) override;
+  // Replies are withheld until complete so that they can be written out whole; progress is still reported.
+
+private:
+  QFile file_;
+  QDataStream stream_;
+  QElapsedTimer clock_;
+
+  void write(const QUrl &url, int status, const CannedReply::RawHeaders &headers, const QByteArray &body,
+             QNetworkReply::NetworkError error, const QString &error_string);
+};
+
+class Replayer : public QNetworkAccessManager {
+  Q_OBJECT
+
+public:
+  Replayer(const QString &path, bool realtime, QObject *parent = nullptr);
+
+  size_t remaining_syncs() const;
+
+signals:
+  void exhausted();
+  // A sync was requested after the last recorded one was served. It stays pending until aborted.
+
+protected:
+  QNetworkReply *createRequest(Operation op, const QNetworkRequest &request, QIODevice *data) override;
+
+private:
+  const bool realtime_;
+  QElapsedTimer clock_;
+  std::unordered_map<QString, std::deque<Record>, QStringHash> records_;
+  // By URL path, in recorded order. Query strings carry tokens that can legitimately differ between runs, so they're
+  // ignored; requests to the same path are served in the order they were recorded.
+};
+
+}
+
+}
+
+#endif
@@ -0,0 +1,69 @@
+#include "CompletionIndex.hpp"
+
+#include <algorithm>
+#include <tuple>
+
+namespace matrix {
+
+static bool before(const CompletionIndex::Entry &a, const CompletionIndex::Entry &b) {
+  return std::tie(a.key, a.member, a.text) < std::tie(b.key, b.member, b.text);
+}
+
+QString CompletionIndex::fold(const QString &text) {
+  return text.normalized(QString::NormalizationForm_C).toCaseFolded();
+}
+
+CompletionIndex::Entry CompletionIndex::make_entry(const QString &text, const UserID &member, bool strip_sigil) {
+  auto key = fold(text);
+  if(strip_sigil && key.startsWith('@')) key.remove(0, 1);
+  return Entry{std::move(key), text, member};
+}
+
+gsl::span<const CompletionIndex::Entry> CompletionIndex::matching(const QString &prefix) const {
+  auto key = fold(prefix);
+  if(key.startsWith('@')) key.remove(0, 1);
+  auto begin = std::lower_bound(entries_.begin(), entries_.end(), key,
+                                [](const Entry &e, const QString &k) { return e.key < k; });
+  auto end = begin;
+  while(end != entries_.end() && end->key.startsWith(key)) {
+    ++end;
+  }
+  return gsl::span<const Entry>(entries_.data() + (begin - entries_.begin()), end - begin);
+}
+
+void CompletionIndex::insert(Entry &&entry) {
+  auto it = std::lower_bound(entries_.begin(), entries_.end(), entry, before);
+  if(it != entries_.end() && !before(entry, *it)) return;
+  entries_.insert(it, std::move(entry));
+}
+
+void CompletionIndex::erase(const Entry &entry) {
+  auto it = std::lower_bound(entries_.begin(), entries_.end(), entry, before);
+  if(it != entries_.end() && !before(entry, *it)) entries_.erase(it);
+}
+
+void CompletionIndex::insert(const QString &text, const UserID &member) {
+  insert(make_entry(text, member, false));
+}
+
+void CompletionIndex::erase(const QString &text, const UserID &member) {
+  erase(make_entry(text, member, false));
+}
+
+void CompletionIndex::insert_member(const UserID &member) {
+  insert(make_entry(member.value(), member, true));
+}
+
+void CompletionIndex::erase_member(const UserID &member) {
+  erase(make_entry(member.value(), member, true));
+}
+
+void CompletionIndex::set_aliases(gsl::span<const QString> aliases) {
+  entries_.erase(std::remove_if(entries_.begin(), entries_.end(), [](const Entry &e) { return e.member.value().isEmpty(); }),
+                 entries_.end());
+  for(const auto &alias : aliases) {
+    insert(make_entry(alias, UserID(QString()), false));
+  }
+}
+
+}
@@ -0,0 +1,43 @@
+#ifndef NATIVE_CHAT_MATRIX_COMPLETION_INDEX_HPP_
+#define NATIVE_CHAT_MATRIX_COMPLETION_INDEX_HPP_
+
+#include <vector>
+
+#include <QString>
+
+#include <span.h>
+
+#include "ID.hpp"
+
+namespace matrix {
+
+class CompletionIndex {
+public:
+  struct Entry {
+    QString key;                // Case-folded and NFC-normalized
+    QString text;               // To insert when completed
+    UserID member;              // Empty for room aliases
+  };
+
+  static QString fold(const QString &text);
+
+  gsl::span<const Entry> matching(const QString &prefix) const;
+  // Every entry whose key begins with prefix. User IDs are matched with or without their sigil.
+
+  void insert(const QString &text, const UserID &member);
+  void erase(const QString &text, const UserID &member);
+  void insert_member(const UserID &member);
+  void erase_member(const UserID &member);
+  void set_aliases(gsl::span<const QString> aliases);
+
+private:
+  std::vector<Entry> entries_;  // Sorted by key, then member, then text
+
+  static Entry make_entry(const QString &text, const UserID &member, bool strip_sigil);
+  void insert(Entry &&entry);
+  void erase(const Entry &entry);
+};
+
+}
+
+#endif
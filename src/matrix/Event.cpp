@@ -205,6 +205,11 @@ Avatar::Avatar(State e) : State(std::move(e)) {
   check(content().json(), {{"url", "content.url", QJsonValue::String}});
 }
 
+PowerLevels::PowerLevels(State e) : State(std::move(e)) {
+  if(redacted()) return;
+  check(content().json(), {{"users", "content.users", QJsonValue::Object, false}});
+}
+
 Create::Create(State e) : State(std::move(e)) {
   check(content().json(), {{"creator", "content.create", QJsonValue::String}});
 }
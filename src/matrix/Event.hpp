@@ -353,6 +353,17 @@ public:
   static const EventType tag() { return EventType("m.room.avatar"); }
 };
 
+class PowerLevels : public State {
+public:
+  explicit PowerLevels(State);
+
+  int64_t users_default() const noexcept { return content().json()["users_default"].toDouble(0); }
+  QJsonObject users() const noexcept { return content().json()["users"].toObject(); }
+  int64_t user_level(const UserID &user) const noexcept { return users().value(user.value()).toDouble(users_default()); }
+
+  static const EventType tag() { return EventType("m.room.power_levels"); }
+};
+
 class Create : public State {
 public:
   explicit Create(State);
@@ -11,6 +11,14 @@ namespace matrix {
 
 Matrix::Matrix(QNetworkAccessManager &net, QObject *parent) : QObject(parent), net(net) {}
 
+void Matrix::preconnect(const QUrl &homeserver) {
+  if(homeserver.scheme() == "https") {
+    net.connectToHostEncrypted(homeserver.host(), homeserver.port(443));
+  } else {
+    net.connectToHost(homeserver.host(), homeserver.port(80));
+  }
+}
+
 void Matrix::login(QUrl homeserver, QString username, QString password) {
   QUrl login_url(homeserver);
   login_url.setPath("/_matrix/client/r0/login");
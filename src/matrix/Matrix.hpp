@@ -20,6 +20,10 @@ public:
 
   void login(QUrl homeserver, QString username, QString password);
 
+  void preconnect(const QUrl &homeserver);
+  // Resolves and handshakes with the homeserver ahead of the first request, e.g. while a session loads its cache. QNAM
+  // does this on its own thread and reuses the connection.
+
 signals:
   void logged_in(const UserID &user_id, const QString &access_token);
   void login_error(QString message);
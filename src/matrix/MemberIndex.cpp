@@ -0,0 +1,124 @@
+#include "MemberIndex.hpp"
+
+#include <algorithm>
+
+namespace matrix {
+
+static bool before(const MemberIndex::Entry &a, const MemberIndex::Entry &b) {
+  if(a.last_active != b.last_active) return a.last_active > b.last_active;
+  if(a.power != b.power) return a.power > b.power;
+  const int c = a.key.compare(b.key);
+  if(c != 0) return c < 0;
+  return a.id < b.id;
+}
+
+MemberIndex::MemberIndex() {
+  collator_.setCaseSensitivity(Qt::CaseInsensitive);
+  collator_.setNumericMode(true);
+}
+
+QCollatorSortKey MemberIndex::key(const QString &n) const {
+  // Sigils shouldn't affect the order of members without display names
+  int i = 0;
+  while(i < n.size() && n[i] == '@') {
+    ++i;
+  }
+  return collator_.sortKey(i == n.size() ? n : n.mid(i));
+}
+
+const MemberIndex::Entry *MemberIndex::find(const UserID &id) const {
+  auto it = ranks_.find(id);
+  if(it == ranks_.end()) return nullptr;
+  return &entries_[it->second];
+}
+
+std::experimental::optional<size_t> MemberIndex::rank(const UserID &id) const {
+  auto it = ranks_.find(id);
+  if(it == ranks_.end()) return {};
+  return it->second;
+}
+
+void MemberIndex::reindex(size_t begin, size_t end) {
+  for(size_t i = begin; i < end; ++i) {
+    ranks_[entries_[i].id] = i;
+  }
+}
+
+MemberIndex::Entry MemberIndex::entry(const UserID &id, const QString &name, uint64_t last_active, int64_t power) const {
+  return Entry{id, name, last_active, power, key(name)};
+}
+
+void MemberIndex::assign(std::vector<Entry> entries) {
+  std::sort(entries.begin(), entries.end(), before);
+  entries_ = std::move(entries);
+  ranks_.clear();
+  ranks_.reserve(entries_.size());
+  reindex(0, entries_.size());
+}
+
+MemberIndex::Change MemberIndex::insert(const UserID &id, const QString &name, uint64_t last_active, int64_t power) {
+  if(ranks_.count(id)) return {};
+  Entry e = entry(id, name, last_active, power);
+  auto it = std::lower_bound(entries_.begin(), entries_.end(), e, before);
+  const size_t to = it - entries_.begin();
+  entries_.insert(it, std::move(e));
+  reindex(to, entries_.size());
+  return Change{{}, to};
+}
+
+MemberIndex::Change MemberIndex::erase(const UserID &id) {
+  auto it = ranks_.find(id);
+  if(it == ranks_.end()) return {};
+  const size_t from = it->second;
+  ranks_.erase(it);
+  entries_.erase(entries_.begin() + from);
+  reindex(from, entries_.size());
+  return Change{from, {}};
+}
+
+MemberIndex::Change MemberIndex::move(size_t from, Entry &&entry) {
+  entries_[from] = std::move(entry);
+  const auto pos = entries_.begin() + from;
+  size_t to;
+  auto up = std::lower_bound(entries_.begin(), pos, *pos, before);
+  if(up != pos) {
+    to = up - entries_.begin();
+    std::rotate(up, pos, pos + 1);
+  } else {
+    auto down = std::lower_bound(pos + 1, entries_.end(), *pos, before);
+    to = (down - entries_.begin()) - 1;
+    std::rotate(pos, pos + 1, down);
+  }
+  reindex(std::min(from, to), std::max(from, to) + 1);
+  return Change{from, to};
+}
+
+MemberIndex::Change MemberIndex::set_name(const UserID &id, const QString &name) {
+  auto it = ranks_.find(id);
+  if(it == ranks_.end()) return {};
+  Entry entry = entries_[it->second];
+  if(entry.name == name) return {};
+  entry.name = name;
+  entry.key = key(name);
+  return move(it->second, std::move(entry));
+}
+
+MemberIndex::Change MemberIndex::set_last_active(const UserID &id, uint64_t ts) {
+  auto it = ranks_.find(id);
+  if(it == ranks_.end()) return {};
+  Entry entry = entries_[it->second];
+  if(ts <= entry.last_active) return {};
+  entry.last_active = ts;
+  return move(it->second, std::move(entry));
+}
+
+MemberIndex::Change MemberIndex::set_power(const UserID &id, int64_t power) {
+  auto it = ranks_.find(id);
+  if(it == ranks_.end()) return {};
+  Entry entry = entries_[it->second];
+  if(power == entry.power) return {};
+  entry.power = power;
+  return move(it->second, std::move(entry));
+}
+
+}
@@ -0,0 +1,66 @@
+#ifndef NATIVE_CHAT_MATRIX_MEMBER_INDEX_HPP_
+#define NATIVE_CHAT_MATRIX_MEMBER_INDEX_HPP_
+
+#include <vector>
+#include <unordered_map>
+#include <experimental/optional>
+
+#include <QString>
+#include <QCollator>
+
+#include <span.h>
+
+#include "ID.hpp"
+
+namespace matrix {
+
+class MemberIndex {
+public:
+  struct Entry {
+    UserID id;
+    QString name;               // As displayed, i.e. disambiguated
+    uint64_t last_active;       // origin_server_ts of their latest event or receipt; 0 if unknown
+    int64_t power;
+    QCollatorSortKey key;       // Of name
+  };
+
+  struct Change {
+    std::experimental::optional<size_t> from, to;
+    // Ranks before and after. A member who was inserted has no from, and one who was removed has no to.
+  };
+
+  MemberIndex();
+
+  gsl::span<const Entry> entries() const { return entries_; }
+  // Most recently active first, then most powerful, then by name
+  size_t size() const { return entries_.size(); }
+  const Entry *find(const UserID &id) const;
+  std::experimental::optional<size_t> rank(const UserID &id) const;
+
+  Entry entry(const UserID &id, const QString &name, uint64_t last_active, int64_t power) const;
+  void assign(std::vector<Entry> entries);
+  // Replaces the contents, sorting and indexing once, for building a large room without inserting member by member.
+  // Entries must have distinct IDs.
+
+  Change insert(const UserID &id, const QString &name, uint64_t last_active, int64_t power);
+  Change erase(const UserID &id);
+  Change set_name(const UserID &id, const QString &name);
+  Change set_last_active(const UserID &id, uint64_t ts);
+  // Only ever moves members forwards in time
+  Change set_power(const UserID &id, int64_t power);
+
+private:
+  QCollator collator_;
+  std::vector<Entry> entries_;
+  std::unordered_map<UserID, size_t> ranks_;
+  // Position of each member in entries_. Moves only renumber the entries between the old and new positions, which
+  // for activity is usually a short run at the front.
+
+  QCollatorSortKey key(const QString &name) const;
+  Change move(size_t from, Entry &&entry);
+  void reindex(size_t begin, size_t end);
+};
+
+}
+
+#endif
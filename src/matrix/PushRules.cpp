@@ -0,0 +1,331 @@
+#include "PushRules.hpp"
+
+#include <QJsonArray>
+#include <QDebug>
+
+#include "../QStringHash.hpp"
+
+#include "Event.hpp"
+
+namespace matrix {
+
+static constexpr size_t MAX_GLOB_TOKENS = 63;
+// One bit of the position set is needed per token, plus one for the accepting position
+
+static constexpr size_t MAX_DFA_STATES = 1024;
+// Per pattern. Beyond this the table is discarded and rebuilt, so hostile bodies can't grow it without bound
+
+static bool is_word(QChar c) {
+  return c.isLetterOrNumber() || c == '_';
+}
+
+bool Glob::Token::accepts(QChar x) const {
+  switch(kind) {
+  case Kind::LITERAL: return x == c;
+  case Kind::ANY: return true;
+  case Kind::STAR: return true;
+  case Kind::SET: {
+    bool found = false;
+    for(int i = 0; i + 1 < set.size() && !found; i += 2) {
+      found = set[i] <= x && x <= set[i+1];
+    }
+    return found != negated;
+  }
+  }
+  return false;
+}
+
+Glob::Glob(const QString &pattern) : valid_(true) {
+  const QString folded = pattern.toCaseFolded();
+  for(int i = 0; i < folded.size(); ++i) {
+    const QChar c = folded[i];
+    if(c == '*') {
+      if(tokens_.empty() || tokens_.back().kind != Token::Kind::STAR) {
+        tokens_.push_back(Token{Token::Kind::STAR, c, {}, false});
+      }
+    } else if(c == '?') {
+      tokens_.push_back(Token{Token::Kind::ANY, c, {}, false});
+    } else if(c == '[' && folded.indexOf(']', i + 2) != -1) {
+      const int end = folded.indexOf(']', i + 2);
+      Token t{Token::Kind::SET, c, {}, false};
+      int j = i + 1;
+      if(folded[j] == '!') {
+        t.negated = true;
+        ++j;
+      }
+      for(; j < end; ++j) {
+        if(j + 2 < end && folded[j+1] == '-') {
+          t.set += folded[j];
+          t.set += folded[j+2];
+          j += 2;
+        } else {
+          t.set += folded[j];
+          t.set += folded[j];
+        }
+      }
+      tokens_.push_back(std::move(t));
+      i = end;
+    } else {
+      tokens_.push_back(Token{Token::Kind::LITERAL, c, {}, false});
+    }
+  }
+  if(tokens_.size() > MAX_GLOB_TOKENS) {
+    qDebug() << "ignoring overly complex push rule pattern" << pattern;
+    valid_ = false;
+  }
+}
+
+uint64_t Glob::closure(uint64_t positions) const {
+  // A star may match nothing, so being before one means also being after it
+  for(size_t i = 0; i < tokens_.size(); ++i) {
+    if((positions & (uint64_t(1) << i)) && tokens_[i].kind == Token::Kind::STAR) {
+      positions |= uint64_t(1) << (i + 1);
+    }
+  }
+  return positions;
+}
+
+uint32_t Glob::state(uint64_t positions) const {
+  auto it = dfa_index_.find(positions);
+  if(it != dfa_index_.end()) return it->second;
+  const uint32_t index = dfa_.size();
+  dfa_.push_back(State{positions, {}});
+  dfa_index_.emplace(positions, index);
+  return index;
+}
+
+uint32_t Glob::step(uint32_t from, QChar c) const {
+  {
+    auto it = dfa_[from].next.find(c.unicode());
+    if(it != dfa_[from].next.end()) return it->second;
+  }
+  const uint64_t positions = dfa_[from].positions;
+  uint64_t result = 0;
+  for(size_t i = 0; i < tokens_.size(); ++i) {
+    if(!(positions & (uint64_t(1) << i)) || !tokens_[i].accepts(c)) continue;
+    result |= uint64_t(1) << (tokens_[i].kind == Token::Kind::STAR ? i : i + 1);
+  }
+  result = closure(result);
+  if(dfa_.size() >= MAX_DFA_STATES && !dfa_index_.count(result)) {
+    // Table is full; forget it and start over rather than growing without bound
+    dfa_.clear();
+    dfa_index_.clear();
+    return state(result);
+  }
+  const uint32_t to = state(result);
+  dfa_[from].next.emplace(c.unicode(), to);
+  return to;
+}
+
+bool Glob::match(const QString &folded) const {
+  if(!valid_) return false;
+  uint32_t s = state(closure(1));
+  for(const QChar c : folded) {
+    s = step(s, c);
+    if(dfa_[s].positions == 0) return false;
+  }
+  return accepting(s);
+}
+
+bool Glob::match_words(const QString &folded) const {
+  if(!valid_) return false;
+  const uint64_t start = closure(1);
+  // Every word start is a potential match start, so the start position is merged in before each one
+  uint32_t s = state(start);
+  for(int i = 0; i < folded.size(); ++i) {
+    const bool word_start = i == 0 || (is_word(folded[i]) != is_word(folded[i-1]));
+    if(word_start && i != 0) s = state(dfa_[s].positions | start);
+    s = step(s, folded[i]);
+    const bool word_end = i + 1 == folded.size() || (is_word(folded[i]) != is_word(folded[i+1]));
+    if(word_end && accepting(s)) return true;
+  }
+  return false;
+}
+
+static QString lookup(const QJsonObject &object, const QStringList &path) {
+  QJsonValue v = object;
+  for(const auto &key : path) {
+    v = v.toObject().value(key);
+  }
+  return v.toString();
+}
+
+bool PushRules::Condition::matches(const event::Room &e, const Context &context) const {
+  switch(kind) {
+  case Kind::EVENT_MATCH: {
+    const auto value = lookup(e.json(), path).toCaseFolded();
+    return words ? glob->match_words(value) : glob->match(value);
+  }
+  case Kind::CONTAINS_DISPLAY_NAME: {
+    if(context.display_name.isEmpty()) return false;
+    const auto body = e.content().json()["body"].toString().toCaseFolded();
+    for(int i = body.indexOf(context.display_name); i != -1; i = body.indexOf(context.display_name, i + 1)) {
+      const int end = i + context.display_name.size();
+      if((i == 0 || is_word(body[i-1]) != is_word(body[i]))
+         && (end == body.size() || is_word(body[end]) != is_word(body[end-1]))) {
+        return true;
+      }
+    }
+    return false;
+  }
+  case Kind::ROOM_MEMBER_COUNT:
+    switch(comparison) {
+    case Comparison::EQ: return context.member_count == count;
+    case Comparison::LT: return context.member_count < count;
+    case Comparison::GT: return context.member_count > count;
+    case Comparison::LE: return context.member_count <= count;
+    case Comparison::GE: return context.member_count >= count;
+    }
+    return false;
+  case Kind::ROOM: return context.room.value() == value;
+  case Kind::SENDER: return e.sender().value() == value;
+  case Kind::NEVER: return false;
+  }
+  return false;
+}
+
+static PushRules::Actions parse_actions(const QJsonArray &actions) {
+  PushRules::Actions result;
+  for(const auto &action : actions) {
+    if(action.toString() == "notify" || action.toString() == "coalesce") {
+      result.notify = true;
+    } else if(action.toString() == "dont_notify") {
+      result.notify = false;
+    } else if(action.isObject()) {
+      const auto o = action.toObject();
+      if(o["set_tweak"].toString() == "highlight") {
+        result.highlight = o.value("value").toBool(true);
+      } else if(o["set_tweak"].toString() == "sound") {
+        result.sound = o["value"].toString();
+      }
+    }
+  }
+  return result;
+}
+
+static QJsonObject default_rules(const UserID &self) {
+  // The subset of the specification's defaults that are relevant to a client's own display
+  const QString localpart = self.value().mid(1, self.value().indexOf(':') - 1);
+  auto rule = [](const QString &id, QJsonArray conditions, QJsonArray actions) {
+    return QJsonObject{{"rule_id", id}, {"enabled", true}, {"conditions", conditions}, {"actions", actions}};
+  };
+  auto match = [](const QString &key, const QString &pattern) {
+    return QJsonObject{{"kind", "event_match"}, {"key", key}, {"pattern", pattern}};
+  };
+  const QJsonObject highlight{{"set_tweak", "highlight"}};
+  return QJsonObject{
+    {"override", QJsonArray{
+        rule(".m.rule.suppress_notices", {match("content.msgtype", "m.notice")}, {"dont_notify"}),
+        rule(".m.rule.contains_display_name", {QJsonObject{{"kind", "contains_display_name"}}}, {"notify", highlight})
+      }},
+    {"content", QJsonArray{
+        QJsonObject{{"rule_id", ".m.rule.contains_user_name"}, {"enabled", true}, {"pattern", localpart},
+                    {"actions", QJsonArray{"notify", highlight}}}
+      }},
+    {"underride", QJsonArray{
+        rule(".m.rule.room_one_to_one",
+             {QJsonObject{{"kind", "room_member_count"}, {"is", "2"}}, match("type", "m.room.message")},
+             {"notify"}),
+        rule(".m.rule.message", {match("type", "m.room.message")}, {"notify"})
+      }}
+  };
+}
+
+PushRules::PushRules(const UserID &self) {
+  compile(default_rules(self));
+}
+
+PushRules::PushRules(const QJsonObject &global) {
+  compile(global);
+}
+
+void PushRules::compile(const QJsonObject &global) {
+  // Identical patterns are common, e.g. the same word in several rules, so share their automata
+  std::unordered_map<QString, std::shared_ptr<const Glob>, QStringHash> globs;
+  auto glob = [&](const QString &pattern) {
+    auto &g = globs[pattern];
+    if(!g) g = std::make_shared<const Glob>(pattern);
+    return g;
+  };
+
+  auto add = [&](const QJsonObject &r, std::vector<Condition> conditions) {
+    if(!r["enabled"].toBool(true)) return;
+    rules_.push_back(Rule{r["rule_id"].toString(), std::move(conditions), parse_actions(r["actions"].toArray())});
+  };
+
+  auto conditional = [&](const QJsonArray &rules) {
+    for(const auto &x : rules) {
+      const auto r = x.toObject();
+      std::vector<Condition> conditions;
+      for(const auto &y : r["conditions"].toArray()) {
+        const auto c = y.toObject();
+        Condition condition{Condition::Kind::NEVER, {}, nullptr, false, Condition::Comparison::EQ, 0, {}};
+        const auto kind = c["kind"].toString();
+        if(kind == "event_match") {
+          condition.kind = Condition::Kind::EVENT_MATCH;
+          condition.path = c["key"].toString().split('.');
+          condition.glob = glob(c["pattern"].toString());
+          condition.words = c["key"].toString() == "content.body";
+        } else if(kind == "contains_display_name") {
+          condition.kind = Condition::Kind::CONTAINS_DISPLAY_NAME;
+        } else if(kind == "room_member_count") {
+          QString is = c["is"].toString();
+          int prefix = 0;
+          while(prefix < is.size() && !is[prefix].isDigit()) ++prefix;
+          const auto op = is.left(prefix);
+          bool ok = true;
+          condition.count = is.mid(prefix).toULongLong(&ok);
+          if(!ok) {
+            qDebug() << "ignoring malformed room_member_count condition" << is;
+          } else if(op == "" || op == "==") {
+            condition.kind = Condition::Kind::ROOM_MEMBER_COUNT;
+            condition.comparison = Condition::Comparison::EQ;
+          } else if(op == "<" || op == ">" || op == "<=" || op == ">=") {
+            condition.kind = Condition::Kind::ROOM_MEMBER_COUNT;
+            condition.comparison = op == "<" ? Condition::Comparison::LT
+              : op == ">" ? Condition::Comparison::GT
+              : op == "<=" ? Condition::Comparison::LE
+              : Condition::Comparison::GE;
+          }
+        }
+        // Conditions we can't evaluate, e.g. sender_notification_permission, never match, per the specification
+        conditions.push_back(std::move(condition));
+      }
+      add(r, std::move(conditions));
+    }
+  };
+
+  auto simple = [&](const QJsonArray &rules, Condition::Kind kind) {
+    for(const auto &x : rules) {
+      const auto r = x.toObject();
+      add(r, {Condition{kind, {}, nullptr, false, Condition::Comparison::EQ, 0, r["rule_id"].toString()}});
+    }
+  };
+
+  conditional(global["override"].toArray());
+  for(const auto &x : global["content"].toArray()) {
+    const auto r = x.toObject();
+    add(r, {Condition{Condition::Kind::EVENT_MATCH, QStringList{"content", "body"}, glob(r["pattern"].toString()), true,
+                      Condition::Comparison::EQ, 0, {}}});
+  }
+  simple(global["room"].toArray(), Condition::Kind::ROOM);
+  simple(global["sender"].toArray(), Condition::Kind::SENDER);
+  conditional(global["underride"].toArray());
+}
+
+PushRules::Actions PushRules::evaluate(const event::Room &e, const Context &context) const {
+  if(e.sender() == context.self) return {};  // Our own events never notify us
+  for(const auto &rule : rules_) {
+    bool matched = true;
+    for(const auto &condition : rule.conditions) {
+      if(!condition.matches(e, context)) {
+        matched = false;
+        break;
+      }
+    }
+    if(matched) return rule.actions;
+  }
+  return {};
+}
+
+}
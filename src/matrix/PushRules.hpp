@@ -0,0 +1,110 @@
+#ifndef NATIVE_CHAT_MATRIX_PUSH_RULES_HPP_
+#define NATIVE_CHAT_MATRIX_PUSH_RULES_HPP_
+
+#include <vector>
+#include <memory>
+#include <unordered_map>
+
+#include <QString>
+#include <QStringList>
+#include <QJsonObject>
+
+#include "ID.hpp"
+
+namespace matrix {
+
+namespace event {
+class Room;
+}
+
+class Glob {
+public:
+  explicit Glob(const QString &pattern);
+  // Case-insensitive, supporting *, ? and [...] character classes
+
+  bool valid() const { return valid_; }
+
+  bool match(const QString &folded) const;
+  // Whether the whole of folded, which must already be case-folded, matches
+  bool match_words(const QString &folded) const;
+  // Whether any substring of folded bounded by word boundaries matches
+
+private:
+  struct Token {
+    enum class Kind { LITERAL, ANY, STAR, SET } kind;
+    QChar c;
+    QString set;                // Pairs of inclusive range bounds
+    bool negated;
+
+    bool accepts(QChar x) const;
+  };
+
+  struct State {
+    uint64_t positions;         // Bit i is set iff the first i tokens may have been matched
+    std::unordered_map<ushort, uint32_t> next;
+  };
+
+  std::vector<Token> tokens_;
+  bool valid_;
+  mutable std::vector<State> dfa_;
+  mutable std::unordered_map<uint64_t, uint32_t> dfa_index_;
+  // Subset construction is performed lazily, one transition at a time, as characters are seen
+
+  uint64_t closure(uint64_t positions) const;
+  uint32_t state(uint64_t positions) const;
+  uint32_t step(uint32_t state, QChar c) const;
+  bool accepting(uint32_t state) const { return dfa_[state].positions & (uint64_t(1) << tokens_.size()); }
+};
+
+class PushRules {
+public:
+  struct Actions {
+    bool notify = false;
+    bool highlight = false;
+    QString sound;
+  };
+
+  struct Context {
+    UserID self;
+    RoomID room;
+    QString display_name;       // Case-folded; empty if unset
+    size_t member_count;        // Joined members
+  };
+
+  PushRules() = default;
+  // Matches nothing
+  explicit PushRules(const UserID &self);
+  // The server's default rules, as far as they can be evaluated locally
+  explicit PushRules(const QJsonObject &global);
+  // From the "global" ruleset of m.push_rules account data
+
+  Actions evaluate(const event::Room &event, const Context &context) const;
+
+private:
+  struct Condition {
+    enum class Kind { EVENT_MATCH, CONTAINS_DISPLAY_NAME, ROOM_MEMBER_COUNT, ROOM, SENDER, NEVER } kind;
+    QStringList path;            // For EVENT_MATCH
+    std::shared_ptr<const Glob> glob;
+    bool words;                  // Whether glob matches words of the value rather than all of it
+    enum class Comparison { EQ, LT, GT, LE, GE } comparison;
+    size_t count;
+    QString value;               // For ROOM and SENDER
+
+    bool matches(const event::Room &event, const Context &context) const;
+  };
+
+  struct Rule {
+    QString id;
+    std::vector<Condition> conditions;
+    Actions actions;
+  };
+
+  std::vector<Rule> rules_;
+  // Enabled rules in priority order, i.e. override, content, room, sender, underride
+
+  void compile(const QJsonObject &global);
+};
+
+}
+
+#endif
@@ -3,6 +3,8 @@
 #include <unordered_set>
 #include <memory>
 #include <algorithm>
+#include <limits>
+#include <tuple>
 
 #include <QtNetwork>
 #include <QJsonObject>
@@ -13,6 +15,8 @@
 #include "proto.hpp"
 #include "Session.hpp"
 #include "utils.hpp"
+#include "Trace.hpp"
+#include "UploadQueue.hpp"
 
 using std::experimental::optional;
 
@@ -31,6 +35,7 @@ RoomState::RoomState(const QJsonObject &info, lmdb::txn &txn, lmdb::dbi &member_
   if(info["avatar"].isString()) {
     avatar_ = info["avatar"].toString();
   }
+  set_power_levels(info["power_levels"].toObject());
 
   const auto as = info["aliases"].toArray();
   aliases_.reserve(as.size());
@@ -67,13 +72,45 @@ QJsonObject RoomState::to_json() const {
   }
   o["aliases"] = std::move(aa);
 
+  QJsonObject users;
+  for(const auto &x : power_levels_) {
+    users[x.first.value()] = static_cast<double>(x.second);
+  }
+  o["power_levels"] = QJsonObject{{"users", users}, {"users_default", static_cast<double>(users_default_)}};
+
   return o;
 }
 
 QString RoomState::pretty_name(const UserID &own_id) const {
+  if(!pretty_name_ || pretty_name_own_id_ != own_id.value()) {
+    pretty_name_own_id_ = own_id.value();
+    pretty_name_ = compute_pretty_name(own_id);
+  }
+  return *pretty_name_;
+}
+
+void RoomState::invalidate_pretty_name() {
+  pretty_name_ = {};
+  ++pretty_name_version_;
+}
+
+void RoomState::members_changed() {
+  if(pretty_name_ && !pretty_name_from_members_) return;
+  invalidate_pretty_name();
+}
+
+void RoomState::member_renamed(const UserID &member) {
+  if(pretty_name_ && std::find(heroes_.begin(), heroes_.end(), member) == heroes_.end()) return;
+  invalidate_pretty_name();
+}
+
+QString RoomState::compute_pretty_name(const UserID &own_id) const {
+  heroes_.clear();
+  pretty_name_from_members_ = false;
   if(name_ && !name_->isEmpty()) return *name_;
   if(canonical_alias_) return *canonical_alias_;
   if(!aliases_.empty()) return aliases_[0];  // Non-standard, but matches vector-web
+  pretty_name_from_members_ = true;
   // FIXME: Maintain earliest two IDs as state!
   auto ms = members();
   ms.erase(std::remove_if(ms.begin(), ms.end(), [&](const Member *m){ return m->id() == own_id; }), ms.end());
@@ -83,6 +120,9 @@ QString RoomState::pretty_name(const UserID &own_id) const {
                         return a->id() < b->id();
                       });
   }
+  for(size_t i = 0; i < std::min<size_t>(ms.size(), 2); ++i) {
+    heroes_.push_back(ms[i]->id());
+  }
   switch(ms.size()) {
   case 0: return QObject::tr("Empty room");
   case 1: return ms[0]->pretty_name();
@@ -145,10 +185,12 @@ void RoomState::forget_displayname(const UserID &id, const QString &old_name_in,
   const auto before = vec.size();
   vec.erase(std::remove(vec.begin(), vec.end(), id), vec.end());
   assert(before - vec.size() == 1);
+  if(room) room->completion_index_.erase(old_name_in, id);
   if(vec.empty()) {
     members_by_displayname_.erase(old_name);
   }
   if(other_member) {
+    member_renamed(other_member->id());
     room->member_disambiguation_changed(*other_member, other_disambiguation);
   }
 }
@@ -162,6 +204,8 @@ void RoomState::record_displayname(const UserID &id, const QString &name, Room *
   vec.push_back(id);
 
   if(room) {
+    room->completion_index_.insert(name, id);
+
     const Member *other_member = nullptr;
     const bool existing_displayname = vec.size() == 2;
     const Member *const existing_mxid = member_from_id(UserID(normalized));
@@ -170,7 +214,25 @@ void RoomState::record_displayname(const UserID &id, const QString &name, Room *
       if(existing_displayname) other_member = &members_by_id_.at(vec[0]);
       if(existing_mxid) other_member = existing_mxid;
     }
-    if(other_member) room->member_disambiguation_changed(*other_member, "");
+    if(other_member) {
+      member_renamed(other_member->id());
+      room->member_disambiguation_changed(*other_member, "");
+    }
+  }
+}
+
+int64_t RoomState::power_level(const UserID &id) const {
+  auto it = power_levels_.find(id);
+  return it == power_levels_.end() ? users_default_ : it->second;
+}
+
+void RoomState::set_power_levels(const QJsonObject &content) {
+  power_levels_.clear();
+  users_default_ = content["users_default"].toDouble(0);
+  const auto users = content["users"].toObject();
+  power_levels_.reserve(users.size());
+  for(auto it = users.begin(); it != users.end(); ++it) {
+    power_levels_.emplace(UserID(it.key()), it.value().toDouble(users_default_));
   }
 }
 
@@ -183,13 +245,20 @@ const Member *RoomState::member_from_id(const UserID &id) const {
 static constexpr std::chrono::steady_clock::duration MINIMUM_BACKOFF(std::chrono::seconds(5));
 // Default synapse seconds-per-message when throttled
 
+static constexpr std::chrono::milliseconds RECEIPT_DELAY(1000);
+// Quiet period after the latest read receipt before it's sent, so that scrolling through a backlog sends only one
+
 Room::Room(Matrix &universe, Session &session, RoomID id, const QJsonObject &initial,
            lmdb::env &env, lmdb::txn &txn, lmdb::dbi &&member_db)
     : universe_(universe), session_(session), id_(std::move(id)),
-      db_env_(env), member_db_(std::move(member_db)), transmitting_(nullptr), retry_backoff_(MINIMUM_BACKOFF)
+      db_env_(env), member_db_(std::move(member_db)), transmitting_(nullptr), retry_backoff_(MINIMUM_BACKOFF),
+      uploads_(new UploadQueue(*this, this))
 {
   transmit_retry_timer_.setSingleShot(true);
   connect(&transmit_retry_timer_, &QTimer::timeout, this, &Room::transmit_event);
+  receipt_timer_.setSingleShot(true);
+  receipt_timer_.setInterval(RECEIPT_DELAY.count());
+  connect(&receipt_timer_, &QTimer::timeout, this, &Room::flush_read_receipt);
 
   if(!initial.isEmpty()) {
     state_ = RoomState(initial["state"].toObject(), txn, member_db_);
@@ -216,6 +285,125 @@ Room::Room(Matrix &universe, Session &session, RoomID id, const QJsonObject &ini
       update_receipt(UserID(it.key()), EventID(it.value().toObject()["event_id"].toString()), it.value().toObject()["ts"].toDouble());
     }
   }
+
+  std::unordered_set<QString, QStringHash> echoed;
+  for(const auto &batch : buffer_) {
+    for(const auto &evt : batch.events) {
+      if(evt.sender() != session_.user_id()) continue;
+      if(auto u = evt.unsigned_data()) echoed.insert(u->value("transaction_id").toString());
+    }
+  }
+  for(auto &event : session_.load_pending(id_)) {
+    if(echoed.count(event.transaction_id)) {
+      // Delivered, but we quit before hearing back
+      session_.discard_pending(id_, event.transaction_id);
+    } else {
+      pending_events_.push_back(std::move(event));
+    }
+  }
+  if(!pending_events_.empty()) {
+    QTimer::singleShot(0, this, &Room::transmit_event);
+  }
+
+  std::unordered_map<UserID, uint64_t> active;
+  for(const auto &batch : buffer_) {
+    for(const auto &evt : batch.events) {
+      auto &ts = active[evt.sender()];
+      ts = std::max(ts, evt.origin_server_ts());
+    }
+  }
+  for(const auto &x : receipts_by_user_) {
+    auto &ts = active[x.first];
+    ts = std::max(ts, x.second.ts);
+  }
+  const auto members = state_.members();
+  std::vector<MemberIndex::Entry> entries;
+  entries.reserve(members.size());
+  for(const auto member : members) {
+    auto it = active.find(member->id());
+    entries.push_back(member_index_.entry(member->id(), state_.member_name(*member),
+                                          it == active.end() ? 0 : it->second, state_.power_level(member->id())));
+    completion_index_.insert_member(member->id());
+    if(member->displayname()) completion_index_.insert(*member->displayname(), member->id());
+  }
+  member_index_.assign(std::move(entries));
+  completion_index_.set_aliases(state_.aliases());
+
+  connect(this, &Room::membership_changed, [this](const Member &member, Membership) {
+      if(!membership_displayable(member.membership())) {
+        completion_index_.erase_member(member.id());
+        rank(member.id(), member_index_.erase(member.id()));
+      } else if(member_index_.find(member.id())) {
+        rank(member.id(), member_index_.set_name(member.id(), state_.member_name(member)));
+      } else {
+        completion_index_.insert_member(member.id());
+        rank(member.id(), member_index_.insert(member.id(), state_.member_name(member), 0,
+                                               state_.power_level(member.id())));
+      }
+    });
+  connect(this, &Room::member_name_changed, [this](const Member &member, const QString &) {
+      rank(member.id(), member_index_.set_name(member.id(), state_.member_name(member)));
+    });
+  connect(this, &Room::member_disambiguation_changed, [this](const Member &member, const QString &) {
+      rank(member.id(), member_index_.set_name(member.id(), state_.member_name(member)));
+    });
+  connect(this, &Room::aliases_changed, [this]() {
+      completion_index_.set_aliases(state_.aliases());
+    });
+  connect(this, &Room::power_levels_changed, [this]() {
+      std::vector<UserID> ids;
+      ids.reserve(member_index_.size());
+      for(const auto &entry : member_index_.entries()) {
+        ids.push_back(entry.id);
+      }
+      for(const auto &id : ids) {
+        rank(id, member_index_.set_power(id, state_.power_level(id)));
+      }
+    });
+}
+
+void Room::rank(const UserID &member, const MemberIndex::Change &change) {
+  if(change.from || change.to) member_rank_changed(member, change);
+}
+
+std::vector<QString> Room::complete(const QString &prefix, size_t limit) const {
+  const auto matches = completion_index_.matching(prefix);
+  struct Candidate {
+    size_t rank;
+    bool by_id;
+    const CompletionIndex::Entry *entry;
+  };
+  std::vector<Candidate> candidates;
+  candidates.reserve(matches.size());
+  for(const auto &entry : matches) {
+    size_t rank = std::numeric_limits<size_t>::max();
+    if(!entry.member.value().isEmpty()) {
+      auto r = member_index_.rank(entry.member);
+      if(!r) continue;          // Departed
+      rank = *r;
+    }
+    candidates.push_back(Candidate{rank, entry.text == entry.member.value(), &entry});
+  }
+
+  // Members match at most twice, by name and by ID, so this many is enough to fill the result after deduplication
+  const auto order = [](const Candidate &a, const Candidate &b) {
+    return std::tie(a.rank, a.by_id, a.entry->key) < std::tie(b.rank, b.by_id, b.entry->key);
+  };
+  const size_t n = std::min(candidates.size(), 2 * limit);
+  std::partial_sort(candidates.begin(), candidates.begin() + n, candidates.end(), order);
+
+  std::vector<QString> result;
+  result.reserve(std::min(n, limit));
+  const UserID *last = nullptr;
+  for(size_t i = 0; i < n && result.size() < limit; ++i) {
+    const auto &entry = *candidates[i].entry;
+    if(!entry.member.value().isEmpty()) {
+      if(last && *last == entry.member) continue;
+      last = &entry.member;
+    }
+    result.push_back(entry.text);
+  }
+  return result;
 }
 
 QString Room::pretty_name() const {
@@ -229,6 +417,7 @@ void Room::load_state(lmdb::txn &txn, gsl::span<const event::room::State> events
       initial_state_.prune_departed();
       state_.dispatch(state, this, &member_db_, &txn);
       state_.prune_departed();
+      push_context_ = {};
     } catch(malformed_event &e) {
       qDebug() << "WARNING:" << id().value() << "ignoring malformed state:" << e.what();
       qDebug() << state.json();
@@ -266,18 +455,11 @@ QJsonObject Room::to_json() const {
 }
 
 bool Room::dispatch(lmdb::txn &txn, const proto::JoinedRoom &joined) {
+  TRACE_OPERATION("Room::dispatch", id_.value());
   bool state_touched = false;
 
-  if(joined.unread_notifications.highlight_count != highlight_count_) {
-    auto old = highlight_count_;
-    highlight_count_ = joined.unread_notifications.highlight_count;
-    highlight_count_changed(old);
-  }
-
-  if(joined.unread_notifications.notification_count != notification_count_) {
-    auto old = notification_count_;
-    notification_count_ = joined.unread_notifications.notification_count;
-    notification_count_changed(old);
+  if(joined.unread_notifications) {
+    set_counts(joined.unread_notifications->highlight_count, joined.unread_notifications->notification_count);
   }
 
   if(joined.timeline.limited) {
@@ -298,7 +480,10 @@ bool Room::dispatch(lmdb::txn &txn, const proto::JoinedRoom &joined) {
     for(auto &evt : joined.timeline.events) {
       if(auto s = evt.to_state()) {
         try {
-          state_touched |= state_.dispatch(*s, this, &member_db_, &txn);
+          if(state_.dispatch(*s, this, &member_db_, &txn)) {
+            state_touched = true;
+            push_context_ = {};
+          }
         } catch(const malformed_event &e) {
           qDebug() << "WARNING:" << id().value() << "ignoring malformed state:" << e.what();
           qDebug() << s->json();
@@ -308,6 +493,8 @@ bool Room::dispatch(lmdb::txn &txn, const proto::JoinedRoom &joined) {
       // Must be placed before `message` so resulting calls to `has_unread` return accurate results accounting for the
       // message in question
       batch.events.emplace_back(evt);
+      session_.index(id_, gsl::span<const event::Room>(&evt, 1));
+      rank(evt.sender(), member_index_.set_last_active(evt.sender(), evt.origin_server_ts()));
 
       message(evt);
 
@@ -344,6 +531,8 @@ bool Room::dispatch(lmdb::txn &txn, const proto::JoinedRoom &joined) {
     }
   }
 
+  if(!joined.unread_notifications) recount();
+
   if(state_touched) {
     state_changed();
   }
@@ -365,7 +554,9 @@ bool RoomState::update_membership(const UserID &user_id, const event::room::Memb
     auto old_displayname = member.displayname();
     auto old_member_name = member_name(member);
     member.update_membership(content);
+    if(member.membership() != old_membership) members_changed();
     if(member.displayname() != old_displayname) {
+      member_renamed(member.id());
       if(old_displayname)
         forget_displayname(member.id(), *old_displayname, room);
       if(member.displayname())
@@ -393,6 +584,7 @@ bool RoomState::update_membership(const UserID &user_id, const event::room::Memb
       auto old_membership = member.membership();
       auto old_displayname = member.displayname();
       member.update_membership(content);
+      members_changed();
       if(member.displayname() != old_displayname) {
         if(old_displayname)
           forget_displayname(member.id(), *old_displayname, room);
@@ -427,6 +619,7 @@ bool RoomState::dispatch(const event::room::State &state, Room *room, lmdb::dbi
 
     aliases_.reserve(all_aliases.size());
     std::move(all_aliases.begin(), all_aliases.end(), std::back_inserter(aliases_));
+    invalidate_pretty_name();
     if(room) room->aliases_changed();
     return true;
   }
@@ -434,14 +627,20 @@ bool RoomState::dispatch(const event::room::State &state, Room *room, lmdb::dbi
     event::room::CanonicalAlias ca{state};
     auto old = std::move(canonical_alias_);
     canonical_alias_ = ca.alias();
-    if(room && canonical_alias_ != old) room->canonical_alias_changed();
+    if(canonical_alias_ != old) {
+      invalidate_pretty_name();
+      if(room) room->canonical_alias_changed();
+    }
     return true;
   }
   if(state.type() == event::room::Name::tag()) {
     event::room::Name n{state};
     auto old = std::move(name_);
     name_ = n.name();
-    if(room && name_ != old) room->name_changed();
+    if(name_ != old) {
+      invalidate_pretty_name();
+      if(room) room->name_changed();
+    }
     return true;
   }
   if(state.type() == event::room::Topic::tag()) {
@@ -460,6 +659,12 @@ bool RoomState::dispatch(const event::room::State &state, Room *room, lmdb::dbi
     if(room && avatar_ != old) room->avatar_changed();
     return true;
   }
+  if(state.type() == event::room::PowerLevels::tag()) {
+    event::room::PowerLevels p(state);
+    set_power_levels(p.content().json());
+    if(room) room->power_levels_changed();
+    return true;
+  }
   if(state.type() == event::room::Create::tag()) {
     // Nothing to do here, because our rooms data structures are created implicitly
     return false;
@@ -476,10 +681,12 @@ bool RoomState::dispatch(const event::room::State &state, Room *room, lmdb::dbi
 void RoomState::revert(const event::room::State &state) {
   if(state.type() == event::room::CanonicalAlias::tag()) {
     canonical_alias_ = event::room::CanonicalAlias(state).prev_alias();
+    invalidate_pretty_name();
     return;
   }
   if(state.type() == event::room::Name::tag()) {
     name_ = event::room::Name(state).prev_name();
+    invalidate_pretty_name();
     return;
   }
   if(state.type() == event::room::Topic::tag()) {
@@ -494,6 +701,11 @@ void RoomState::revert(const event::room::State &state) {
       avatar_ = QUrl();
     return;
   }
+  if(state.type() == event::room::PowerLevels::tag()) {
+    auto prev = event::room::PowerLevels(state).prev_content();
+    set_power_levels(prev ? prev->json() : QJsonObject());
+    return;
+  }
   if(state.type() == event::room::Member::tag()) {
     event::room::Member member(state);
     update_membership(member.user(),
@@ -532,10 +744,45 @@ void RoomState::prune_departed(Room *room) {
     if(dn) forget_displayname(*departed_, *dn, room);
     members_by_id_.erase(*departed_);
     departed_ = {};
+    members_changed();
   }
 }
 
 MessageFetch *Room::get_messages(Direction dir, const TimelineCursor &from, uint64_t limit, optional<TimelineCursor> to) {
+  if(!to && prefetch_ && prefetch_->dir == dir && prefetch_->from == from && prefetch_->limit == limit) {
+    Prefetch p = std::move(*prefetch_);
+    prefetch_ = {};
+    if(!p.start) return p.fetch;  // Still in flight; the caller can simply listen in
+
+    // Complete asynchronously like a real request, so the caller can connect first
+    auto result = new MessageFetch(this);
+    QTimer::singleShot(0, result, [result, p]() {
+        result->finished(*p.start, *p.end, p.events);
+        result->deleteLater();
+      });
+    return result;
+  }
+  return fetch_messages(dir, from, limit, to);
+}
+
+void Room::prefetch_messages(Direction dir, const TimelineCursor &from, uint64_t limit) {
+  if(prefetch_ && prefetch_->dir == dir && prefetch_->from == from && prefetch_->limit == limit) return;
+
+  auto fetch = fetch_messages(dir, from, limit, {});
+  prefetch_ = Prefetch{dir, from, limit, fetch, {}, {}, {}};
+  connect(fetch, &MessageFetch::finished, this,
+          [this, fetch](const TimelineCursor &start, const TimelineCursor &end, gsl::span<const event::Room> events) {
+      if(!prefetch_ || prefetch_->fetch != fetch) return;  // Claimed or superseded
+      prefetch_->start = start;
+      prefetch_->end = end;
+      prefetch_->events.assign(events.begin(), events.end());
+    });
+  connect(fetch, &MessageFetch::error, this, [this, fetch]() {
+      if(prefetch_ && prefetch_->fetch == fetch) prefetch_ = {};
+    });
+}
+
+MessageFetch *Room::fetch_messages(Direction dir, const TimelineCursor &from, uint64_t limit, optional<TimelineCursor> to) {
   QUrlQuery query;
   query.addQueryItem("from", from.value());
   query.addQueryItem("dir", dir == Direction::FORWARD ? "f" : "b");
@@ -543,7 +790,7 @@ MessageFetch *Room::get_messages(Direction dir, const TimelineCursor &from, uint
   if(to) query.addQueryItem("to", to->value());
   auto reply = session_.get(QString("client/r0/rooms/" % QUrl::toPercentEncoding(id_.value()) % "/messages"), query);
   auto result = new MessageFetch(reply);
-  connect(reply, &QNetworkReply::finished, [reply, result]() {
+  connect(reply, &QNetworkReply::finished, this, [this, reply, result]() {
       auto r = decode(reply);
       if(r.error) {
         result->error(*r.error);
@@ -582,12 +829,87 @@ MessageFetch *Room::get_messages(Direction dir, const TimelineCursor &from, uint
       if(error) {
         result->error(tr("malformed event: %1").arg(error));
       } else {
+        session_.index(id_, events);
         result->finished(start, end, events);
       }
     });
   return result;
 }
 
+EventContext *Room::get_context(const EventID &event, uint64_t limit) {
+  QUrlQuery query;
+  if(limit != 0) query.addQueryItem("limit", QString::number(limit));
+  auto reply = session_.get(QString("client/r0/rooms/" % QUrl::toPercentEncoding(id_.value()) % "/context/" % QUrl::toPercentEncoding(event.value())), query);
+  auto result = new EventContext(reply);
+  connect(reply, &QNetworkReply::finished, [reply, result]() {
+      auto r = decode(reply);
+      if(r.error) {
+        result->error(*r.error);
+        return;
+      }
+
+      auto start_val = r.object["start"];
+      auto end_val = r.object["end"];
+      if(!start_val.isString() || !end_val.isString()) {
+        result->error("invalid or missing pagination tokens in server's response");
+        return;
+      }
+
+      auto event_val = r.object["event"];
+      if(!event_val.isObject()) {
+        result->error("invalid or missing \"event\" attribute in server's response");
+        return;
+      }
+
+      optional<event::Room> evt;
+      std::vector<event::Room> before, after;
+      std::vector<event::room::State> state;
+      const char *error = nullptr;
+      try {
+        evt = event::Room(event::Identifiable(Event(event_val.toObject())));
+        auto to_event = [](const QJsonValue &v) { return event::Room(event::Identifiable(Event(v.toObject()))); };
+        auto b = r.object["events_before"].toArray();
+        std::transform(b.begin(), b.end(), std::back_inserter(before), to_event);
+        auto a = r.object["events_after"].toArray();
+        std::transform(a.begin(), a.end(), std::back_inserter(after), to_event);
+        auto st = r.object["state"].toArray();
+        std::transform(st.begin(), st.end(), std::back_inserter(state),
+                       [&](const QJsonValue &v) { return event::room::State(to_event(v)); });
+      } catch(const malformed_event &e) {
+        error = e.what();
+      }
+      if(error) {
+        result->error(tr("malformed event: %1").arg(error));
+      } else {
+        result->finished(TimelineCursor{start_val.toString()}, TimelineCursor{end_val.toString()},
+                         before, *evt, after, state);
+      }
+    });
+  return result;
+}
+
+EventLookup *Room::get_event_at(uint64_t ts, Direction dir) {
+  QUrlQuery query;
+  query.addQueryItem("ts", QString::number(ts));
+  query.addQueryItem("dir", dir == Direction::FORWARD ? "f" : "b");
+  auto reply = session_.get(QString("client/v1/rooms/" % QUrl::toPercentEncoding(id_.value()) % "/timestamp_to_event"), query);
+  auto result = new EventLookup(reply);
+  connect(reply, &QNetworkReply::finished, [reply, result]() {
+      auto r = decode(reply);
+      if(r.error) {
+        result->error(*r.error);
+        return;
+      }
+      auto id = r.object["event_id"];
+      if(!id.isString()) {
+        result->error("invalid or missing \"event_id\" attribute in server's response");
+        return;
+      }
+      result->finished(EventID(id.toString()), r.object["origin_server_ts"].toDouble());
+    });
+  return result;
+}
+
 EventSend *Room::leave() {
   auto reply = session_.post(QString("client/r0/rooms/" % QUrl::toPercentEncoding(id_.value()) % "/leave"));
   auto es = new EventSend(reply);
@@ -603,7 +925,9 @@ EventSend *Room::leave() {
 }
 
 void Room::send(const QString &type, QJsonObject content) {
-  pending_events_.push_back({type, content});
+  pending_events_.push_back({type, content, session_.get_transaction_id()});
+  session_.store_pending(id_, pending_events_.back());
+  local_echo(pending_events_.back());
   transmit_event();
 }
 
@@ -632,6 +956,24 @@ void Room::send_file(const QString &uri, const QString &name, const QString &med
            });
 }
 
+void Room::send_image(const QString &uri, const QString &name, const QString &media_type, size_t size,
+                      const QSize &dimensions, const QString &thumbnail_uri, const QJsonObject &thumbnail_info) {
+  QJsonObject info{
+    {"mimetype", media_type},
+    {"size", static_cast<qint64>(size)},
+    {"w", dimensions.width()},
+    {"h", dimensions.height()}};
+  if(!thumbnail_uri.isEmpty()) {
+    info["thumbnail_url"] = thumbnail_uri;
+    info["thumbnail_info"] = thumbnail_info;
+  }
+  send("m.room.message",
+       {{"msgtype", "m.image"},
+         {"url", uri},
+         {"body", name},
+         {"info", info}});
+}
+
 void Room::send_message(const QString &body) {
   send("m.room.message",
        {{"msgtype", "m.text"},
@@ -644,7 +986,25 @@ void Room::send_emote(const QString &body) {
          {"body", body}});
 }
 
-void Room::send_read_receipt(const EventID &event) {
+void Room::send_read_receipt(const event::Room &event) {
+  if(event.origin_server_ts() < acknowledged_ts_) return;
+  if(pending_receipt_ && event.origin_server_ts() < pending_receipt_->origin_server_ts()) return;
+  auto own = receipt_from(session_.user_id());
+  if(own && own->event == event.id()) return;
+
+  pending_receipt_ = event;
+  receipt_timer_.start();
+}
+
+EventSend *Room::flush_read_receipt() {
+  receipt_timer_.stop();
+  if(!pending_receipt_) return nullptr;
+  acknowledged_ts_ = std::max(acknowledged_ts_, pending_receipt_->origin_server_ts());
+  recount();  // Don't wait for the server to catch up
+  if(!session_.can_send()) return nullptr;  // Kept until the session catches up
+  const EventID event = pending_receipt_->id();
+  pending_receipt_ = {};
+
   auto reply = session_.post(QString("client/r0/rooms/" % QUrl::toPercentEncoding(id_.value()) % "/receipt/m.read/" % QUrl::toPercentEncoding(event.value())));
   auto es = new EventSend(reply);
   connect(reply, &QNetworkReply::finished, [reply, es, event]() {
@@ -655,6 +1015,7 @@ void Room::send_read_receipt(const EventID &event) {
       }
     });
   connect(es, &EventSend::error, this, &Room::error);
+  return es;
 }
 
 gsl::span<const Room::Receipt * const> Room::receipts_for(const EventID &id) const {
@@ -683,6 +1044,54 @@ bool Room::has_unread() const {
   return true;
 }
 
+PushRules::Actions Room::push_actions(const event::Room &e) const {
+  return session_.push_rules().evaluate(e, push_context());
+}
+
+const PushRules::Context &Room::push_context() const {
+  if(!push_context_) {
+    auto self = state_.member_from_id(session_.user_id());
+    size_t joined = 0;
+    for(auto member : state_.members()) {
+      joined += member->membership() == Membership::JOIN;
+    }
+    push_context_ = PushRules::Context{session_.user_id(), id_,
+                                       self && self->displayname() ? self->displayname()->toCaseFolded() : QString(),
+                                       joined};
+  }
+  return *push_context_;
+}
+
+void Room::set_counts(uint64_t highlights, uint64_t notifications) {
+  if(highlights != highlight_count_) {
+    auto old = highlight_count_;
+    highlight_count_ = highlights;
+    highlight_count_changed(old);
+  }
+
+  if(notifications != notification_count_) {
+    auto old = notification_count_;
+    notification_count_ = notifications;
+    notification_count_changed(old);
+  }
+}
+
+void Room::recount() {
+  uint64_t highlights = 0, notifications = 0;
+  auto own = receipt_from(session_.user_id());
+  [&]() {
+    for(auto batch = buffer_.crbegin(); batch != buffer_.crend(); ++batch) {
+      for(auto event = batch->events.crbegin(); event != batch->events.crend(); ++event) {
+        if((own && own->event == event->id()) || event->origin_server_ts() <= acknowledged_ts_) return;
+        const auto actions = push_actions(*event);
+        notifications += actions.notify;
+        highlights += actions.highlight;
+      }
+    }
+  }();
+  set_counts(highlights, notifications);
+}
+
 void Room::update_receipt(const UserID &user, const EventID &event, uint64_t ts) {
   const Receipt new_value{event, ts};
   auto emplaced = receipts_by_user_.emplace(user, new_value);
@@ -696,15 +1105,27 @@ void Room::update_receipt(const UserID &user, const EventID &event, uint64_t ts)
     emplaced.first->second = new_value;
   }
   receipts_by_event_[event].push_back(&emplaced.first->second);
+  rank(user, member_index_.set_last_active(user, ts));
+
+  if(user == session_.user_id()) {
+    // Account for receipts sent by other clients
+    for(const auto &batch : buffer_) {
+      for(const auto &evt : batch.events) {
+        if(evt.id() == event) acknowledged_ts_ = std::max(acknowledged_ts_, evt.origin_server_ts());
+      }
+    }
+  }
 }
 
 void Room::transmit_event() {
-  if(transmitting_) return;     // We'll be re-invoked when necessary by transmit_finished
+  if(transmitting_ || pending_events_.empty()) return;  // We'll be re-invoked when necessary by transmit_finished
+  if(transmit_retry_timer_.isActive()) return;  // Or when the backoff expires
+  if(!session_.can_send()) return;              // Or once the session catches up
 
+  // One at a time: concurrent requests may be spread over several connections and reach the server out of order
   const auto &event = pending_events_.front();
-  if(last_transmit_transaction_.isEmpty()) last_transmit_transaction_ = session_.get_transaction_id();
   transmitting_ = session_.put(
-    "client/r0/rooms/" % QUrl::toPercentEncoding(id_.value()) % "/send/" % QUrl::toPercentEncoding(event.type) % "/" % last_transmit_transaction_,
+    "client/r0/rooms/" % QUrl::toPercentEncoding(id_.value()) % "/send/" % QUrl::toPercentEncoding(event.type) % "/" % event.transaction_id,
     event.content);
   connect(transmitting_, &QNetworkReply::finished, this, &Room::transmit_finished);
 }
@@ -715,29 +1136,24 @@ void Room::transmit_finished() {
 
   auto r = decode(transmitting_);
   transmitting_ = nullptr;
-  bool retrying = false;
-  if(r.code >= 400 && r.code < 500 && r.code != 429) {
-    // HTTP client errors other than rate-limiting are unrecoverable
-    error(*r.error);
-    pending_events_.pop_front();
-  } else if(!r.error) {
-    pending_events_.pop_front();
-  } else {
-    retrying = true;
+  if(r.error && !(r.code >= 400 && r.code < 500 && r.code != 429)) {
+    // Retried with the same transaction ID, so the server deduplicates it if it did land
     qDebug() << "retrying send in" << duration_cast<duration<float>>(retry_backoff_).count() << "seconds due to error:" << *r.error;
+    transmit_retry_timer_.start(duration_cast<milliseconds>(retry_backoff_).count());
+    retry_backoff_ = std::min<steady_clock::duration>(30s, duration_cast<steady_clock::duration>(1.25 * retry_backoff_));
+    return;
   }
-  if(!retrying) {
-    last_transmit_transaction_ = "";
-    retry_backoff_ = MINIMUM_BACKOFF;
-  }
-  if(!pending_events_.empty()) {
-    if(retrying) {
-      transmit_retry_timer_.start(duration_cast<milliseconds>(retry_backoff_).count());
-      retry_backoff_ = std::min<steady_clock::duration>(30s, duration_cast<steady_clock::duration>(1.25 * retry_backoff_));
-    } else {
-      transmit_event();
-    }
+
+  if(r.error) {
+    // HTTP client errors other than rate-limiting are unrecoverable
+    error(*r.error);
+    local_echo_failed(pending_events_.front().transaction_id);
   }
+  session_.discard_pending(id_, pending_events_.front().transaction_id);
+  pending_events_.pop_front();
+  retry_backoff_ = MINIMUM_BACKOFF;
+
+  transmit_event();
 }
 
 }
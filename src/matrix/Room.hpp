@@ -12,6 +12,7 @@
 #include <QObject>
 #include <QUrl>
 #include <QTimer>
+#include <QSize>
 
 #include <span.h>
 
@@ -19,6 +20,9 @@
 
 #include "Member.hpp"
 #include "Event.hpp"
+#include "PushRules.hpp"
+#include "MemberIndex.hpp"
+#include "CompletionIndex.hpp"
 
 class QNetworkReply;
 
@@ -26,6 +30,7 @@ namespace matrix {
 
 class Matrix;
 class Session;
+class UploadQueue;
 
 namespace proto {
 struct JoinedRoom;
@@ -58,8 +63,12 @@ public:
   std::vector<const Member *> members() const;
   const Member *member_from_id(const UserID &id) const;
 
+  int64_t power_level(const UserID &id) const;
+
   QString pretty_name(const UserID &own_id) const;
-  // Matrix r0.1.0 11.2.2.5 ish (like vector-web)
+  // Matrix r0.1.0 11.2.2.5 ish (like vector-web). Cached until state that affects it changes.
+  uint64_t pretty_name_version() const { return pretty_name_version_; }
+  // Incremented whenever pretty_name may have changed
 
   QString member_disambiguation(const Member &member) const;
   QString member_name(const Member &member) const;
@@ -77,9 +86,23 @@ private:
   std::unordered_map<UserID, Member> members_by_id_;
   std::unordered_map<QString, std::vector<UserID>, QStringHash> members_by_displayname_;
   std::experimental::optional<UserID> departed_;
-
+  std::unordered_map<UserID, int64_t> power_levels_;
+  int64_t users_default_ = 0;
+
+  mutable std::experimental::optional<QString> pretty_name_;
+  mutable QString pretty_name_own_id_;
+  mutable std::vector<UserID> heroes_;
+  // Members named by pretty_name_; empty if it didn't come from membership
+  mutable bool pretty_name_from_members_ = false;
+  uint64_t pretty_name_version_ = 0;
+
+  QString compute_pretty_name(const UserID &own_id) const;
+  void invalidate_pretty_name();
+  void members_changed();
+  void member_renamed(const UserID &member);
   void forget_displayname(const UserID &member, const QString &old_name, Room *room);
   void record_displayname(const UserID &member, const QString &name, Room *room);
+  void set_power_levels(const QJsonObject &content);
   std::vector<UserID> &members_named(QString displayname);
   const std::vector<UserID> &members_named(QString displayname) const;
 
@@ -97,6 +120,31 @@ signals:
   void error(const QString &message);
 };
 
+class EventContext : public QObject {
+  Q_OBJECT
+
+public:
+  EventContext(QObject *parent = nullptr) : QObject(parent) {}
+
+signals:
+  void finished(const TimelineCursor &start, const TimelineCursor &end,
+                gsl::span<const event::Room> before, const event::Room &event, gsl::span<const event::Room> after,
+                gsl::span<const event::room::State> state);
+  // before is in reverse chronological order, after in chronological order. state is the room state at the end of after.
+  void error(const QString &message);
+};
+
+class EventLookup : public QObject {
+  Q_OBJECT
+
+public:
+  EventLookup(QObject *parent = nullptr) : QObject(parent) {}
+
+signals:
+  void finished(const EventID &event, uint64_t origin_server_ts);
+  void error(const QString &message);
+};
+
 class EventSend : public QObject {
   Q_OBJECT
 
@@ -127,6 +175,7 @@ public:
   struct PendingEvent {
     QString type;
     QJsonObject content;
+    QString transaction_id;     // Allocated when queued so that retransmissions are idempotent
   };
 
   Room(Matrix &universe, Session &session, RoomID id, const QJsonObject &initial,
@@ -145,6 +194,7 @@ public:
   const RoomState &state() const { return state_; }
 
   QString pretty_name() const;
+  uint64_t pretty_name_version() const { return state_.pretty_name_version(); }
   QString pretty_name_highlights() const {
     return pretty_name() + (highlight_count() != 0 ? " (" + QString::number(highlight_count()) + ")" : "");
   }
@@ -158,6 +208,13 @@ public:
   QJsonObject to_json() const;
 
   MessageFetch *get_messages(Direction dir, const TimelineCursor &from, uint64_t limit = 0, std::experimental::optional<TimelineCursor> to = {});
+  EventContext *get_context(const EventID &event, uint64_t limit = 0);
+  EventLookup *get_event_at(uint64_t ts, Direction dir);
+  // Finds the event closest to ts in the given direction
+
+  void prefetch_messages(Direction dir, const TimelineCursor &from, uint64_t limit);
+  // Speculatively fetches a page so that a matching get_messages call can complete without waiting on the server. Only
+  // the most recent prefetch is retained.
 
   EventSend *leave();
 
@@ -165,19 +222,42 @@ public:
   void redact(const EventID &event, const QString &reason = "");
 
   void send_file(const QString &uri, const QString &name, const QString &media_type, size_t size);
+  void send_image(const QString &uri, const QString &name, const QString &media_type, size_t size, const QSize &dimensions,
+                  const QString &thumbnail_uri = QString(), const QJsonObject &thumbnail_info = QJsonObject());
   void send_message(const QString &body);
   void send_emote(const QString &body);
 
-  void send_read_receipt(const EventID &event);
+  UploadQueue &uploads() { return *uploads_; }
+  // Files on their way to the room. Owned here rather than by a view so that closing one doesn't abandon them.
+
+  void send_read_receipt(const event::Room &event);
+  // Receipts are coalesced until none has been requested for a short interval, and those for events older than one
+  // we've already acknowledged are dropped.
+  EventSend *flush_read_receipt();
+  // Sends any pending read receipt immediately, e.g. when the user looks away. Returns the request, if one was made.
+  void transmit_event();
+  // Sends what's in the outbox, if the session allows
 
   bool has_unread() const;
+  uint64_t read_ts() const { return acknowledged_ts_; }
+  // origin_server_ts of the latest event we've sent a read receipt for
+
+  PushRules::Actions push_actions(const event::Room &event) const;
+  // Evaluates the account's push rules against event in the current room state
+  bool is_highlight(const event::Room &event) const { return push_actions(event).highlight; }
 
   gsl::span<const UserID> typing() const { return typing_; }
   gsl::span<const Receipt * const> receipts_for(const EventID &id) const;
   const Receipt *receipt_from(const UserID &id) const;
 
   const std::deque<PendingEvent> &pending_events() const { return pending_events_; }
-  // Events that have not yet been successfully transmitted
+  // Events that have not yet been successfully transmitted. Persisted across restarts.
+
+  const MemberIndex &member_index() const { return member_index_; }
+  // Joined and invited members ordered by recent activity, then power level, then name
+
+  std::vector<QString> complete(const QString &prefix, size_t limit) const;
+  // Display names, user IDs and aliases beginning with prefix, most recently active members first
 
 signals:
   void membership_changed(const Member &, Membership old);
@@ -191,12 +271,20 @@ signals:
   void aliases_changed();
   void topic_changed(const std::experimental::optional<QString> &old);
   void avatar_changed();
+  void power_levels_changed();
+  void member_rank_changed(const UserID &member, const MemberIndex::Change &change);
+  // Emitted after member_index() changes
   void discontinuity();
   void typing_changed();
   void receipts_changed();
 
   void prev_batch(const TimelineCursor &);
   void message(const event::Room &);
+  void local_echo(const PendingEvent &);
+  // Emitted when an event is queued for sending. The copy later received in message will have a matching
+  // unsigned.transaction_id.
+  void local_echo_failed(const QString &transaction_id);
+  // The server rejected the event, so it will never be received
 
   void error(const QString &msg);
   void left(Membership reason);
@@ -213,22 +301,49 @@ private:
   RoomState state_;
 
   uint64_t highlight_count_ = 0, notification_count_ = 0;
+  mutable std::experimental::optional<PushRules::Context> push_context_;  // Cleared when state changes
 
   std::unordered_map<EventID, std::vector<Receipt *>> receipts_by_event_;
   std::unordered_map<UserID, Receipt> receipts_by_user_;
 
   std::vector<UserID> typing_;
 
+  MemberIndex member_index_;
+  CompletionIndex completion_index_;
+  friend class RoomState;       // Maintains completion_index_ as display names come and go
+
+  struct Prefetch {
+    Direction dir;
+    TimelineCursor from;
+    uint64_t limit;
+    MessageFetch *fetch;        // Identifies the request while it's in flight
+    std::experimental::optional<TimelineCursor> start, end;  // Set once the response has arrived
+    std::vector<event::Room> events;
+  };
+  std::experimental::optional<Prefetch> prefetch_;
+
+  std::experimental::optional<event::Room> pending_receipt_;
+  QTimer receipt_timer_;
+  uint64_t acknowledged_ts_ = 0;  // origin_server_ts of the latest event we're known to have read
+
   // State used for reliable in-order message delivery in send, transmit_event, and transmit_finished
   std::deque<PendingEvent> pending_events_;
-  QNetworkReply *transmitting_;
+  QNetworkReply *transmitting_;  // Request for the first pending event, if in flight
   QTimer transmit_retry_timer_;
   std::chrono::steady_clock::duration retry_backoff_;
-  QString last_transmit_transaction_;
+
+  UploadQueue *uploads_;
 
   void update_receipt(const UserID &user, const EventID &event, uint64_t ts);
 
-  void transmit_event();
+  void rank(const UserID &member, const MemberIndex::Change &change);
+  const PushRules::Context &push_context() const;
+  void set_counts(uint64_t highlights, uint64_t notifications);
+  void recount();
+  // Counts notifying events after our read receipt, for when the server can't tell us
+
+  MessageFetch *fetch_messages(Direction dir, const TimelineCursor &from, uint64_t limit, std::experimental::optional<TimelineCursor> to);
+
   void transmit_finished();
 };
 
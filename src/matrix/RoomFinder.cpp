@@ -0,0 +1,124 @@
+#include "RoomFinder.hpp"
+
+#include <algorithm>
+
+#include "Session.hpp"
+#include "Room.hpp"
+
+namespace matrix {
+
+static constexpr size_t DIRECT_CHAT_MEMBERS = 3;
+// Rooms with at most this many members are also found by the names of the people in them
+
+static QString fold(const QString &s) {
+  return s.normalized(QString::NormalizationForm_C).toCaseFolded();
+}
+
+static uint64_t char_mask(const QString &s) {
+  // One bit per letter or digit, with everything else sharing the rest, so a room can be ruled out without scoring it
+  uint64_t result = 0;
+  for(const auto c : s) {
+    const ushort u = c.unicode();
+    if(u >= 'a' && u <= 'z') result |= uint64_t(1) << (u - 'a');
+    else if(u >= '0' && u <= '9') result |= uint64_t(1) << (26 + u - '0');
+    else result |= uint64_t(1) << (36 + u % 28);
+  }
+  return result;
+}
+
+static int score(const QString &name, const QString &query) {
+  // Greedy subsequence match favouring word starts and runs of consecutive characters; 0 if there is no match
+  int result = 0, run = 0, j = 0, previous = -2;
+  for(int i = 0; i < name.size() && j < query.size(); ++i) {
+    if(name[i] != query[j]) continue;
+    int bonus = 1;
+    if(i == 0) bonus += 8;
+    else if(!name[i-1].isLetterOrNumber()) bonus += 6;
+    if(previous == i - 1) {
+      ++run;
+      bonus += 2 * run;
+    } else {
+      run = 0;
+    }
+    result += bonus;
+    previous = i;
+    ++j;
+  }
+  if(j < query.size()) return 0;
+  // Prefer shorter names among otherwise equal matches
+  return std::max(1, result * 16 - (name.size() - query.size()));
+}
+
+RoomFinder::RoomFinder(Session &session, QObject *parent) : QObject(parent), session_(session) {
+  for(auto room : session_.rooms()) {
+    track(*room);
+  }
+  connect(&session_, &Session::joined, this, &RoomFinder::track);
+}
+
+void RoomFinder::track(Room &room) {
+  auto &entry = rooms_.emplace(room.id(), Entry{&room, {}, 0}).first->second;
+  index(entry);
+
+  auto &&reindex = [this, &entry]() { index(entry); };
+  connect(&room, &Room::name_changed, this, reindex);
+  connect(&room, &Room::canonical_alias_changed, this, reindex);
+  connect(&room, &Room::aliases_changed, this, reindex);
+  connect(&room, &Room::membership_changed, this, reindex);
+  connect(&room, &Room::member_name_changed, this, reindex);
+}
+
+void RoomFinder::index(Entry &entry) {
+  const auto &room = *entry.room;
+  const auto &state = room.state();
+  entry.names.clear();
+  entry.names.push_back(fold(room.pretty_name()));
+  if(state.name()) entry.names.push_back(fold(*state.name()));
+  if(state.canonical_alias()) entry.names.push_back(fold(*state.canonical_alias()));
+  for(const auto &alias : state.aliases()) {
+    entry.names.push_back(fold(alias));
+  }
+  if(room.member_index().size() <= DIRECT_CHAT_MEMBERS) {
+    for(const auto &member : room.member_index().entries()) {
+      if(member.id == session_.user_id()) continue;
+      entry.names.push_back(fold(member.name));
+      entry.names.push_back(fold(member.id.value()));
+    }
+  }
+  std::sort(entry.names.begin(), entry.names.end());
+  entry.names.erase(std::unique(entry.names.begin(), entry.names.end()), entry.names.end());
+
+  entry.mask = 0;
+  for(const auto &name : entry.names) {
+    entry.mask |= char_mask(name);
+  }
+}
+
+std::vector<RoomFinder::Result> RoomFinder::find(const QString &query_in, size_t limit) const {
+  QString query = fold(query_in);
+  query.remove(' ');
+  std::vector<Result> result;
+  if(query.isEmpty()) return result;
+  const uint64_t mask = char_mask(query);
+
+  for(const auto &x : rooms_) {
+    const auto &entry = x.second;
+    if((entry.mask & mask) != mask) continue;
+    int best = 0;
+    for(const auto &name : entry.names) {
+      best = std::max(best, score(name, query));
+    }
+    if(best != 0) result.push_back(Result{entry.room, best});
+  }
+
+  const auto order = [](const Result &a, const Result &b) {
+    if(a.score != b.score) return a.score > b.score;
+    return a.room->id() < b.room->id();
+  };
+  const size_t n = std::min(limit, result.size());
+  std::partial_sort(result.begin(), result.begin() + n, result.end(), order);
+  result.resize(n);
+  return result;
+}
+
+}
@@ -0,0 +1,47 @@
+#ifndef NATIVE_CHAT_MATRIX_ROOM_FINDER_HPP_
+#define NATIVE_CHAT_MATRIX_ROOM_FINDER_HPP_
+
+#include <vector>
+#include <unordered_map>
+
+#include <QObject>
+#include <QString>
+
+#include "ID.hpp"
+
+namespace matrix {
+
+class Session;
+class Room;
+
+class RoomFinder : public QObject {
+  Q_OBJECT
+
+public:
+  struct Result {
+    Room *room;
+    int score;
+  };
+
+  explicit RoomFinder(Session &session, QObject *parent = nullptr);
+
+  std::vector<Result> find(const QString &query, size_t limit) const;
+  // Rooms whose name, aliases or, for direct chats, partner's name contain query as a subsequence, best first
+
+private:
+  struct Entry {
+    Room *room;
+    std::vector<QString> names; // Case-folded
+    uint64_t mask;              // Union of char_mask over names
+  };
+
+  Session &session_;
+  std::unordered_map<RoomID, Entry> rooms_;
+
+  void track(Room &room);
+  void index(Entry &entry);
+};
+
+}
+
+#endif
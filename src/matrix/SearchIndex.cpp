@@ -0,0 +1,262 @@
+#include "SearchIndex.hpp"
+
+#include <algorithm>
+#include <iterator>
+#include <utility>
+#include <cstring>
+
+#include <QTextBoundaryFinder>
+#include <QJsonDocument>
+#include <QJsonObject>
+#include <QJsonArray>
+#include <QDebug>
+
+namespace matrix {
+
+static constexpr uint64_t FORMAT_VERSION = 2;
+// Bumped whenever the layout changes; the index is rebuilt from scratch as history arrives
+
+static constexpr size_t INITIAL_MAP_SIZE = 32UL * 1024UL * 1024UL;
+// Doubled whenever it's three quarters full
+
+static constexpr int MAX_TERM_LENGTH = 64;
+// Keeps keys well under LMDB's limit. Longer words are indexed by their prefix.
+
+static constexpr int MIN_PREFIX_LENGTH = 2;
+// Shorter query words would walk a large fraction of all postings
+
+static constexpr int SNIPPET_LENGTH = 160;
+
+static const lmdb::val format_version_key("format_version");
+
+using DocID = std::pair<uint64_t, uint64_t>;
+// origin_server_ts, then a sequence number among documents sharing it. Stored big-endian so that LMDB's sort order is
+// chronological, letting searches rank by posting alone.
+
+static constexpr size_t DOC_SIZE = 2 * sizeof(uint64_t);
+
+static void encode_doc(const DocID &id, uint8_t *out) {
+  for(size_t i = 0; i < sizeof(uint64_t); ++i) {
+    out[i] = (id.first >> (8*(sizeof(uint64_t) - 1 - i))) & 0xFF;
+    out[sizeof(uint64_t) + i] = (id.second >> (8*(sizeof(uint64_t) - 1 - i))) & 0xFF;
+  }
+}
+
+static DocID decode_doc(const lmdb::val &v) {
+  DocID result{0, 0};
+  for(size_t i = 0; i < sizeof(uint64_t); ++i) {
+    result.first = (result.first << 8) | v.data<const uint8_t>()[i];
+    result.second = (result.second << 8) | v.data<const uint8_t>()[sizeof(uint64_t) + i];
+  }
+  return result;
+}
+
+SearchIndex::SearchIndex(const QString &path)
+  : env_(lmdb::env::create()), meta_(0), terms_(0), docs_(0), events_(0) {
+  env_.set_mapsize(INITIAL_MAP_SIZE);  // Or the size it has grown to, if larger
+  env_.set_max_dbs(4UL);
+  env_.open(path.toStdString().c_str());
+
+  auto txn = lmdb::txn::begin(env_);
+  meta_ = lmdb::dbi::open(txn, "meta", MDB_CREATE);
+  terms_ = lmdb::dbi::open(txn, "terms", MDB_CREATE | MDB_DUPSORT | MDB_DUPFIXED);
+  docs_ = lmdb::dbi::open(txn, "docs", MDB_CREATE);
+  events_ = lmdb::dbi::open(txn, "events", MDB_CREATE);
+  lmdb::val x;
+  if(!lmdb::dbi_get(txn, meta_, format_version_key, x) || x.size() != sizeof(FORMAT_VERSION)
+     || std::memcmp(x.data(), &FORMAT_VERSION, sizeof(FORMAT_VERSION)) != 0) {
+    qDebug() << "resetting search index due to format change";
+    lmdb::dbi_drop(txn, terms_, false);
+    lmdb::dbi_drop(txn, docs_, false);
+    lmdb::dbi_drop(txn, events_, false);
+    lmdb::dbi_put(txn, meta_, format_version_key, lmdb::val(&FORMAT_VERSION, sizeof(FORMAT_VERSION)));
+  }
+  txn.commit();
+}
+
+void SearchIndex::reserve() {
+  // Growing ahead of need means writes practically never meet MDB_MAP_FULL, which LMDB can also report from a commit,
+  // after the transaction is already gone. Must be called with no transaction open.
+  MDB_envinfo info;
+  MDB_stat stat;
+  mdb_env_info(env_.handle(), &info);
+  mdb_env_stat(env_.handle(), &stat);
+  const size_t used = (info.me_last_pgno + 1) * stat.ms_psize;
+  if(used > info.me_mapsize / 4 * 3) {
+    qDebug() << "growing search index to" << info.me_mapsize * 2 / (1024 * 1024) << "MB";
+    env_.set_mapsize(info.me_mapsize * 2);
+  }
+}
+
+void SearchIndex::add(gsl::span<const Entry> entries) {
+  if(entries.empty()) return;
+  for(unsigned attempt = 0; ; ++attempt) {
+    reserve();
+    try {
+      auto txn = lmdb::txn::begin(env_);
+      for(const auto &entry : entries) {
+        add(txn, entry.room, entry.event);
+      }
+      txn.commit();
+      return;
+    } catch(const lmdb::map_full_error &) {
+      if(attempt == 2) {
+        qWarning() << "search index full; not indexing" << entries.size() << "events";
+        return;
+      }
+      // A single batch outgrew the headroom; the aborted transaction frees its pages, and the next reserve grows
+      MDB_envinfo info;
+      mdb_env_info(env_.handle(), &info);
+      env_.set_mapsize(info.me_mapsize * 2);
+    } catch(const lmdb::error &e) {
+      qWarning() << "failed to index" << entries.size() << "events:" << e.what();
+      return;
+    }
+  }
+}
+
+std::vector<QString> SearchIndex::tokenize(const QString &text) {
+  std::vector<QString> result;
+  const QString folded = text.normalized(QString::NormalizationForm_KC).toCaseFolded();
+  QTextBoundaryFinder finder(QTextBoundaryFinder::Word, folded);
+  int start = -1;
+  for(int pos = finder.position(); pos != -1; pos = finder.toNextBoundary()) {
+    const auto reasons = finder.boundaryReasons();
+    if(start != -1 && (reasons & QTextBoundaryFinder::EndOfItem)) {
+      result.push_back(folded.mid(start, std::min(pos - start, MAX_TERM_LENGTH)));
+      start = -1;
+    }
+    if(reasons & QTextBoundaryFinder::StartOfItem) start = pos;
+  }
+  std::sort(result.begin(), result.end());
+  result.erase(std::unique(result.begin(), result.end()), result.end());
+  return result;
+}
+
+void SearchIndex::add(lmdb::txn &txn, const RoomID &room, const event::Room &e) {
+  if(e.type() == EventType("m.room.redaction")) {
+    remove(txn, EventID(e.json()["redacts"].toString()));
+    return;
+  }
+  if(e.type() != event::room::Message::tag() || e.redacted()) return;
+
+  QString body;
+  try {
+    body = event::room::Message(e).content().body();
+  } catch(const malformed_event &) {
+    return;
+  }
+  const auto terms = tokenize(body);
+  if(terms.empty()) return;
+
+  const auto id_utf8 = e.id().value().toUtf8();
+  const lmdb::val id_key(id_utf8.data(), id_utf8.size());
+  lmdb::val existing;
+  if(lmdb::dbi_get(txn, events_, id_key, existing)) return;
+
+  DocID doc{e.origin_server_ts(), 0};
+  {
+    // Follow the last document with the same timestamp, if any
+    uint8_t next_data[DOC_SIZE];
+    encode_doc(DocID{doc.first + 1, 0}, next_data);
+    auto cursor = lmdb::cursor::open(txn, docs_);
+    lmdb::val k(next_data, sizeof(next_data)), v;
+    const bool found = cursor.get(k, v, MDB_SET_RANGE) ? cursor.get(k, v, MDB_PREV) : cursor.get(k, v, MDB_LAST);
+    if(found) {
+      const auto last = decode_doc(k);
+      if(last.first == doc.first) doc.second = last.second + 1;
+    }
+  }
+  uint8_t doc_data[DOC_SIZE];
+  encode_doc(doc, doc_data);
+  const lmdb::val doc_key(doc_data, sizeof(doc_data));
+
+  QJsonArray term_list;
+  for(const auto &term : terms) {
+    term_list.push_back(term);
+  }
+  const auto data = QJsonDocument(QJsonObject{
+      {"room_id", room.value()},
+      {"event_id", e.id().value()},
+      {"sender", e.sender().value()},
+      {"snippet", body.simplified().left(SNIPPET_LENGTH)},
+      {"terms", term_list}     // So that redaction can find the document's postings
+    }).toBinaryData();
+  lmdb::dbi_put(txn, docs_, doc_key, lmdb::val(data.data(), data.size()));
+  lmdb::dbi_put(txn, events_, id_key, doc_key);
+  for(const auto &term : terms) {
+    const auto utf8 = term.toUtf8();
+    lmdb::dbi_put(txn, terms_, lmdb::val(utf8.data(), utf8.size()), doc_key);
+  }
+}
+
+void SearchIndex::remove(lmdb::txn &txn, const EventID &event) {
+  const auto id_utf8 = event.value().toUtf8();
+  const lmdb::val id_key(id_utf8.data(), id_utf8.size());
+  lmdb::val doc_key;
+  if(!lmdb::dbi_get(txn, events_, id_key, doc_key)) return;
+  uint8_t doc_data[DOC_SIZE];
+  encode_doc(decode_doc(doc_key), doc_data);  // Copy out before the map is modified
+  lmdb::val doc(doc_data, sizeof(doc_data));
+  lmdb::val data;
+  if(lmdb::dbi_get(txn, docs_, doc, data)) {
+    const auto o = QJsonDocument::fromBinaryData(QByteArray(data.data(), data.size())).object();
+    for(const auto &term : o["terms"].toArray()) {
+      const auto utf8 = term.toString().toUtf8();
+      lmdb::val key(utf8.data(), utf8.size());
+      lmdb::dbi_del(txn, terms_, key, doc);
+    }
+    lmdb::dbi_del(txn, docs_, doc, nullptr);
+  }
+  lmdb::dbi_del(txn, events_, id_key, nullptr);
+}
+
+std::vector<SearchIndex::Hit> SearchIndex::search(const QString &query, size_t limit) {
+  auto terms = tokenize(query);
+  terms.erase(std::remove_if(terms.begin(), terms.end(), [](const QString &t) { return t.size() < MIN_PREFIX_LENGTH; }),
+              terms.end());
+  if(terms.empty()) return {};
+
+  auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+
+  // Every term is treated as a prefix, so that results can be shown as the user types
+  std::vector<DocID> matches;
+  auto cursor = lmdb::cursor::open(txn, terms_);
+  for(auto term = terms.begin(); term != terms.end(); ++term) {
+    const auto prefix = term->toUtf8();
+    std::vector<DocID> docs;
+    lmdb::val k(prefix.data(), prefix.size()), v;
+    bool found = cursor.get(k, v, MDB_SET_RANGE);
+    while(found && k.size() >= static_cast<size_t>(prefix.size()) && std::equal(prefix.begin(), prefix.end(), k.data())) {
+      docs.push_back(decode_doc(v));
+      found = cursor.get(k, v, MDB_NEXT);
+    }
+    std::sort(docs.begin(), docs.end());
+    docs.erase(std::unique(docs.begin(), docs.end()), docs.end());
+    if(term == terms.begin()) {
+      matches = std::move(docs);
+    } else {
+      std::vector<DocID> both;
+      std::set_intersection(matches.begin(), matches.end(), docs.begin(), docs.end(), std::back_inserter(both));
+      matches = std::move(both);
+    }
+    if(matches.empty()) return {};
+  }
+  cursor.close();
+
+  // Document IDs are chronological, so only the hits that will be returned need to be looked up
+  std::vector<Hit> result;
+  for(auto doc = matches.rbegin(); doc != matches.rend() && result.size() < limit; ++doc) {
+    uint8_t doc_data[DOC_SIZE];
+    encode_doc(*doc, doc_data);
+    lmdb::val data;
+    if(!lmdb::dbi_get(txn, docs_, lmdb::val(doc_data, sizeof(doc_data)), data)) continue;
+    const auto o = QJsonDocument::fromBinaryData(QByteArray(data.data(), data.size())).object();
+    result.push_back(Hit{RoomID(o["room_id"].toString()), EventID(o["event_id"].toString()), UserID(o["sender"].toString()),
+                         doc->first, o["snippet"].toString()});
+  }
+  txn.abort();
+  return result;
+}
+
+}
@@ -0,0 +1,58 @@
+#ifndef NATIVE_CHAT_MATRIX_SEARCH_INDEX_HPP_
+#define NATIVE_CHAT_MATRIX_SEARCH_INDEX_HPP_
+
+#include <vector>
+
+#include <QString>
+
+#include <lmdb++.h>
+#include <span.h>
+
+#include "ID.hpp"
+#include "Event.hpp"
+
+namespace matrix {
+
+class SearchIndex {
+public:
+  struct Hit {
+    RoomID room;
+    EventID event;
+    UserID sender;
+    uint64_t origin_server_ts;
+    QString snippet;            // Start of the body, whitespace simplified
+  };
+
+  struct Entry {
+    RoomID room;
+    event::Room event;
+  };
+
+  explicit SearchIndex(const QString &path);
+  // Opens the index in the existing directory at path. It has an LMDB environment of its own, grown as it fills, so
+  // that indexing can neither exhaust the cache's map nor make a sync fail.
+
+  void add(gsl::span<const Entry> entries);
+  // Indexes message bodies and removes redacted messages, in one transaction. Events that have already been indexed are
+  // ignored. Only the start of each body is kept, enough to list a hit; the rest is in the room or on the server.
+  // Failures are logged rather than thrown, since the index can always be rebuilt from history.
+
+  std::vector<Hit> search(const QString &query, size_t limit);
+  // Finds messages with a word beginning with each word of query, most recent first. Words too short to narrow the
+  // search usefully are ignored.
+
+  static std::vector<QString> tokenize(const QString &text);
+  // Case-folded words, deduplicated
+
+private:
+  lmdb::env env_;
+  lmdb::dbi meta_, terms_, docs_, events_;
+
+  void reserve();
+  void add(lmdb::txn &txn, const RoomID &room, const event::Room &event);
+  void remove(lmdb::txn &txn, const EventID &event);
+};
+
+}
+
+#endif
@@ -1,27 +1,48 @@
 #include "Session.hpp"
 
 #include <stdexcept>
+#include <algorithm>
 
 #include <QtNetwork>
 #include <QTimer>
+#include <QEventLoop>
 #include <QUrl>
+#include <QElapsedTimer>
+#include <QtConcurrent>
 
 #include "utils.hpp"
 #include "Matrix.hpp"
 #include "proto.hpp"
+#include "Trace.hpp"
 
 namespace matrix {
 
-constexpr uint64_t CACHE_FORMAT_VERSION = 2;
+constexpr uint64_t CACHE_FORMAT_VERSION = 6;
 // Bumped every time a backwards-incompatible format change is made, a
 // corruption bug is fixed, or a previously ignored class of state is
 // persisted
 
 static constexpr char POLL_TIMEOUT_MS[] = "50000";
 
+static constexpr qint64 DOWNLOAD_CHUNK_SIZE = 64 * 1024;
+// Upper bound on buffered data per streaming download, regardless of content size
+
+static constexpr unsigned DOWNLOAD_RETRIES = 5;
+
+static constexpr int DOWNLOAD_RETRY_DELAY_MS = 500;
+// Before the first retry of a download; doubled for each one after
+
+static constexpr int THUMBNAIL_CACHE_SIZE = 16 * 1024 * 1024;
+// Bytes of thumbnail data kept in memory
+
+static constexpr int EXIT_RECEIPT_TIMEOUT_MS = 1000;
+// Longest we'll delay quitting so that read receipts reach the server
+
 static const lmdb::val next_batch_key("next_batch");
 static const lmdb::val transaction_id_key("transaction_id");
 static const lmdb::val cache_format_version_key("cache_format_version");
+static const lmdb::val push_rules_key("push_rules");
+static const lmdb::val layout_key("layout");
 
 template<typename T, typename = std::enable_if_t<std::is_integral<T>::value>>
 constexpr T from_little_endian(const uint8_t *x) {
@@ -39,12 +60,23 @@ constexpr void to_little_endian(T v, uint8_t *x) {
   }
 }
 
+template<typename T, typename = std::enable_if_t<std::is_integral<T>::value>>
+constexpr void to_big_endian(T v, uint8_t *x) {
+  for(size_t i = 0; i < sizeof(T); ++i) {
+    x[i] = (v >> (8*(sizeof(T) - 1 - i))) & 0xFF;
+  }
+}
+
+static QString user_dir(QStandardPaths::StandardLocation location, const UserID &user_id) {
+  return QStandardPaths::writableLocation(location) % "/" % QString::fromUtf8(user_id.value().toUtf8().toHex());
+}
+
 std::unique_ptr<Session> Session::create(Matrix& universe, QUrl homeserver, UserID user_id, QString access_token) {
   auto env = lmdb::env::create();
   env.set_mapsize(128UL * 1024UL * 1024UL);  // 128MB should be enough for anyone!
-  env.set_max_dbs(1024UL);                   // maximum rooms plus two
+  env.set_max_dbs(1024UL);                   // maximum rooms, plus state and rooms
 
-  QString state_path = QStandardPaths::writableLocation(QStandardPaths::CacheLocation) % "/" % QString::fromUtf8(user_id.value().toUtf8().toHex() % "/state");
+  QString state_path = user_dir(QStandardPaths::CacheLocation, user_id) % "/state";
   bool fresh = !QFile::exists(state_path);
   if(!QDir().mkpath(state_path)) {
     throw std::runtime_error(("unable to create state directory at " + state_path).toStdString().c_str());
@@ -64,6 +96,12 @@ std::unique_ptr<Session> Session::create(Matrix& universe, QUrl homeserver, User
     env.open(state_path.toStdString().c_str());
   }
 
+  QString search_path = user_dir(QStandardPaths::CacheLocation, user_id) % "/search";
+  if(!QDir().mkpath(search_path)) {
+    throw std::runtime_error(("unable to create search index directory at " + search_path).toStdString().c_str());
+  }
+  SearchIndex search_index(search_path);
+
   auto txn = lmdb::txn::begin(env);
   auto state_db = lmdb::dbi::open(txn, "state", MDB_CREATE);
   auto room_db = lmdb::dbi::open(txn, "rooms", MDB_CREATE);
@@ -78,6 +116,16 @@ std::unique_ptr<Session> Session::create(Matrix& universe, QUrl homeserver, User
       qDebug() << "resetting cache due to breaking changes or fixes";
       lmdb::dbi_drop(txn, state_db, false);
       lmdb::dbi_drop(txn, room_db, false);
+      const std::pair<const char *, unsigned> legacy_dbs[] = {
+        {"search.terms", MDB_DUPSORT | MDB_DUPFIXED}, {"search.docs", 0}, {"search.events", 0}
+      };
+      for(const auto &db : legacy_dbs) {
+        // Left behind by versions that kept the search index in the cache
+        try {
+          auto legacy = lmdb::dbi::open(txn, db.first, db.second);
+          lmdb::dbi_drop(txn, legacy, true);
+        } catch(const lmdb::not_found_error &) {}
+      }
       fresh = true;
     }
   }
@@ -89,37 +137,86 @@ std::unique_ptr<Session> Session::create(Matrix& universe, QUrl homeserver, User
     lmdb::dbi_put(txn, state_db, cache_format_version_key, val);
   }
 
+  // Unlike the cache, this must never be reset
+  auto data_env = lmdb::env::create();
+  data_env.set_mapsize(16UL * 1024UL * 1024UL);
+  data_env.set_max_dbs(8UL);
+  QString data_path = user_dir(QStandardPaths::AppDataLocation, user_id) % "/data";
+  if(!QDir().mkpath(data_path)) {
+    throw std::runtime_error(("unable to create data directory at " + data_path).toStdString().c_str());
+  }
+  data_env.open(data_path.toStdString().c_str());
+
+  auto data_txn = lmdb::txn::begin(data_env);
+  auto data_db = lmdb::dbi::open(data_txn, "data", MDB_CREATE);
+  auto outbox_db = lmdb::dbi::open(data_txn, "outbox", MDB_CREATE);
+
+  {
+    // Transaction IDs used to live in the cache; carry on from there so we don't reuse any
+    lmdb::val x;
+    if(!lmdb::dbi_get(data_txn, data_db, transaction_id_key, x) && lmdb::dbi_get(txn, state_db, transaction_id_key, x)) {
+      lmdb::dbi_put(data_txn, data_db, transaction_id_key, x);
+    }
+  }
+
+  data_txn.commit();
   txn.commit();
 
   return std::make_unique<Session>(universe, std::move(homeserver), std::move(user_id), std::move(access_token),
-                                   std::move(env), std::move(state_db), std::move(room_db));
+                                   std::move(env), std::move(state_db), std::move(room_db), std::move(search_index),
+                                   std::move(data_env), std::move(data_db), std::move(outbox_db));
 }
 
 static std::string room_dbname(const RoomID &room_id) { return ("r." + room_id.value()).toStdString(); }
 
+static QJsonObject decode_room(const QByteArray &data) {
+  return QJsonDocument::fromBinaryData(data).object();
+}
+
 Session::Session(Matrix& universe, QUrl homeserver, UserID user_id, QString access_token,
-                 lmdb::env &&env, lmdb::dbi &&state_db, lmdb::dbi &&room_db)
+                 lmdb::env &&env, lmdb::dbi &&state_db, lmdb::dbi &&room_db, SearchIndex &&search_index,
+                 lmdb::env &&data_env, lmdb::dbi &&data_db, lmdb::dbi &&outbox_db)
     : universe_(universe), homeserver_(homeserver), user_id_(user_id), access_token_(access_token),
       env_(std::move(env)), state_db_(std::move(state_db)), room_db_(std::move(room_db)),
-      buffer_size_(50), synced_(false) {
+      search_index_(std::move(search_index)), push_rules_(user_id_),
+      data_env_(std::move(data_env)), data_db_(std::move(data_db)), outbox_db_(std::move(outbox_db)),
+      buffer_size_(50), synced_(false), thumbnails_(THUMBNAIL_CACHE_SIZE) {
   {
     auto txn = lmdb::txn::begin(env_, nullptr, MDB_RDONLY);
+    lmdb::val stored_rules;
+    if(lmdb::dbi_get(txn, state_db_, push_rules_key, stored_rules)) {
+      push_rules_ = PushRules(QJsonDocument::fromBinaryData(QByteArray(stored_rules.data(), stored_rules.size())).object());
+    }
     lmdb::val stored_batch;
     if(lmdb::dbi_get(txn, state_db_, next_batch_key, stored_batch)) {
       next_batch_ = SyncCursor{QString::fromUtf8(stored_batch.data(), stored_batch.size())};
       qDebug() << "resuming from" << next_batch_->value();
 
+      QElapsedTimer timer;
+      timer.start();
       lmdb::val room;
       lmdb::val state;
+      std::vector<RoomID> ids;
+      QVector<QByteArray> blobs;
       auto cursor = lmdb::cursor::open(txn, room_db_);
       while(cursor.get(room, state, MDB_NEXT)) {
-        auto id = RoomID(QString::fromUtf8(room.data(), room.size()));
+        ids.emplace_back(QString::fromUtf8(room.data(), room.size()));
+        blobs.push_back(QByteArray(state.data(), state.size()));
+      }
+      cursor.close();
+      // Decoding dominates hydration and is independent per room. Rooms themselves are QObjects using this
+      // transaction, so they're still constructed here.
+      const QVector<QJsonObject> decoded = QtConcurrent::blockingMapped(blobs, decode_room);
+      blobs.clear();
+      rooms_.reserve(ids.size());
+      for(size_t i = 0; i < ids.size(); ++i) {
+        const auto &id = ids[i];
         rooms_.emplace(std::piecewise_construct,
                        std::forward_as_tuple(id),
-                       std::forward_as_tuple(universe_, *this, id,
-                                             QJsonDocument::fromBinaryData(QByteArray(state.data(), state.size())).object(),
+                       std::forward_as_tuple(universe_, *this, id, decoded[i],
                                              env_, txn, lmdb::dbi::open(txn, room_dbname(id).c_str())));
       }
+      qDebug() << "hydrated" << ids.size() << "rooms in" << timer.elapsed() << "ms";
     } else {
       qDebug() << "starting from scratch";
     }
@@ -129,15 +226,42 @@ Session::Session(Matrix& universe, QUrl homeserver, UserID user_id, QString acce
   sync_retry_timer_.setSingleShot(true);
   connect(&sync_retry_timer_, &QTimer::timeout, this, static_cast<void (Session::*)()>(&Session::sync));
 
-  QUrlQuery query;
-  query.addQueryItem("filter", encode({
+  if(auto app = QCoreApplication::instance()) {
+    connect(app, &QCoreApplication::aboutToQuit, this, &Session::flush_read_receipts);
+  }
+
+  resume_query_.addQueryItem("filter", encode({
         {"room", QJsonObject{
             {"timeline", QJsonObject{
                 {"limit", static_cast<int>(buffer_size_)}
               }},
           }}
       }));
-  sync(query);
+  // Deferred so the session can be put offline first
+  QTimer::singleShot(0, this, [this]() {
+      if(!offline_) sync(resume_query_);
+    });
+}
+
+void Session::set_offline(bool offline) {
+  if(offline == offline_) return;
+  offline_ = offline;
+  if(offline_) {
+    sync_retry_timer_.stop();
+    if(sync_reply_) {
+      sync_reply_->disconnect(this);
+      sync_reply_->abort();
+      sync_reply_ = nullptr;
+    }
+    if(synced_) {
+      synced_ = false;
+      synced_changed();
+    }
+  } else {
+    catching_up_ = true;
+    sync(resume_query_);
+  }
+  offline_changed();
 }
 
 void Session::sync() {
@@ -152,12 +276,15 @@ void Session::sync(QUrlQuery query) {
     query.addQueryItem("since", next_batch_->value());
     query.addQueryItem("timeout", POLL_TIMEOUT_MS);
   }
+  sync_sent_.start();
   sync_reply_ = get("client/r0/sync", query);
   connect(sync_reply_, &QNetworkReply::finished, this, &Session::handle_sync_reply);
   connect(sync_reply_, &QNetworkReply::downloadProgress, this, &Session::sync_progress);
 }
 
 void Session::handle_sync_reply() {
+  const std::chrono::nanoseconds round_trip{sync_sent_.nsecsElapsed()};
+  TRACE_OPERATION("Session::handle_sync_reply");
   sync_progress(0, 0);
   if(sync_reply_->size() > (1 << 12)) {
     qDebug() << "sync is" << sync_reply_->size() << "bytes";
@@ -165,7 +292,11 @@ void Session::handle_sync_reply() {
 
   using namespace std::chrono_literals;
 
+  const qint64 bytes = sync_reply_->bytesAvailable();
+  QElapsedTimer timer;
+  timer.start();
   auto r = decode(sync_reply_);
+  const std::chrono::nanoseconds decoded{timer.nsecsElapsed()};
   bool was_synced = synced_;
   if(r.error) {
     synced_ = false;
@@ -173,20 +304,10 @@ void Session::handle_sync_reply() {
   } else {
     auto current_batch = next_batch_;
     try {
-      auto s = parse_sync(r.object);
-      auto txn = lmdb::txn::begin(env_);
-      active_txn_ = &txn;
-      try {
-        auto batch_utf8 = s.next_batch.value().toUtf8();
-        lmdb::dbi_put(txn, state_db_, next_batch_key, lmdb::val(batch_utf8.data(), batch_utf8.size()));
-        next_batch_ = s.next_batch;
-        dispatch(txn, std::move(s));
-        txn.commit();
-      } catch(...) {
-        active_txn_ = nullptr;
-        throw;
-      }
-      active_txn_ = nullptr;
+      apply_sync(r.object);
+      sync_stats_.round_trip += round_trip;
+      sync_stats_.bytes += bytes;
+      sync_stats_.parse += decoded;
       synced_ = true;
     } catch(lmdb::runtime_error &e) {
       synced_ = false;
@@ -194,8 +315,17 @@ void Session::handle_sync_reply() {
       error(e.what());
     }
   }
+  sync_reply_ = nullptr;
   if(was_synced != synced_) synced_changed();
 
+  if(synced_ && catching_up_) {
+    catching_up_ = false;
+    for(auto &room : rooms_) {
+      room.second.transmit_event();
+      room.second.flush_read_receipt();
+    }
+  }
+
   auto now = std::chrono::steady_clock::now();
   constexpr std::chrono::steady_clock::duration RETRY_INTERVAL = 10s;
   auto since_last_error = now - last_sync_error_;
@@ -210,8 +340,53 @@ void Session::handle_sync_reply() {
   }
 }
 
+void Session::apply_sync(const QJsonObject &response) {
+  QElapsedTimer timer;
+  timer.start();
+  auto s = parse_sync(response);
+  const std::chrono::nanoseconds parsed{timer.nsecsElapsed()};
+  auto txn = lmdb::txn::begin(env_);
+  active_txn_ = &txn;
+  try {
+    auto batch_utf8 = s.next_batch.value().toUtf8();
+    lmdb::dbi_put(txn, state_db_, next_batch_key, lmdb::val(batch_utf8.data(), batch_utf8.size()));
+    next_batch_ = s.next_batch;
+    dispatch(txn, std::move(s));
+    const std::chrono::nanoseconds dispatched{timer.nsecsElapsed()};
+    {
+      TRACE_OPERATION("lmdb commit", "sync");
+      txn.commit();
+    }
+    sync_stats_.syncs += 1;
+    sync_stats_.parse += parsed;
+    sync_stats_.dispatch += dispatched - parsed;
+    sync_stats_.commit += std::chrono::nanoseconds{timer.nsecsElapsed()} - dispatched;
+    active_txn_ = nullptr;
+    {
+      TRACE_OPERATION("search index", "sync");
+      search_index_.add(unindexed_);
+    }
+    unindexed_.clear();
+  } catch(...) {
+    active_txn_ = nullptr;
+    unindexed_.clear();
+    throw;
+  }
+  active_txn_ = nullptr;
+}
+
 void Session::dispatch(lmdb::txn &txn, proto::Sync sync) {
+  TRACE_OPERATION("Session::dispatch");
   // TODO: Exception-safety: copy all room states, update and them and db, commit, swap copy/orig, emit signals
+  for(const auto &evt : sync.account_data.events) {
+    if(evt.type() != EventType("m.push_rules")) continue;
+    // Must precede room dispatch, so that new events are evaluated against the rules in effect
+    const auto global = evt.content().json()["global"].toObject();
+    push_rules_ = PushRules(global);
+    const auto data = QJsonDocument(global).toBinaryData();
+    lmdb::dbi_put(txn, state_db_, push_rules_key, lmdb::val(data.data(), data.size()));
+    push_rules_changed();
+  }
   for(auto &joined_room : sync.rooms.join) {
     auto it = rooms_.find(joined_room.id);
     bool new_room = false;
@@ -240,6 +415,24 @@ void Session::cache_state(lmdb::txn &txn, const Room &room) {
   lmdb::dbi_put(txn, room_db_, lmdb::val(utf8.data(), utf8.size()), lmdb::val(data.data(), data.size()));
 }
 
+void Session::flush_read_receipts() {
+  QEventLoop loop;
+  size_t outstanding = 0;
+  auto done = [&]() {
+    if(--outstanding == 0) loop.quit();
+  };
+  for(auto &room : rooms_) {
+    if(auto send = room.second.flush_read_receipt()) {
+      ++outstanding;
+      connect(send, &EventSend::finished, &loop, done);
+      connect(send, &EventSend::error, &loop, done);
+    }
+  }
+  if(outstanding == 0) return;
+  QTimer::singleShot(EXIT_RECEIPT_TIMEOUT_MS, &loop, &QEventLoop::quit);
+  loop.exec();
+}
+
 void Session::log_out() {
   auto reply = post("client/r0/logout", {});
   connect(reply, &QNetworkReply::finished, [this, reply](){
@@ -263,10 +456,13 @@ std::vector<Room *> Session::rooms() {
 QNetworkRequest Session::request(const QString &path, QUrlQuery query, const QString &content_type) {
   QUrl url(homeserver_);
   url.setPath("/_matrix/" + path, QUrl::StrictMode);
-  query.addQueryItem("access_token", access_token_);
   url.setQuery(query);
   QNetworkRequest req(url);
   req.setHeader(QNetworkRequest::ContentTypeHeader, content_type);
+  // In a header rather than the query, so that cached URLs are stable across logins and don't carry it
+  req.setRawHeader("Authorization", "Bearer " + access_token_.toUtf8());
+  // Only media is worth keeping; see get_media
+  req.setAttribute(QNetworkRequest::CacheSaveControlAttribute, false);
   return req;
 }
 
@@ -276,6 +472,16 @@ QNetworkReply *Session::get(const QString &path, QUrlQuery query) {
   return reply;
 }
 
+QNetworkReply *Session::get_media(const QString &path, QUrlQuery query) {
+  auto req = request(path, query);
+  req.setAttribute(QNetworkRequest::CacheSaveControlAttribute, true);
+  req.setAttribute(QNetworkRequest::CacheLoadControlAttribute,
+                   offline_ ? QNetworkRequest::AlwaysCache : QNetworkRequest::PreferCache);
+  auto reply = universe_.net.get(req);
+  connect(reply, &QNetworkReply::finished, reply, &QObject::deleteLater);
+  return reply;
+}
+
 QNetworkReply *Session::post(const QString &path, QJsonObject body, QUrlQuery query) {
   auto reply = universe_.net.post(request(path, query), encode(body));
   connect(reply, &QNetworkReply::finished, reply, &QObject::deleteLater);
@@ -289,7 +495,7 @@ QNetworkReply *Session::put(const QString &path, QJsonObject body) {
 }
 
 ContentFetch *Session::get(const Content &content) {
-  auto reply = get("media/r0/download/" % content.host() % "/" % content.id());
+  auto reply = get_media("media/r0/download/" % content.host() % "/" % content.id());
   auto result = new ContentFetch(reply);
   connect(reply, &QNetworkReply::finished, [content, reply, result]() {
       if(reply->error()) {
@@ -305,32 +511,175 @@ ContentFetch *Session::get(const Content &content) {
 }
 
 ContentFetch *Session::get_thumbnail(const Content &content, const QSize &size, ThumbnailMethod method) {
+  const QString key = content.url().toString() % "@" % QString::number(size.width()) % "x" % QString::number(size.height())
+    % (method == ThumbnailMethod::SCALE ? "s" : "c");
+  if(auto cached = thumbnails_.object(key)) {
+    // Complete asynchronously like a real request, so the caller can connect first
+    auto result = new ContentFetch(this);
+    const CachedContent copy = *cached;
+    QTimer::singleShot(0, result, [content, result, copy]() {
+        result->finished(content, copy.type, copy.disposition, copy.data);
+        result->deleteLater();
+      });
+    return result;
+  }
+  auto pending = thumbnail_fetches_.find(key);
+  if(pending != thumbnail_fetches_.end()) {
+    auto result = new ContentFetch(pending->second);
+    connect(pending->second, &ContentFetch::finished, result, &ContentFetch::finished);
+    connect(pending->second, &ContentFetch::error, result, &ContentFetch::error);
+    return result;
+  }
+
   QUrlQuery query;
-  query.addQueryItem("access_token", access_token_);
   query.addQueryItem("width", QString::number(size.width()));
   query.addQueryItem("height", QString::number(size.height()));
   query.addQueryItem("method", method == ThumbnailMethod::SCALE ? "scale" : "crop");
-  auto reply = get("media/r0/thumbnail/" % content.host() % "/" % content.id(), query);
+  auto reply = get_media("media/r0/thumbnail/" % content.host() % "/" % content.id(), query);
   auto result = new ContentFetch(reply);
-  connect(reply, &QNetworkReply::finished, [content, reply, result]() {
+  thumbnail_fetches_.emplace(key, result);
+  connect(reply, &QNetworkReply::finished, this, [this, key, content, reply, result]() {
+      thumbnail_fetches_.erase(key);
       if(reply->error()) {
         result->error(reply->errorString());
       } else {
-        result->finished(content,
-                         reply->header(QNetworkRequest::ContentTypeHeader).toString(),
-                         reply->header(QNetworkRequest::ContentDispositionHeader).toString(),
-                         reply->readAll());
+        auto entry = new CachedContent{reply->header(QNetworkRequest::ContentTypeHeader).toString(),
+                                       reply->header(QNetworkRequest::ContentDispositionHeader).toString(),
+                                       reply->readAll()};
+        const CachedContent copy = *entry;  // The cache may evict entry at once
+        thumbnails_.insert(key, entry, entry->data.size());
+        result->finished(content, copy.type, copy.disposition, copy.data);
       }
     });
   return result;
 }
 
+ContentDownload *Session::download(const Content &content, QIODevice &sink, qint64 offset) {
+  auto result = new ContentDownload(content, sink, this);
+  result->received_ = offset;
+  download_from(result);
+  return result;
+}
+
+void Session::download_from(ContentDownload *dl) {
+  auto req = request("media/r0/download/" % dl->content_.host() % "/" % dl->content_.id());
+  if(dl->received_ != 0) {
+    req.setRawHeader("Range", "bytes=" + QByteArray::number(dl->received_) + "-");
+  }
+  auto reply = universe_.net.get(req);
+  reply->setReadBufferSize(DOWNLOAD_CHUNK_SIZE);
+  dl->reply_ = reply;
+  dl->request_offset_ = dl->received_;
+
+  // Discards what the sink has received so that the download can start over; on failure, reports the error and
+  // returns false
+  auto rewind = [](ContentDownload *dl) {
+    auto sink = dl->sink_.data();
+    if(!sink || sink->isSequential() || !sink->seek(0)) {
+      dl->error(tr("server does not support resuming downloads"));
+      dl->deleteLater();
+      return false;
+    }
+    if(auto file = qobject_cast<QFileDevice *>(sink)) file->resize(0);
+    dl->received_ = 0;
+    dl->request_offset_ = 0;
+    return true;
+  };
+
+  connect(reply, &QNetworkReply::metaDataChanged, dl, [dl, reply, rewind]() {
+      if(dl->reply_ != reply || dl->request_offset_ == 0) return;
+      if(reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt() != 200) return;
+      // Server ignored our range, so we're getting the whole thing again
+      if(!rewind(dl)) {
+        dl->reply_ = nullptr;
+        reply->abort();
+      }
+    });
+  connect(reply, &QNetworkReply::readyRead, dl, [this, dl, reply]() {
+      if(dl->reply_ == reply) drain_download(dl);
+    });
+  connect(reply, &QNetworkReply::downloadProgress, dl, [dl, reply](qint64 received, qint64 total) {
+      if(dl->reply_ != reply) return;
+      dl->progress(dl->request_offset_ + received, total < 0 ? total : dl->request_offset_ + total);
+    });
+  connect(reply, &QNetworkReply::finished, dl, [this, dl, reply, rewind]() {
+      reply->deleteLater();
+      if(dl->reply_ != reply) return;  // Abandoned
+      if(!drain_download(dl)) return;
+      dl->reply_ = nullptr;
+
+      const auto code = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+      if(!reply->error() && (code == 200 || code == 206)) {
+        dl->finished(dl->content_,
+                     reply->header(QNetworkRequest::ContentTypeHeader).toString(),
+                     reply->header(QNetworkRequest::ContentDispositionHeader).toString());
+        dl->deleteLater();
+        return;
+      }
+
+      if(code == 416 && dl->request_offset_ != 0) {
+        // Range not satisfiable: we asked to resume at or past the end
+        const QByteArray range = reply->rawHeader("Content-Range");
+        bool ok = false;
+        const qint64 total = range.startsWith("bytes */") ? range.mid(8).toLongLong(&ok) : -1;
+        if(ok && total == dl->received_) {
+          // Everything arrived before the connection failed
+          dl->finished(dl->content_, QString(), QString());
+          dl->deleteLater();
+          return;
+        }
+        // The content isn't what we were resuming, so fetch all of it
+        qDebug() << "restarting download of" << dl->content_.url().toString() << "from byte 0: server rejected range";
+        if(rewind(dl)) download_from(dl);
+        return;
+      }
+
+      if(reply->error() < QNetworkReply::ProxyConnectionRefusedError && reply->error() != QNetworkReply::OperationCanceledError
+         && dl->retries_ < DOWNLOAD_RETRIES) {
+        // Network-layer failure; pick up where we left off once the backoff expires
+        const int delay = DOWNLOAD_RETRY_DELAY_MS << dl->retries_;
+        ++dl->retries_;
+        qDebug() << "resuming download of" << dl->content_.url().toString() << "at byte" << dl->received_
+                 << "in" << delay << "ms due to error:" << reply->errorString();
+        QTimer::singleShot(delay, dl, [this, dl]() { download_from(dl); });
+        return;
+      }
+
+      if(code != 0) {
+        auto r = decode(reply);
+        dl->error(r.error ? *r.error : reply->errorString());
+      } else {
+        dl->error(reply->errorString());
+      }
+      dl->deleteLater();
+    });
+}
+
+bool Session::drain_download(ContentDownload *dl) {
+  auto reply = dl->reply_;
+  const auto code = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
+  if(code != 200 && code != 206) return true;  // Leave error bodies for decode
+  while(reply->bytesAvailable() > 0) {
+    const QByteArray chunk = reply->read(DOWNLOAD_CHUNK_SIZE);
+    if(!dl->sink_ || dl->sink_->write(chunk) != chunk.size()) {
+      const QString msg = dl->sink_ ? dl->sink_->errorString() : tr("output closed");
+      dl->reply_ = nullptr;
+      reply->abort();
+      dl->error(msg);
+      dl->deleteLater();
+      return false;
+    }
+    dl->received_ += chunk.size();
+  }
+  return true;
+}
+
 QString Session::get_transaction_id() {
-  auto txn = lmdb::txn::begin(env_);
+  auto txn = lmdb::txn::begin(data_env_);
 
   uint64_t value;
   lmdb::val x;
-  if(lmdb::dbi_get(txn, state_db_, transaction_id_key, x)) {
+  if(lmdb::dbi_get(txn, data_db_, transaction_id_key, x)) {
     value = from_little_endian<uint64_t>(x.data<const uint8_t>());
   } else {
     value = 0;
@@ -339,13 +688,79 @@ QString Session::get_transaction_id() {
   uint8_t data[8];
   to_little_endian(value + 1, data);
   lmdb::val y(data, sizeof(data));
-  lmdb::dbi_put(txn, state_db_, transaction_id_key, y);
+  lmdb::dbi_put(txn, data_db_, transaction_id_key, y);
 
   txn.commit();
 
   return QString::number(value, 36);
 }
 
+static QByteArray outbox_prefix(const RoomID &room) {
+  return room.value().toUtf8() + '\0';
+}
+
+static QByteArray outbox_key(const RoomID &room, const QString &transaction_id) {
+  // Big-endian so that a room's events sort in the order they were queued
+  uint8_t counter[8];
+  to_big_endian(transaction_id.toULongLong(nullptr, 36), counter);
+  return outbox_prefix(room) + QByteArray(reinterpret_cast<const char *>(counter), sizeof(counter));
+}
+
+void Session::store_pending(const RoomID &room, const Room::PendingEvent &event) {
+  auto key = outbox_key(room, event.transaction_id);
+  auto data = QJsonDocument(QJsonObject{
+      {"type", event.type},
+      {"content", event.content},
+      {"transaction_id", event.transaction_id}
+    }).toBinaryData();
+  auto txn = lmdb::txn::begin(data_env_);
+  lmdb::dbi_put(txn, outbox_db_, lmdb::val(key.data(), key.size()), lmdb::val(data.data(), data.size()));
+  txn.commit();
+}
+
+void Session::discard_pending(const RoomID &room, const QString &transaction_id) {
+  auto key = outbox_key(room, transaction_id);
+  auto txn = lmdb::txn::begin(data_env_);
+  lmdb::dbi_del(txn, outbox_db_, lmdb::val(key.data(), key.size()), nullptr);
+  txn.commit();
+}
+
+std::vector<Room::PendingEvent> Session::load_pending(const RoomID &room) {
+  std::vector<Room::PendingEvent> result;
+  const auto prefix = outbox_prefix(room);
+  auto txn = lmdb::txn::begin(data_env_, nullptr, MDB_RDONLY);
+  auto cursor = lmdb::cursor::open(txn, outbox_db_);
+  lmdb::val key(prefix.data(), prefix.size()), value;
+  bool found = cursor.get(key, value, MDB_SET_RANGE);
+  while(found && key.size() > static_cast<size_t>(prefix.size())
+        && std::equal(prefix.begin(), prefix.end(), key.data())) {
+    auto o = QJsonDocument::fromBinaryData(QByteArray(value.data(), value.size())).object();
+    result.push_back({o["type"].toString(), o["content"].toObject(), o["transaction_id"].toString()});
+    found = cursor.get(key, value, MDB_NEXT);
+  }
+  cursor.close();
+  txn.commit();
+  return result;
+}
+
+void Session::store_layout(const QJsonObject &layout) {
+  auto data = QJsonDocument(layout).toBinaryData();
+  auto txn = lmdb::txn::begin(data_env_);
+  lmdb::dbi_put(txn, data_db_, layout_key, lmdb::val(data.data(), data.size()));
+  txn.commit();
+}
+
+QJsonObject Session::load_layout() {
+  auto txn = lmdb::txn::begin(data_env_, nullptr, MDB_RDONLY);
+  lmdb::val data;
+  QJsonObject result;
+  if(lmdb::dbi_get(txn, data_db_, layout_key, data)) {
+    result = QJsonDocument::fromBinaryData(QByteArray(data.data(), data.size())).object();
+  }
+  txn.commit();
+  return result;
+}
+
 JoinRequest *Session::join(const QString &id_or_alias) {
   auto reply = post("client/r0/join/" + QUrl::toPercentEncoding(id_or_alias), {});
   auto req = new JoinRequest(reply);
@@ -371,9 +786,26 @@ void Session::cache_state(const Room &room) {
   if(active_txn_) return;       // State will be cached after sync processing completes
   auto txn = lmdb::txn::begin(env_);
   cache_state(txn, room);
+  TRACE_OPERATION("lmdb commit", "state");
   txn.commit();
 }
 
+void Session::index(const RoomID &room, gsl::span<const event::Room> events) {
+  if(active_txn_) {
+    for(const auto &e : events) unindexed_.push_back(SearchIndex::Entry{room, e});
+    return;
+  }
+  std::vector<SearchIndex::Entry> entries;
+  entries.reserve(events.size());
+  for(const auto &e : events) entries.push_back(SearchIndex::Entry{room, e});
+  TRACE_OPERATION("search index", room.value());
+  search_index_.add(entries);
+}
+
+std::vector<SearchIndex::Hit> Session::search(const QString &query, size_t limit) {
+  return search_index_.search(query, limit);
+}
+
 ContentPost *Session::upload(QIODevice &data, const QString &content_type, const QString &filename) {
   QUrlQuery query;
   query.addQueryItem("filename", filename);
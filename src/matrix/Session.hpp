@@ -10,6 +10,10 @@
 #include <QString>
 #include <QUrlQuery>
 #include <QTimer>
+#include <QElapsedTimer>
+#include <QPointer>
+#include <QCache>
+#include <QIODevice>
 
 #include <lmdb++.h>
 
@@ -17,10 +21,11 @@
 
 #include "Room.hpp"
 #include "Content.hpp"
+#include "SearchIndex.hpp"
+#include "PushRules.hpp"
 
 class QNetworkRequest;
 class QNetworkReply;
-class QIODevice;
 
 namespace matrix {
 
@@ -52,6 +57,35 @@ signals:
   void error(const QString &msg);
 };
 
+class ContentDownload : public QObject {
+  Q_OBJECT
+
+public:
+  ContentDownload(const Content &content, QIODevice &sink, QObject *parent = nullptr)
+    : QObject(parent), content_(content), sink_(&sink) {}
+
+  const Content &content() const { return content_; }
+
+  qint64 received() const { return received_; }
+  // Bytes of content written to the sink so far. Pass to Session::download to resume after an error.
+
+signals:
+  void finished(const Content &content, const QString &type, const QString &disposition);
+  // type and disposition are empty if a resumed download turned out to have already been complete
+  void progress(qint64 received, qint64 total);
+  void error(const QString &msg);
+
+private:
+  friend class Session;
+
+  Content content_;
+  QPointer<QIODevice> sink_;
+  QNetworkReply *reply_ = nullptr;
+  qint64 received_ = 0;
+  qint64 request_offset_ = 0;  // Value of received_ when reply_ was issued
+  unsigned retries_ = 0;
+};
+
 class ContentPost : public QObject {
   Q_OBJECT
 
@@ -71,7 +105,8 @@ class Session : public QObject {
 
 public:
   Session(Matrix& universe, QUrl homeserver, UserID user_id, QString access_token,
-          lmdb::env &&env, lmdb::dbi &&state_db, lmdb::dbi &&room_db);
+          lmdb::env &&env, lmdb::dbi &&state_db, lmdb::dbi &&room_db, SearchIndex &&search_index,
+          lmdb::env &&data_env, lmdb::dbi &&data_db, lmdb::dbi &&outbox_db);
 
   static std::unique_ptr<Session> create(Matrix& universe, QUrl homeserver, UserID user_id, QString access_token);
 
@@ -85,6 +120,13 @@ public:
   void log_out();
 
   bool synced() const { return synced_; }
+
+  bool offline() const { return offline_; }
+  void set_offline(bool offline);
+  // While offline, nothing is requested from the server: rooms are served from the cache, media from the disk cache
+  // only, and sends wait in the outbox
+  bool can_send() const { return !offline_ && !catching_up_; }
+  // False until a sync succeeds after starting or coming back online, so catching up isn't delayed by the outbox
   std::vector<Room *> rooms();
   Room *room_from_id(const RoomID &r) {
     auto it = rooms_.find(r);
@@ -110,10 +152,25 @@ public:
 
   ContentFetch *get_thumbnail(const Content &, const QSize &size, ThumbnailMethod method = ThumbnailMethod::SCALE);
 
+  ContentDownload *download(const Content &, QIODevice &sink, qint64 offset = 0);
+  // Writes content to sink as it arrives, holding only a bounded amount in memory. If offset is nonzero, sink must
+  // already contain that many bytes of the content and be positioned after them. Interrupted transfers are resumed
+  // automatically. sink must remain open until finished or error is emitted.
+
   ContentPost *upload(QIODevice &data, const QString &content_type, const QString &filename);
 
   QString get_transaction_id();
 
+  void store_pending(const RoomID &room, const Room::PendingEvent &event);
+  void discard_pending(const RoomID &room, const QString &transaction_id);
+  std::vector<Room::PendingEvent> load_pending(const RoomID &room);
+  // Outbox of events not yet acknowledged by the server, in order of transaction ID. Unlike the cache, this is never
+  // discarded.
+
+  void store_layout(const QJsonObject &layout);
+  QJsonObject load_layout();
+  // Opaque description of the user's open windows, kept alongside the outbox
+
   JoinRequest *join(const QString &id_or_alias);
 
   QUrl ensure_http(const QUrl &) const;
@@ -121,13 +178,36 @@ public:
 
   void cache_state(const Room &room);
 
+  void index(const RoomID &room, gsl::span<const event::Room> events);
+  // Adds events to the search index. Those arriving while a sync is applied are indexed together once it's committed.
+
+  std::vector<SearchIndex::Hit> search(const QString &query, size_t limit = 100);
+  // Searches cached messages in all rooms
+
+  const PushRules &push_rules() const { return push_rules_; }
+
+  void apply_sync(const QJsonObject &response);
+  // Processes a sync response as though it had just arrived, for tools that supply their own. Throws
+  // lmdb::runtime_error if the cache can't be updated.
+
+  struct SyncStats {
+    uint64_t syncs = 0, bytes = 0;
+    std::chrono::nanoseconds parse{0}, dispatch{0}, commit{0};
+    std::chrono::nanoseconds round_trip{0};
+    // From request to response, including any time the server held a long poll
+  };
+  const SyncStats &sync_stats() const { return sync_stats_; }
+  // Cumulative cost of the syncs processed so far, for profiling
+
 signals:
   void logged_out();
   void error(QString message);
   void synced_changed();
   void joined(matrix::Room &room);
+  void push_rules_changed();
   void sync_progress(qint64 received, qint64 total);
   void sync_complete();
+  void offline_changed();
 
 private:
   Matrix &universe_;
@@ -136,24 +216,50 @@ private:
   QString access_token_;
   lmdb::env env_;
   lmdb::dbi state_db_, room_db_;
+  SearchIndex search_index_;
+  std::vector<SearchIndex::Entry> unindexed_;  // Collected while a sync is applied
+  PushRules push_rules_;
+  lmdb::env data_env_;
+  lmdb::dbi data_db_, outbox_db_;
+  // Durable storage for things that can't be recovered from the server
   size_t buffer_size_;
   std::unordered_map<RoomID, Room> rooms_;
   bool synced_;
+  bool offline_ = false;
+  bool catching_up_ = true;
   std::experimental::optional<SyncCursor> next_batch_;
+  struct CachedContent {
+    QString type, disposition;
+    QByteArray data;
+  };
+  QCache<QString, CachedContent> thumbnails_;
+  // Recently fetched thumbnails, so that e.g. avatars are shared between views and can be fetched ahead of time
+  std::unordered_map<QString, ContentFetch *, QStringHash> thumbnail_fetches_;
+  // In flight, by the same key as thumbnails_, so that callers asking again before a reply arrives share it
+
   lmdb::txn *active_txn_ = nullptr;
-  QNetworkReply *sync_reply_;
+  QNetworkReply *sync_reply_ = nullptr;  // In flight, if any
+  QElapsedTimer sync_sent_;
   QTimer sync_retry_timer_;
+  QUrlQuery resume_query_;  // For the first sync after starting or coming back online
+  SyncStats sync_stats_;
 
   std::chrono::steady_clock::time_point last_sync_error_;
   // Last time a sync failed. Used to ensure we don't spin if errors happen quickly.
 
   QNetworkRequest request(const QString &path, QUrlQuery query = QUrlQuery(), const QString &content_type = "application/json");
+  QNetworkReply *get_media(const QString &path, QUrlQuery query = QUrlQuery());
+  // Content never changes, so any cached copy will do
 
   void sync();
   void sync(QUrlQuery query);
   void handle_sync_reply();
   void dispatch(lmdb::txn &txn, proto::Sync sync);
   void cache_state(lmdb::txn &txn, const Room &room);
+  void download_from(ContentDownload *download);
+  bool drain_download(ContentDownload *download);
+  void flush_read_receipts();
+  // Sends pending read receipts and waits briefly for them to complete, for use once the main event loop has exited
 };
 
 }
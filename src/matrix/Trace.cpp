@@ -0,0 +1,163 @@
+#include "Trace.hpp"
+
+namespace matrix {
+namespace trace {
+
+std::atomic<const char *> &current_operation() {
+  thread_local std::atomic<const char *> operation{nullptr};
+  return operation;
+}
+
+}
+}
+
+#ifdef NACHAT_TRACING
+
+#include <chrono>
+#include <mutex>
+#include <atomic>
+#include <vector>
+#include <cstdio>
+
+#include <QCoreApplication>
+#include <QThread>
+#include <QFile>
+#include <QDebug>
+
+namespace matrix {
+namespace trace {
+
+namespace {
+
+constexpr size_t FLUSH_THRESHOLD = 1 << 14;
+// Records buffered before being written out, bounding both memory use and how often a span pays for I/O
+
+struct Record {
+  const char *name;
+  QString detail;
+  int64_t start, duration;      // Nanoseconds
+  uint32_t thread;
+};
+
+QByteArray escaped(const QString &s) {
+  QByteArray result;
+  for(const char c : s.toUtf8()) {
+    if(c == '"' || c == '\\') {
+      result += '\\';
+      result += c;
+    } else if(static_cast<unsigned char>(c) < 0x20) {
+      char buf[8];
+      std::snprintf(buf, sizeof(buf), "\\u%04x", c);
+      result += buf;
+    } else {
+      result += c;
+    }
+  }
+  return result;
+}
+
+class Writer {
+public:
+  Writer() : epoch_{std::chrono::steady_clock::now()}, file_{QString::fromLocal8Bit(qgetenv("NACHAT_TRACE_FILE"))} {
+    if(file_.fileName().isEmpty()) return;
+    if(!file_.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+      qWarning() << "couldn't open trace file" << file_.fileName() << ":" << file_.errorString();
+      return;
+    }
+    qDebug() << "tracing to" << file_.fileName();
+    file_.write("[\n");
+    open_ = true;
+  }
+
+  ~Writer() {
+    // The array is left unterminated, which the format permits, so that a crash loses only unflushed records
+    std::lock_guard<std::mutex> lock(mutex_);
+    write();
+  }
+
+  bool open() const { return open_; }
+
+  int64_t now() const {
+    return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch_).count();
+  }
+
+  uint32_t thread() {
+    thread_local uint32_t id = 0;
+    if(id == 0) {
+      id = next_thread_++;
+      QString name = QThread::currentThread()->objectName();
+      if(QCoreApplication::instance() && QThread::currentThread() == QCoreApplication::instance()->thread()) {
+        name = "main";
+      } else if(name.isEmpty()) {
+        name = QString("thread %1").arg(id);
+      }
+      std::lock_guard<std::mutex> lock(mutex_);
+      thread_names_.emplace_back(id, std::move(name));
+    }
+    return id;
+  }
+
+  void add(Record &&r) {
+    std::lock_guard<std::mutex> lock(mutex_);
+    records_.push_back(std::move(r));
+    if(records_.size() >= FLUSH_THRESHOLD) write();
+  }
+
+private:
+  const std::chrono::steady_clock::time_point epoch_;
+  QFile file_;
+  bool open_ = false;
+  std::atomic<uint32_t> next_thread_{1};
+  std::mutex mutex_;
+  std::vector<Record> records_;
+  std::vector<std::pair<uint32_t, QString>> thread_names_;  // Not yet written
+
+  void write() {
+    if(!open_) return;
+    const qint64 pid = QCoreApplication::applicationPid();
+    QByteArray out;
+    char buf[160];
+    for(const auto &t : thread_names_) {
+      std::snprintf(buf, sizeof(buf), "{\"ph\":\"M\",\"name\":\"thread_name\",\"pid\":%lld,\"tid\":%u,\"args\":{\"name\":\"",
+                    static_cast<long long>(pid), t.first);
+      out += buf;
+      out += escaped(t.second);
+      out += "\"}},\n";
+    }
+    thread_names_.clear();
+    for(const auto &r : records_) {
+      std::snprintf(buf, sizeof(buf), "{\"ph\":\"X\",\"pid\":%lld,\"tid\":%u,\"ts\":%.3f,\"dur\":%.3f,\"name\":\"",
+                    static_cast<long long>(pid), r.thread, r.start / 1e3, r.duration / 1e3);
+      out += buf;
+      out += r.name;
+      if(r.detail.isEmpty()) {
+        out += "\"},\n";
+      } else {
+        out += "\",\"args\":{\"detail\":\"";
+        out += escaped(r.detail);
+        out += "\"}},\n";
+      }
+    }
+    records_.clear();
+    file_.write(out);
+    file_.flush();
+  }
+};
+
+Writer writer;
+
+}
+
+bool enabled() { return writer.open(); }
+
+int64_t Span::now() { return writer.now(); }
+
+void Span::finish() {
+  const auto end = writer.now();
+  writer.add(Record{name_, std::move(detail_), start_, end - start_, writer.thread()});
+}
+
+}
+}
+
+#endif
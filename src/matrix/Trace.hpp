@@ -0,0 +1,92 @@
+#ifndef NATIVE_CHAT_MATRIX_TRACE_HPP_
+#define NATIVE_CHAT_MATRIX_TRACE_HPP_
+
+#include <cstdint>
+#include <atomic>
+
+#include <QString>
+
+// Scoped spans around hot paths, written as Chrome trace events for viewing in Perfetto or chrome://tracing.
+//
+// Spans exist only in builds configured with NACHAT_TRACING; otherwise TRACE_SCOPE expands to nothing and its arguments
+// are never evaluated. When compiled in, events are recorded only if NACHAT_TRACE_FILE names a writable file at startup,
+// and a span costs a clock read and a branch when it isn't.
+//
+// Operations are coarser spans that are also marked in every build, at the cost of two relaxed stores, so that a stall
+// can be attributed to whatever was running when it was noticed.
+
+namespace matrix {
+namespace trace {
+
+std::atomic<const char *> &current_operation();
+// Name of the innermost operation running on the calling thread, or null. Other threads may read it through the
+// reference.
+
+class Operation {
+public:
+  explicit Operation(const char *name)
+    : slot_(current_operation()), previous_{slot_.exchange(name, std::memory_order_relaxed)} {}
+  ~Operation() { slot_.store(previous_, std::memory_order_relaxed); }
+
+  Operation(const Operation &) = delete;
+  Operation &operator=(const Operation &) = delete;
+
+private:
+  std::atomic<const char *> &slot_;
+  const char *previous_;
+};
+
+}
+}
+
+#define NACHAT_TRACE_CONCAT_(a, b) a##b
+#define NACHAT_TRACE_CONCAT(a, b) NACHAT_TRACE_CONCAT_(a, b)
+#define NACHAT_TRACE_FIRST_(first, ...) first
+
+#ifdef NACHAT_TRACING
+
+namespace matrix {
+namespace trace {
+
+bool enabled();
+
+class Span {
+public:
+  explicit Span(const char *name) : name_{name}, start_{enabled() ? now() : -1} {}
+  Span(const char *name, const QString &detail) : name_{name}, start_{enabled() ? now() : -1} {
+    if(start_ >= 0) detail_ = detail;
+  }
+  // name must outlive the trace, as with a string literal
+
+  ~Span() { if(start_ >= 0) finish(); }
+
+  Span(const Span &) = delete;
+  Span &operator=(const Span &) = delete;
+
+private:
+  const char *name_;
+  QString detail_;
+  int64_t start_;               // Nanoseconds since the trace began, or negative if not recording
+
+  static int64_t now();
+  void finish();
+};
+
+}
+}
+
+#define TRACE_SCOPE(...) ::matrix::trace::Span NACHAT_TRACE_CONCAT(trace_span_, __LINE__){__VA_ARGS__}
+// Records a span from here to the end of the enclosing block, named by a string literal and optionally annotated
+
+#else
+
+#define TRACE_SCOPE(...) do {} while(0)
+
+#endif
+
+#define TRACE_OPERATION(...) \
+  ::matrix::trace::Operation NACHAT_TRACE_CONCAT(trace_operation_, __LINE__){NACHAT_TRACE_FIRST_(__VA_ARGS__, "")}; \
+  TRACE_SCOPE(__VA_ARGS__)
+// As TRACE_SCOPE, additionally marking the operation in builds without tracing
+
+#endif
@@ -0,0 +1,204 @@
+#include "UploadQueue.hpp"
+
+#include <QtConcurrent>
+#include <QFutureWatcher>
+#include <QFile>
+#include <QFileInfo>
+#include <QBuffer>
+#include <QImage>
+#include <QImageReader>
+#include <QMimeDatabase>
+#include <QJsonObject>
+#include <QDebug>
+
+#include "Room.hpp"
+#include "Session.hpp"
+
+namespace matrix {
+
+static constexpr size_t DEFAULT_MAX_PARALLEL = 3;
+
+static const QSize THUMBNAIL_SIZE(800, 600);
+
+static QByteArray encode_image(const QImage &image, QString &type) {
+  QByteArray result;
+  QBuffer buffer(&result);
+  buffer.open(QIODevice::WriteOnly);
+  if(image.hasAlphaChannel()) {
+    image.save(&buffer, "PNG");
+    type = "image/png";
+  } else {
+    image.save(&buffer, "JPEG", 85);
+    type = "image/jpeg";
+  }
+  return result;
+}
+
+static UploadQueue::Prepared prepare(QString path, QString media_type, QSize max_size) {
+  // Runs on a worker thread, so must not touch the queue
+  UploadQueue::Prepared result;
+  result.media_type = media_type;
+  if(!media_type.startsWith("image/")) return result;
+
+  QImageReader reader(path);
+  reader.setAutoTransform(true);
+  QImage image = reader.read();
+  if(image.isNull()) {
+    qDebug() << "uploading" << path << "without image info due to decode error:" << reader.errorString();
+    return result;
+  }
+  result.dimensions = image.size();
+
+  if(max_size.isValid() && (image.width() > max_size.width() || image.height() > max_size.height())) {
+    image = image.scaled(max_size, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    result.data = encode_image(image, result.media_type);
+    result.dimensions = image.size();
+  }
+
+  if(image.width() > THUMBNAIL_SIZE.width() || image.height() > THUMBNAIL_SIZE.height()) {
+    const QImage thumbnail = image.scaled(THUMBNAIL_SIZE, Qt::KeepAspectRatio, Qt::SmoothTransformation);
+    result.thumbnail = encode_image(thumbnail, result.thumbnail_type);
+    result.thumbnail_dimensions = thumbnail.size();
+  }
+
+  return result;
+}
+
+UploadQueue::UploadQueue(Room &room, QObject *parent) : QObject(parent), room_(room), max_parallel_(DEFAULT_MAX_PARALLEL) {}
+
+void UploadQueue::enqueue(const QString &path) {
+  const QFileInfo info(path);
+  auto item = std::make_shared<Item>();
+  item->path = path;
+  item->name = info.fileName();
+  item->stage = Stage::PREPARING;
+  item->size = info.size();
+  items_.push_back(item);
+
+  auto watcher = new QFutureWatcher<Prepared>(this);
+  connect(watcher, &QFutureWatcherBase::finished, this, [this, item, watcher]() {
+      watcher->deleteLater();
+      item->prepared = watcher->result();
+      if(!item->prepared.data.isEmpty()) item->size = item->prepared.data.size();
+      item->stage = Stage::READY;
+      update_progress();
+      pump();
+    });
+  watcher->setFuture(QtConcurrent::run(prepare, path, QMimeDatabase().mimeTypeForFile(info).name(), max_image_size_));
+  update_progress();
+}
+
+void UploadQueue::pump() {
+  for(const auto &item : items_) {
+    if(uploading_ >= max_parallel_) break;
+    if(item->stage == Stage::READY && start_upload(item)) ++uploading_;
+  }
+  flush();
+}
+
+bool UploadQueue::start_upload(const std::shared_ptr<Item> &item) {
+  std::shared_ptr<QIODevice> device;
+  if(item->prepared.data.isEmpty()) {
+    auto file = std::make_shared<QFile>(item->path);
+    if(!file->open(QIODevice::ReadOnly)) {
+      item->stage = Stage::FAILED;
+      error(item->path, file->errorString());
+      return false;
+    }
+    device = file;
+  } else {
+    auto buffer = std::make_shared<QBuffer>();
+    buffer->setData(item->prepared.data);
+    buffer->open(QIODevice::ReadOnly);
+    device = buffer;
+  }
+
+  item->stage = Stage::UPLOADING;
+  post(item, device, item->prepared.media_type, false);
+
+  if(!item->prepared.thumbnail.isEmpty()) {
+    auto buffer = std::make_shared<QBuffer>();
+    buffer->setData(item->prepared.thumbnail);
+    buffer->open(QIODevice::ReadOnly);
+    post(item, buffer, item->prepared.thumbnail_type, true);
+  }
+  return true;
+}
+
+void UploadQueue::post(const std::shared_ptr<Item> &item, std::shared_ptr<QIODevice> device, const QString &type, bool thumbnail) {
+  auto reply = room_.session().upload(*device, type, item->name);
+  ++item->uploads_pending;
+  // This closure captures 'device' to ensure it outlives the network request, which may outlive the queue
+  connect(reply, &QObject::destroyed, [device]() {});
+  connect(reply, &ContentPost::success, this, [this, item, thumbnail](const QString &uri) {
+      (thumbnail ? item->thumbnail_uri : item->uri) = uri;
+      upload_finished(item);
+    });
+  connect(reply, &ContentPost::error, this, [this, item, thumbnail](const QString &msg) {
+      if(thumbnail) {
+        qDebug() << "sending" << item->path << "without thumbnail due to upload error:" << msg;
+      } else {
+        item->stage = Stage::FAILED;
+        error(item->path, msg);
+      }
+      upload_finished(item);
+    });
+  connect(reply, &ContentPost::progress, this, [this, item, thumbnail](qint64 completed, qint64 total) {
+      (void)total;
+      item->sent[thumbnail ? 1 : 0] = completed;
+      update_progress();
+    });
+}
+
+void UploadQueue::upload_finished(const std::shared_ptr<Item> &item) {
+  if(--item->uploads_pending != 0) return;
+  --uploading_;
+  if(item->stage != Stage::FAILED) item->stage = Stage::DONE;
+  pump();
+}
+
+void UploadQueue::flush() {
+  // Events are only sent once everything ahead of them is, to preserve ordering
+  bool popped = false;
+  while(!items_.empty()) {
+    const auto &item = *items_.front();
+    if(item.stage == Stage::DONE) {
+      send(item);
+    } else if(item.stage != Stage::FAILED) {
+      break;
+    }
+    items_.pop_front();
+    popped = true;
+  }
+  if(!popped) return;
+  update_progress();
+  if(items_.empty()) finished();
+}
+
+void UploadQueue::send(const Item &item) {
+  const auto &p = item.prepared;
+  if(!p.dimensions.isValid()) {
+    room_.send_file(item.uri, item.name, p.media_type, item.size);
+    return;
+  }
+  QJsonObject thumbnail_info;
+  if(!item.thumbnail_uri.isEmpty()) {
+    thumbnail_info = QJsonObject{
+      {"mimetype", p.thumbnail_type},
+      {"size", p.thumbnail.size()},
+      {"w", p.thumbnail_dimensions.width()},
+      {"h", p.thumbnail_dimensions.height()}};
+  }
+  room_.send_image(item.uri, item.name, p.media_type, item.size, p.dimensions, item.thumbnail_uri, thumbnail_info);
+}
+
+void UploadQueue::update_progress() {
+  qint64 completed = 0, total = 0;
+  for(const auto &item : items_) {
+    total += item->size + item->prepared.thumbnail.size();
+    completed += item->sent[0] + item->sent[1];
+  }
+  progress(completed, total);
+}
+
+}
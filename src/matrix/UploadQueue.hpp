@@ -0,0 +1,80 @@
+#ifndef NATIVE_CHAT_MATRIX_UPLOAD_QUEUE_HPP_
+#define NATIVE_CHAT_MATRIX_UPLOAD_QUEUE_HPP_
+
+#include <deque>
+#include <memory>
+
+#include <QObject>
+#include <QString>
+#include <QSize>
+#include <QByteArray>
+
+class QIODevice;
+
+namespace matrix {
+
+class Room;
+
+class UploadQueue : public QObject {
+  Q_OBJECT
+
+public:
+  struct Prepared {
+    QString media_type;
+    QByteArray data;            // Replacement content, e.g. a downscaled image; empty to upload the file as-is
+    QSize dimensions;           // Invalid if not an image
+    QByteArray thumbnail;       // Empty if none is needed
+    QString thumbnail_type;
+    QSize thumbnail_dimensions;
+  };
+
+  explicit UploadQueue(Room &room, QObject *parent = nullptr);
+
+  void enqueue(const QString &path);
+  // Files are uploaded concurrently, but their events are sent in the order they were enqueued
+
+  size_t size() const { return items_.size(); }
+
+  size_t max_parallel() const { return max_parallel_; }
+  void set_max_parallel(size_t n) { max_parallel_ = n; pump(); }
+
+  const QSize &max_image_size() const { return max_image_size_; }
+  void set_max_image_size(const QSize &size) { max_image_size_ = size; }
+  // Images larger than this are downscaled before upload. Invalid size disables downscaling.
+
+signals:
+  void progress(qint64 completed, qint64 total);
+  void error(const QString &path, const QString &message);
+  void finished();
+
+private:
+  enum class Stage { PREPARING, READY, UPLOADING, DONE, FAILED };
+
+  struct Item {
+    QString path, name;
+    Stage stage;
+    Prepared prepared;
+    qint64 size;                // Size of the uploaded content, excluding thumbnail
+    qint64 sent[2] = {0, 0};    // Progress of content and thumbnail uploads
+    unsigned uploads_pending = 0;
+    QString uri, thumbnail_uri;
+  };
+
+  Room &room_;
+  size_t max_parallel_;
+  QSize max_image_size_;
+  size_t uploading_ = 0;       // Items in the UPLOADING stage
+  std::deque<std::shared_ptr<Item>> items_;
+
+  void pump();
+  bool start_upload(const std::shared_ptr<Item> &item);
+  void post(const std::shared_ptr<Item> &item, std::shared_ptr<QIODevice> device, const QString &type, bool thumbnail);
+  void upload_finished(const std::shared_ptr<Item> &item);
+  void flush();
+  void send(const Item &item);
+  void update_progress();
+};
+
+}
+
+#endif
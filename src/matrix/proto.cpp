@@ -3,6 +3,8 @@
 #include <QJsonArray>
 #include <QDebug>
 
+#include "Trace.hpp"
+
 namespace matrix {
 
 using namespace proto;
@@ -33,8 +35,10 @@ JoinedRoom parse_joined_room(QString id, QJsonValue v) {
   JoinedRoom room{RoomID{id}, parse_timeline(o["timeline"])};
 
   auto un = o["unread_notifications"].toObject();
-  room.unread_notifications.highlight_count = un["highlight_count"].toDouble();
-  room.unread_notifications.notification_count = un["notification_count"].toDouble();
+  if(un.contains("highlight_count") || un.contains("notification_count")) {
+    room.unread_notifications = UnreadNotifications{static_cast<uint64_t>(un["highlight_count"].toDouble()),
+                                                    static_cast<uint64_t>(un["notification_count"].toDouble())};
+  }
   room.state.events = parse_array(o["state"].toObject()["events"], [](QJsonValue v) {
       return event::room::State(event::Room(event::Identifiable(Event(v.toObject()))));
     });
@@ -49,6 +53,7 @@ JoinedRoom parse_joined_room(QString id, QJsonValue v) {
 }
 
 Sync parse_sync(QJsonValue v) {
+  TRACE_OPERATION("parse_sync");
   auto o = v.toObject();
   Sync sync{SyncCursor{o["next_batch"].toString()}};
   QJsonObject::iterator i;
@@ -72,6 +77,9 @@ Sync parse_sync(QJsonValue v) {
   sync.presence.events = parse_array(o["presence"].toObject()["events"], [](QJsonValue v) {
       return Event(v.toObject());
     });
+  sync.account_data.events = parse_array(o["account_data"].toObject()["events"], [](QJsonValue v) {
+      return Event(v.toObject());
+    });
 
   return sync;
 }
@@ -2,6 +2,7 @@
 #define NATIVE_CHAT_MATRIX_PROTO_HPP_
 
 #include <vector>
+#include <experimental/optional>
 
 #include <QString>
 
@@ -45,7 +46,7 @@ struct Ephemeral {
 
 struct JoinedRoom {
   RoomID id;
-  UnreadNotifications unread_notifications;
+  std::experimental::optional<UnreadNotifications> unread_notifications;  // Absent if the server doesn't count them
   Timeline timeline;
   State state;
   AccountData account_data;
@@ -79,6 +80,7 @@ struct Rooms {
 struct Sync {
   SyncCursor next_batch;
   Presence presence;
+  AccountData account_data;
   Rooms rooms;
 
   explicit Sync(SyncCursor &&next) : next_batch{std::move(next)} {}
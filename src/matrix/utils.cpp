@@ -4,6 +4,8 @@
 #include <QJsonDocument>
 #include <QObject>
 
+#include "Trace.hpp"
+
 namespace matrix {
 
 QByteArray encode(QJsonObject o) {
@@ -11,6 +13,7 @@ QByteArray encode(QJsonObject o) {
 }
 
 Response decode(QNetworkReply *reply) {
+  TRACE_SCOPE("decode");
   Response r;
   auto data = reply->readAll();
   r.code = reply->attribute(QNetworkRequest::HttpStatusCodeAttribute).toInt();
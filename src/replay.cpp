@@ -0,0 +1,94 @@
+#include <cstdio>
+#include <memory>
+
+#include <QCoreApplication>
+#include <QCommandLineParser>
+#include <QStandardPaths>
+#include <QElapsedTimer>
+#include <QDir>
+
+#include "matrix/Matrix.hpp"
+#include "matrix/Session.hpp"
+#include "matrix/Capture.hpp"
+
+// Feeds a capture recorded with NACHAT_RECORD through a headless session, with a fresh cache each run, and reports
+// where the time went.
+
+static double ms(std::chrono::nanoseconds t) {
+  return std::chrono::duration<double, std::milli>(t).count();
+}
+
+static void report(const matrix::Session &session, qint64 wall_ms) {
+  const auto &stats = session.sync_stats();
+  std::printf("syncs: %llu (%.1f MB) in %lld ms\n", static_cast<unsigned long long>(stats.syncs),
+              stats.bytes / (1024.0 * 1024.0), static_cast<long long>(wall_ms));
+  if(stats.syncs == 0) return;
+  const auto n = static_cast<double>(stats.syncs);
+  std::printf("  parse:    %9.1f ms total, %7.2f ms/sync\n", ms(stats.parse), ms(stats.parse) / n);
+  std::printf("  dispatch: %9.1f ms total, %7.2f ms/sync\n", ms(stats.dispatch), ms(stats.dispatch) / n);
+  std::printf("  commit:   %9.1f ms total, %7.2f ms/sync\n", ms(stats.commit), ms(stats.commit) / n);
+}
+
+int main(int argc, char *argv[]) {
+  QCoreApplication::setOrganizationName("nachat");
+  QCoreApplication::setApplicationName("nachat-replay");
+  QCoreApplication app(argc, argv);
+
+  QCommandLineParser parser;
+  parser.setApplicationDescription("Replays recorded server traffic and times its processing");
+  parser.addHelpOption();
+  parser.addPositionalArgument("capture", "File written by nachat with NACHAT_RECORD set");
+  parser.addPositionalArgument("user", "Matrix ID of the account that was recorded");
+  QCommandLineOption realtime("realtime", "Replay at the recorded pace rather than as fast as possible");
+  QCommandLineOption history("history", "Once synced, page back once in every room");
+  parser.addOption(realtime);
+  parser.addOption(history);
+  parser.process(app);
+  const auto args = parser.positionalArguments();
+  if(args.size() != 2) parser.showHelp(1);
+
+  // Keep away from the real cache, and start empty so the first sync is processed as a full one
+  QStandardPaths::setTestModeEnabled(true);
+  QDir(QStandardPaths::writableLocation(QStandardPaths::CacheLocation)).removeRecursively();
+  QDir(QStandardPaths::writableLocation(QStandardPaths::AppDataLocation)).removeRecursively();
+
+  matrix::capture::Replayer net(args[0], parser.isSet(realtime));
+  matrix::Matrix universe{net};
+
+  QElapsedTimer wall;
+  wall.start();
+  auto session = matrix::Session::create(universe, QUrl("https://replay.invalid"), matrix::UserID(args[1]), "replay");
+
+  QObject::connect(&net, &matrix::capture::Replayer::exhausted, [&]() {
+      report(*session, wall.elapsed());
+      if(!parser.isSet(history)) {
+        app.quit();
+        return;
+      }
+
+      auto pending = std::make_shared<size_t>(0);
+      auto events = std::make_shared<size_t>(0);
+      QElapsedTimer paging;
+      paging.start();
+      auto done = [&app, pending, events, paging]() {
+        if(--*pending != 0) return;
+        std::printf("history: %zu events in %lld ms\n", *events, static_cast<long long>(paging.elapsed()));
+        app.quit();
+      };
+      for(auto room : session->rooms()) {
+        if(room->buffer().empty()) continue;
+        auto fetch = room->get_messages(matrix::Direction::BACKWARD, room->buffer().front().prev_batch);
+        ++*pending;
+        QObject::connect(fetch, &matrix::MessageFetch::finished,
+                         [done, events](const matrix::TimelineCursor &, const matrix::TimelineCursor &,
+                                        gsl::span<const matrix::event::Room> batch) {
+                           *events += batch.size();
+                           done();
+                         });
+        QObject::connect(fetch, &matrix::MessageFetch::error, done);
+      }
+      if(*pending == 0) app.quit();
+    });
+
+  return app.exec();
+}
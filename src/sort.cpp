@@ -2,7 +2,7 @@
 
 QString room_sort_key(const QString &n) {
   int i = 0;
-  while((n[i] == '#' || n[i] == '@') && (i < n.size())) {
+  while(i < n.size() && (n[i] == '#' || n[i] == '@')) {
     ++i;
   }
   if(i == n.size()) return n.toCaseFolded();